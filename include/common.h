@@ -50,6 +50,7 @@ struct code_seg_t
 {
 	struct inst_t *text;
 	uint32_t size;
+	uint32_t refcnt; // Processes running this code, forked ones share it
 };
 
 struct trans_table_t
@@ -75,9 +76,12 @@ struct page_table_t
 	int size; // Number of row in the first layer
 };
 
+struct sim_ctx;
+
 /* PCB, describe information about a process */
 struct pcb_t
 {
+	struct sim_ctx *ctx;	 // Simulation the process belongs to
 	uint32_t pid;		 // PID
 	uint32_t priority;	 // Default priority, this legacy process based (FIXED)
 	char path[100];
@@ -101,6 +105,7 @@ struct pcb_t
 #endif
 	struct page_table_t *page_table; // Page table
 	uint32_t bp;			 // Break pointer
+	uint64_t wake_time;		 // Slot a blocked process is ready again
 };
 
 #endif
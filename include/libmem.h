@@ -15,6 +15,23 @@
 #define SYSMEM_SWP_OP 3
 #define SYSMEM_IO_READ 4
 #define SYSMEM_IO_WRITE 5
+#define SYSMEM_UNMAP_OP 6
+#define SYSMEM_SHMGET_OP 7
+#define SYSMEM_SHMAT_OP 8
+#define SYSMEM_SHMDT_OP 9
+#define SYSMEM_COMPACT_OP 10
+#define SYSMEM_IO_READV 11
+#define SYSMEM_IO_WRITEV 12
+
+/* Most segments moved by one SYSMEM_IO_READV or SYSMEM_IO_WRITEV */
+#define SYSMEM_IOV_MAX 16
+
+/* One physically contiguous piece of a vectored transfer */
+struct memio_vec {
+        uint32_t addr;
+        uint32_t len;
+        BYTE *buf;
+};
 
 extern struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
 int inc_vma_limit(struct pcb_t*, int, int);
@@ -23,3 +40,5 @@ int liballoc(struct pcb_t *, uint32_t, uint32_t);
 int libfree(struct pcb_t *, uint32_t);
 int libread(struct pcb_t*, uint32_t, uint32_t, uint32_t*);
 int libwrite(struct pcb_t*, BYTE, uint32_t, uint32_t);
+int libread_range(struct pcb_t*, uint32_t, uint32_t, BYTE*, uint32_t*);
+int libwrite_range(struct pcb_t*, const BYTE*, uint32_t*, uint32_t, uint32_t);
@@ -3,7 +3,16 @@
 
 #include "common.h"
 
-struct pcb_t * load(const char * path);
+struct sim_ctx;
+
+/* Read a process description, NULL if it is missing or malformed */
+struct pcb_t * load(struct sim_ctx * ctx, const char * path);
+
+/* Copy a PCB under a new PID, the code segment is shared */
+struct pcb_t * clone_pcb(struct pcb_t * parent);
+
+/* Drop a reference to a code segment, the last one frees it */
+void free_code(struct sim_ctx * ctx, struct code_seg_t * code);
 
 #endif
 
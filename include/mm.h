@@ -14,6 +14,13 @@
 #define PAGING_MAX_PGN  (DIV_ROUND_UP(BIT(PAGING_CPU_BUS_WIDTH),PAGING_PAGESZ))
 
 #define PAGING_SBRK_INIT_SZ PAGING_PAGESZ
+/* pg_getpage result: swap-in started, retry the access once it is done.
+ * Negative as -EAGAIN, run() returns 1 for a finished or bad instruction */
+#define PAGING_FAULT_WAIT (-11)
+/* Top of the virtual address space, the stack area grows down from here */
+#define PAGING_VMA_TOP (PAGING_MAX_PGN * PAGING_PAGESZ)
+/* Mappings are placed top-down from here, leaving the rest to the stack */
+#define PAGING_MMAP_BASE (PAGING_VMA_TOP - PAGING_VMA_TOP / 4)
 /* PTE BIT */
 #define PAGING_PTE_PRESENT_MASK BIT(31) 
 #define PAGING_PTE_SWAPPED_MASK BIT(30)
@@ -35,6 +42,9 @@
 /* SWPTYP */
 #define PAGING_PTE_SWPTYP_LOBIT 0
 #define PAGING_PTE_SWPTYP_HIBIT 4
+/* Swap types: a MEMSWP frame or an entry of the compressed swap cache */
+#define PAGING_SWPTYP_DEV   0
+#define PAGING_SWPTYP_ZSWAP 1
 /* SWPOFF */
 #define PAGING_PTE_SWPOFF_LOBIT 5
 #define PAGING_PTE_SWPOFF_HIBIT 25
@@ -50,6 +60,7 @@
 #define PAGING_PTE_PGN(pte)   GETVAL(pte,PAGING_PGN_MASK,PAGING_ADDR_PGN_LOBIT)
 #define PAGING_PTE_FPN(pte)   GETVAL(pte,PAGING_PTE_FPN_MASK,PAGING_PTE_FPN_LOBIT)
 #define PAGING_PTE_SWP(pte)   GETVAL(pte,PAGING_PTE_SWPOFF_MASK,PAGING_SWPFPN_OFFSET)
+#define PAGING_PTE_SWPTYP(pte) GETVAL(pte,PAGING_PTE_SWPTYP_MASK,PAGING_PTE_SWPTYP_LOBIT)
 
 /* OFFSET */
 #define PAGING_ADDR_OFFST_LOBIT 0
@@ -69,6 +80,24 @@
 #define PAGING_SWP(pte) ((pte&PAGING_PTE_SWPOFF_MASK) >> PAGING_SWPFPN_OFFSET)
 #define PAGING_PAGE_SWAPPED(pte) ((pte) & PAGING_PTE_SWAPPED_MASK)
 
+/* COW: resident page whose frame fork left shared, copied on first write.
+ * The bit overlaps the swap offset, so it only means something while the
+ * page is resident and pte_set_swap/pte_set_fpn drop it */
+#define PAGING_PTE_COW_MASK PAGING_PTE_EMPTY01_MASK
+#define PAGING_PAGE_COW(pte) (PAGING_PAGE_PRESENT(pte) && !PAGING_PAGE_SWAPPED(pte) && ((pte) & PAGING_PTE_COW_MASK))
+
+/* HUGE: head PTE of an aligned block of 2^HUGEPAGE_ORDER pages backed by
+ * a contiguous frame run, the other PTEs of the block stay empty. Like
+ * COW the bit overlaps the swap offset, huge pages are split before
+ * they are swapped out */
+#define PAGING_PTE_HUGE_MASK PAGING_PTE_EMPTY02_MASK
+#define PAGING_PAGE_HUGE(pte) (PAGING_PAGE_PRESENT(pte) && !PAGING_PAGE_SWAPPED(pte) && ((pte) & PAGING_PTE_HUGE_MASK))
+#ifdef HUGEPAGE_ORDER
+#define PAGING_HPAGE_NR BIT(HUGEPAGE_ORDER)
+#define PAGING_HPAGE_SZ (PAGING_HPAGE_NR * PAGING_PAGESZ)
+#define PAGING_HPAGE_BASE(pgn) ((pgn) & ~(PAGING_HPAGE_NR - 1))
+#endif
+
 /* Value operators */
 #define SETBIT(v,mask) (v=v|mask)
 #define CLRBIT(v,mask) (v=v&~mask)
@@ -94,15 +123,15 @@
 /* Extract SWAPTYPE */
 #define PAGING_FPN(x)  GETVAL(x,PAGING_PTE_FPN_MASK,PAGING_PTE_FPN_LOBIT)
 
-/* Memory range operator */
-/* TODO implement the INCLUDE and OVERLAP checking mechanism */
+/* Memory range operator on half-open ranges [x1,x2) and [y1,y2) */
 #define INCLUDE(x1,x2,y1,y2) ((y1 >= x1 && y2 <= x2) ? 1 : 0)
-#define OVERLAP(x1,x2,y1,y2) ((x1 <= y2 && x2 >= y1) ? 1 : 0)
+#define OVERLAP(x1,x2,y1,y2) ((x1 < y2 && x2 > y1) ? 1 : 0)
 
 /* VM region prototypes */
 struct vm_rg_struct * init_vm_rg(int rg_start, int rg_endi);
 int enlist_vm_rg_node(struct vm_rg_struct **rglist, struct vm_rg_struct* rgnode);
 int enlist_pgn_node(struct pgn_t **pgnlist, int pgn);
+int delist_pgn_node(struct pgn_t **pgnlist, int pgn);
 int vmap_page_range(struct pcb_t *caller, int addr, int pgnum, 
                     struct framephy_struct *frames, struct vm_rg_struct *ret_rg);
 int vm_map_ram(struct pcb_t *caller, int astart, int send, int mapstart, int incpgnum, struct vm_rg_struct *ret_rg);
@@ -120,9 +149,24 @@ int init_pte(uint32_t *pte,
              int swpoff); //swap offset
 int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr);
 int __free(struct pcb_t *caller, int vmaid, int rgid);
+int __mmap(struct pcb_t *caller, int rgid, int size, int *alloc_addr);
+int __munmap(struct pcb_t *caller, int rgid);
+int __shmget(struct pcb_t *caller, int key, int size);
+int __shmat(struct pcb_t *caller, int rgid, int key, int *alloc_addr);
+int free_pcb_memph(struct pcb_t *caller);
+int __dup_mm(struct pcb_t *caller, struct mm_struct *newmm);
+int cow_stat(struct sim_ctx *ctx, unsigned long *shared, unsigned long *copied);
+int enlist_mm_proc(struct pcb_t *proc);
+int delist_mm_proc(struct pcb_t *proc);
+int kswapd_balance(struct sim_ctx *ctx, struct memphy_struct *mram);
+int reclaim_stat(struct sim_ctx *ctx, unsigned long *kswapd, unsigned long *direct);
+int vm_unmap_range(struct pcb_t *caller, uint32_t start, uint32_t end);
 int __read(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *data);
 int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value);
+int __read_range(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *buf, int *len);
+int __write_range(struct pcb_t *caller, int vmaid, int rgid, int offset, const BYTE *buf, int *len);
 int init_mm(struct mm_struct *mm, struct pcb_t *caller);
+int free_mm(struct mm_struct *mm);
 
 /* VM prototypes */
 int pgalloc(struct pcb_t *proc, uint32_t size, uint32_t reg_index);
@@ -139,19 +183,87 @@ int pgwrite(
 		uint32_t offset);
 /* Local VM prototypes */
 struct vm_rg_struct * get_symrg_byid(struct mm_struct* mm, int rgid);
+struct vm_rg_struct * get_symrg_alloc(struct mm_struct* mm, int rgid);
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend);
+int __validate_overlap_vm_area(struct mm_struct *mm, int vmaid, unsigned long vmastart, unsigned long vmaend);
+struct vm_area_struct *create_vm_area(struct mm_struct *mm, unsigned long vmastart, unsigned long vmaend, unsigned long flags);
+int remove_vm_area(struct mm_struct *mm, int vmaid);
+struct vm_area_struct *vm_map_area(struct mm_struct *mm, unsigned long size);
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg);
+int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt);
+struct vm_rg_struct *vm_freerg_insert(struct vm_area_struct *vma, struct vm_rg_struct *rg_elmt);
+int vm_freerg_take(struct vm_area_struct *vma, int size, struct vm_rg_struct *newrg);
+int vm_freerg_stat(struct vm_area_struct *vma, struct vm_freerg_stat *stat);
+int vm_rss_stat(struct mm_struct *mm, int *rss_private, int *rss_shared);
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz);
-int find_victim_page(struct mm_struct* mm, int *pgn);
+int find_victim_page(struct mm_struct* mm, struct memphy_struct *mram, int *pgn);
+int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller);
+int pg_getfreefp(struct mm_struct *mm, int *fpn, struct pcb_t *caller);
+int pg_swapout(struct mm_struct *mm, int private, int *vicfpn, struct pcb_t *caller);
+int pg_cowpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller);
+int pg_hugepage_split(struct mm_struct *mm, int pgn);
+int tlb_flush(struct mm_struct *mm);
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid);
+struct vm_area_struct *get_vma_by_addr(struct mm_struct *mm, unsigned long addr);
+unsigned long vm_next_mapped(struct mm_struct *mm, unsigned long addr);
+
+/* Shared memory prototypes */
+struct shm_segment *shm_lookup(struct sim_ctx *ctx, int key);
+struct shm_segment *shm_create(struct sim_ctx *ctx, int key, int size);
+struct vm_area_struct *shm_attach(struct sim_ctx *ctx, struct mm_struct *mm, int key);
+int shm_detach(struct sim_ctx *ctx, struct vm_area_struct *vma);
+int shm_getpage(struct pcb_t *caller, struct vm_area_struct *vma, int pgn, int *fpn);
+int shm_cleanup(struct sim_ctx *ctx);
+int shm_rmap(struct sim_ctx *ctx, struct compact_control *cc);
+
+/* Compressed swap cache prototypes */
+int zswap_store(struct sim_ctx *ctx, struct memphy_struct *mram, int fpn, struct memphy_struct *mswp);
+int zswap_load(struct sim_ctx *ctx, int id, struct memphy_struct *mram, int fpn);
+int zswap_needs_io(struct sim_ctx *ctx, int id);
+int zswap_get(struct sim_ctx *ctx, int id);
+int zswap_put(struct sim_ctx *ctx, int id);
+int zswap_get_stat(struct sim_ctx *ctx, struct zswap_stat *stat);
+int zswap_cleanup(struct sim_ctx *ctx);
+struct snap;
+int zswap_snap(struct sim_ctx *ctx, struct snap *s);
+
+/* Compaction prototypes */
+int compact_frag_stat(struct memphy_struct *mram, int order, struct frag_stat *stat);
+int compact_init(struct compact_control *cc, struct memphy_struct *mram);
+int compact_add_pte(struct compact_control *cc, uint32_t *pte);
+int compact_add_slot(struct compact_control *cc, int *slot);
+int compact_run(struct compact_control *cc);
+int compact_free(struct compact_control *cc);
+int __compact_memory(struct sim_ctx *ctx, struct memphy_struct *mram, struct frag_stat *before, struct frag_stat *after);
+int compact_memory(struct sim_ctx *ctx, struct memphy_struct *mram, struct frag_stat *before, struct frag_stat *after);
+int compact_proactive(struct sim_ctx *ctx, struct memphy_struct *mram);
+int compact_stat(struct sim_ctx *ctx, unsigned long *runs, unsigned long *moved);
+
+/* Same-page merging prototypes */
+int ksm_merge_page(struct sim_ctx *ctx, struct memphy_struct *mram, struct mm_struct *mm, int pgn);
+int ksm_reset(struct sim_ctx *ctx);
+int ksm_cleanup(struct sim_ctx *ctx);
+int ksm_scan(struct sim_ctx *ctx, struct memphy_struct *mram, int nr_pages);
+int ksm_stat(struct sim_ctx *ctx, unsigned long *merged, unsigned long *freed, unsigned long *scanned,
+             unsigned long *slots, unsigned long *ns);
 
 /* MEM/PHY protypes */
 int MEMPHY_get_freefp(struct memphy_struct *mp, int *fpn);
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn);
+int MEMPHY_get_fp(struct memphy_struct *mp, int fpn);
+int MEMPHY_nr_freefp(struct memphy_struct *mp);
+int MEMPHY_rebuild_freelist(struct memphy_struct *mp);
+int MEMPHY_get_freerun(struct memphy_struct *mp, int order, int *retfpn);
 int MEMPHY_read(struct memphy_struct * mp, int addr, BYTE *value);
 int MEMPHY_write(struct memphy_struct * mp, int addr, BYTE data);
+int MEMPHY_read_range(struct memphy_struct *mp, int addr, BYTE *buf, int len);
+int MEMPHY_write_range(struct memphy_struct *mp, int addr, const BYTE *buf, int len);
+int MEMPHY_copy_frame(struct memphy_struct *mpsrc, int srcfpn,
+                      struct memphy_struct *mpdst, int dstfpn);
 int MEMPHY_dump(struct memphy_struct * mp);
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg);
+int init_memphy_file(struct memphy_struct *mp, int max_size, int randomflg, const char *path);
+int free_memphy(struct memphy_struct *mp);
 
 /* print list */
 int print_list_fp(struct framephy_struct *fp);
@@ -10,6 +10,25 @@
 //#define MMDBG 1
 #define IODUMP 1
 #define PAGETBL_DUMP 1
+//#define TRACE_LEVEL 4 /* default trace level instead of the one IODUMP and PAGETBL_DUMP give, see trace.h */
+#define MEMPHY_MMAP 1 /* back MEMPHY by anonymous mmap instead of malloc */
+//#define MEMPHY_SWPFILE "swapfile" /* back MEMSWP n by mmap of file swapfile.n */
+
+/* Experimental memory management, off by default */
+//#define MMSTAT 1 /* fault, reclaim, COW, zswap, compaction and KSM counters at exit */
+//#define KSWAPD 1 /* background page reclaim, a timer device of its own */
+#define KSWAPD_WMARK_LOW 5   /* wake below this percent of free MEMRAM frames */
+#define KSWAPD_WMARK_HIGH 10 /* reclaim until this percent is free again */
+//#define MEMSWP_LATENCY 2 /* slots a swap-in blocks the faulting process, undefine for synchronous faults */
+//#define ZSWAP 1 /* compressed in-RAM swap cache ahead of the MEMSWP devices */
+#define ZSWAP_POOL_SZ 512  /* bytes of compressed pages held before writing back */
+#define ZSWAP_MAX_LEN 192  /* pages compressing to more go straight to MEMSWP */
+//#define HUGEPAGE_ORDER 4 /* map aligned blocks of 2^order pages of large allocations with one PTE, undefine for base pages only */
+//#define TLB_ENTRIES 16 /* per process software TLB, undefine to walk the page table on every access */
+#define COMPACT_ORDER 4 /* compaction aims at free runs of 2^order frames */
+//#define COMPACT_PROACTIVE 500 /* kswapd compacts above this fragmentation index (0..1000), undefine for on demand only */
+//#define KSM 1 /* merge identical MEMRAM frames copy-on-write, a timer device of its own */
+#define KSM_PAGES_TO_SCAN 16 /* resident pages the scanner looks at per slot */
 
 // #define SCHED_TEST
 #endif
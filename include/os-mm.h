@@ -4,7 +4,9 @@
 
 #define MM_PAGING
 #define PAGING_MAX_MMSWP 4 /* max number of supported swapped space */
-#define PAGING_MAX_SYMTBL_SZ 30
+#define PAGING_SYMTBL_INIT_SZ 8   /* symbol table entries on first allocation */
+#define PAGING_MAX_SYMTBL_SZ 65536 /* region IDs range in [0, PAGING_MAX_SYMTBL_SZ) */
+#define PAGING_FREERG_NBINS 23 /* free region bin n holds sizes [2^n, 2^(n+1)) */
 
 typedef char BYTE;
 typedef uint32_t addr_t;
@@ -23,6 +25,29 @@ struct vm_rg_struct {
    unsigned long rg_end;
 
    struct vm_rg_struct *rg_next;
+
+   /* Free region links: address order and size bin */
+   struct vm_rg_struct *rg_prev;
+   struct vm_rg_struct *bin_next;
+   struct vm_rg_struct *bin_prev;
+};
+
+/* Memory area flags */
+#define VM_GROWSDOWN 0x1 /* area grows toward lower addresses (stack) */
+#define VM_MAPPED    0x2 /* anonymous area made by SYSMEM_MAP_OP */
+#define VM_SHARED    0x4 /* attached shared memory segment */
+
+/*
+ *  Shared memory segment, its frames are mapped by every attached area
+ */
+struct shm_segment {
+   int key;
+   int size;
+   int npages;
+   int *fpn;   /* MEMRAM frame of each page, -1 before the first touch */
+   int nattch; /* attached areas, the segment goes away with the last */
+   struct memphy_struct *mram;
+   struct shm_segment *next;
 };
 
 /*
@@ -32,6 +57,7 @@ struct vm_area_struct {
    unsigned long vm_id;
    unsigned long vm_start;
    unsigned long vm_end;
+   unsigned long vm_flags;
 
    unsigned long sbrk;
 /*
@@ -39,23 +65,119 @@ struct vm_area_struct {
  * unsigned long vm_limit = vm_end - vm_start
  */
    struct mm_struct *vm_mm;
+   /* Free regions kept in address order, coalesced with neighbours */
    struct vm_rg_struct *vm_freerg_list;
+   /* Same free regions segregated by size class */
+   struct vm_rg_struct *vm_freerg_bin[PAGING_FREERG_NBINS];
+   /* Backing segment of a VM_SHARED area */
+   struct shm_segment *vm_shm;
    struct vm_area_struct *vm_next;
 };
 
+/*
+ * Free region statistics of a memory area
+ */
+struct vm_freerg_stat {
+   int nr_regions;
+   unsigned long total;
+   unsigned long largest;
+   int frag_pct; /* external fragmentation: 100 * (1 - largest / total) */
+};
+
+/*
+ * Free frame runs of a memory device
+ */
+struct frag_stat {
+   int nr_free;
+   int nr_runs;
+   int largest;
+   int unusable_pct; /* free frames outside runs of the asked size */
+   int frag_index;   /* 0..1000, high when a failed run is due to fragmentation, -1 if a run fits */
+};
+
+/*
+ * Compressed swap cache statistics
+ */
+struct zswap_stat {
+   unsigned long stored;       /* pages taken into the pool */
+   unsigned long zero_pages;   /* of which zero-filled, stored without data */
+   unsigned long rejected;     /* pages left to the swap device */
+   unsigned long written_back; /* pages pushed out of the pool */
+   unsigned long orig_bytes;   /* size of the stored pages */
+   unsigned long comp_bytes;   /* size they compressed to */
+   unsigned long hits;         /* loads served from the pool */
+   unsigned long misses;       /* loads read back from the swap device */
+   unsigned long pool_bytes;   /* current pool usage */
+   int pool_pages;
+};
+
+/*
+ * Software TLB entry, tag is (page or huge block number << 1 | huge) + 1
+ * and 0 while the entry is empty
+ */
+struct tlb_entry {
+   uint32_t tag;
+   int fpn;
+   int writable;
+};
+
+/*
+ * Reverse map of MEMRAM frames collected for one compaction pass
+ */
+struct compact_control {
+   struct memphy_struct *mram;
+   int nrfp;
+   int *head;           /* first mapping of each frame, -1 if none */
+   unsigned int *nref;  /* mappings found, compared against fp_refcnt */
+   struct rmap_item *items;
+   int nr_items;
+   int cap;
+};
+
 /* 
  * Memory management struct
  */
 struct mm_struct {
    uint32_t *pgd;
 
+   /* All vm areas linked in address order */
    struct vm_area_struct *mmap;
 
-   /* Currently we support a fixed number of symbol */
-   struct vm_rg_struct symrgtbl[PAGING_MAX_SYMTBL_SZ];
+   /* Same areas sorted by (vm_start, vm_end) and by vm_id for lookups */
+   struct vm_area_struct **vma_addr;
+   struct vm_area_struct **vma_id;
+   int vma_cnt;
+   int vma_cap;
+   unsigned long vma_next_id;
+
+   /* Symbol table indexed by region ID, grown on demand by __alloc.
+    * An entry with rg_start == rg_end is not allocated */
+   struct vm_rg_struct *symrgtbl;
+   int symrgtbl_sz;
 
    /* list of free page */
    struct pgn_t *fifo_pgn;
+
+   /* Page fault counters: minor (demand-zero) and major (swap-in) */
+   uint32_t minflt;
+   uint32_t majflt;
+   /* Writes to copy-on-write pages left by fork */
+   uint32_t cowflt;
+
+   /* Swap-in in flight: page and the slot its transfer completes */
+   int pf_pgn;
+   uint64_t pf_ready;
+
+   /* Huge pages mapped on fault and split back to base pages */
+   uint32_t thpflt;
+   uint32_t thpsplit;
+
+#ifdef TLB_ENTRIES
+   /* Direct mapped translations, huge and base pages share the slots */
+   struct tlb_entry tlb[TLB_ENTRIES];
+   uint32_t tlb_hit;
+   uint32_t tlb_miss;
+#endif
 };
 
 /*
@@ -69,18 +191,44 @@ struct framephy_struct {
    struct mm_struct* owner;
 };
 
+/* MEMPHY storage backends */
+#define MEMPHY_BACKEND_HEAP 0 /* malloc'd and zeroed up front */
+#define MEMPHY_BACKEND_ANON 1 /* anonymous mmap, zero pages on first touch */
+#define MEMPHY_BACKEND_FILE 2 /* mmap of a sparse swap file */
+
 struct memphy_struct {
    /* Basic field of data and size */
    BYTE *storage;
    int maxsz;
+
+   /* Storage backend and its swap file (MEMPHY_BACKEND_FILE only) */
+   int backend;
+   int fd;
+   char *path;
    
    /* Sequential device fields */ 
    int rdmflg;
    int cursor;
+   unsigned long seekdist; /* total cursor travel */
+   unsigned long seekcnt;  /* number of seeks */
 
    /* Management structure */
    struct framephy_struct *free_fp_list;
    struct framephy_struct *used_fp_list;
+
+   /* Frames from fp_hiwm up to maxsz / PAGESZ were never handed out and
+    * are free without being listed in free_fp_list */
+   int fp_hiwm;
+   int free_fp_cnt; /* listed plus never used frames */
+
+   /* Mappings of each frame, a frame is free again when it drops to 0 */
+   unsigned int *fp_refcnt;
+
+   /* Non-zero bytes of each frame and the frames written since the last
+    * diff dump, so that dumps only visit populated or changed frames */
+   unsigned short *fp_nzcnt;
+   uint64_t *fp_dirty;
+   BYTE *dump_shadow; /* content at the last diff dump, made by the first one */
 };
 
 #endif
@@ -1,5 +1,5 @@
-#ifndef QUEUE_H
-#define QUEUE_H
+#ifndef SCHED_H
+#define SCHED_H
 
 #include "common.h"
 
@@ -9,13 +9,15 @@
 
 #define MAX_PRIO 140
 
-int queue_empty(void);
+struct sim_ctx;
 
-void init_scheduler(void);
-void finish_scheduler(void);
+int queue_empty(struct sim_ctx * ctx);
+
+void init_scheduler(struct sim_ctx * ctx);
+void finish_scheduler(struct sim_ctx * ctx);
 
 /* Get the next process from ready queue */
-struct pcb_t * get_proc(void);
+struct pcb_t * get_proc(struct sim_ctx * ctx);
 
 /* Put a process back to run queue */
 void put_proc(struct pcb_t * proc);
@@ -23,6 +25,19 @@ void put_proc(struct pcb_t * proc);
 /* Add a new process to ready queue */
 void add_proc(struct pcb_t * proc);
 
+/* Forget a finished process before it is freed */
+void finish_proc(struct pcb_t * proc);
+
+/* Nonzero while priority [prio] has as many live processes as its ready
+ * queue holds, another one would be dropped */
+int sched_full(struct sim_ctx * ctx, uint32_t prio);
+
+/* Keep a process off the ready queues until slot [wake_time] */
+void block_proc(struct pcb_t * proc, uint64_t wake_time);
+
+/* Number of processes still blocked */
+int blocked_procs(struct sim_ctx * ctx);
+
 #endif
 
 
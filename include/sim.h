@@ -0,0 +1,185 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "common.h"
+#include "queue.h"
+#include "sched.h"
+#include "timer.h"
+
+#include <pthread.h>
+
+#define KSM_NBUCKETS 256
+
+struct ld_args {
+	char ** path;
+	unsigned long * start_time;
+#ifdef MLQ_SCHED
+	unsigned long * prio;
+#endif
+};
+
+/* Totals of a finished run, kept next to those of the memory modules */
+struct sim_stat {
+	uint64_t slots;		// Slots until the last device detached
+	unsigned long busy;	// CPU slots that ran an instruction
+	unsigned long idle;	// CPU slots with nothing to run
+	unsigned long stalled;	// CPU slots lost to a blocking page fault
+	unsigned long finished;	// Processes run to their end
+	unsigned long minflt;	// Page faults of the finished processes
+	unsigned long majflt;
+};
+
+/* State of one CPU between slots */
+struct sim_cpu {
+	struct pcb_t * proc;	// Process on the CPU, NULL while idle
+	int time_left;		// Slots left of its time slice
+	int stopped;		// The CPU left the timer
+	/* Slot accounting: ran an instruction, had nothing to run, or lost
+	 * the slot to a page fault that blocked the process */
+	unsigned long busy, idle, stalled;
+	unsigned long finished, minflt, majflt;
+};
+
+/* One simulation: its configuration and everything the timer, scheduler,
+ * loader and memory modules keep between calls. Independent contexts
+ * run side by side in one process, the trace sink stays process wide.
+ */
+struct sim_ctx {
+	/* Configuration */
+	int time_slot;
+	int num_cpus;
+	int num_processes;
+	struct ld_args ld_processes;
+	FILE * submit_fp;	// Submission stream read after the config, NULL without one
+	int quiet;		// Do not list the processes of the config
+#ifdef MM_PAGING
+	int memramsz;
+	int memswpsz[PAGING_MAX_MMSWP];
+	struct memphy_struct mram;
+	struct memphy_struct mswp[PAGING_MAX_MMSWP];
+#endif
+
+	/* Timer */
+	pthread_t timer;
+	struct timer_id_container_t * dev_list;
+	uint64_t time;
+	int timer_started;
+	int timer_stop;
+
+	/* Scheduler */
+	struct queue_t ready_queue;
+	struct queue_t run_queue;
+	struct queue_t running_list;
+	pthread_mutex_t queue_lock;
+#ifdef MLQ_SCHED
+	struct queue_t mlq_ready_queue[MAX_PRIO];
+	int slot[MAX_PRIO];
+#endif
+	/* Live processes of each priority. A ready queue drops what it has
+	 * no room for, so admission keeps each count within MAX_QUEUE_SIZE. */
+	int nr_live[MAX_PRIO];
+	/* Processes waiting for a timed event, each until its wake_time */
+	struct pcb_t ** blocked_list;
+	int nr_blocked;
+	int blocked_cap;
+	pthread_mutex_t blocked_lock;
+
+	/* CPUs, num_cpus of them once the run starts */
+	struct sim_cpu * cpu;
+
+	/* Loader, pid_lock also protects the code refcounts */
+	uint32_t avail_pid;
+	pthread_mutex_t pid_lock;
+	int done;
+	/* Next process of the config and the one loaded but not admitted
+	 * yet, waiting for its start time or for room in its queue */
+	int ld_next;
+	struct pcb_t * ld_proc;
+	char ld_path[100];
+	unsigned long ld_start;
+	unsigned long ld_prio;
+	int ld_held;
+
+	/* Snapshot written when the timer reaches slot snap_at, and whether
+	 * the state came from one */
+	const char * snap_path;
+	uint64_t snap_at;
+	int restored;
+
+	/* CPUs still running, the memory daemons leave the timer with the last one */
+	int mmd_cpus;
+	pthread_mutex_t mmd_lock;
+
+	struct pcb_t * proc_list[MAX_PROC];
+
+	struct sim_stat stat;
+	pthread_mutex_t stat_lock;
+
+#ifdef MM_PAGING
+	/* libmem, every field below is protected by mmvm_lock */
+	pthread_mutex_t mmvm_lock;
+	/* Copy-on-write totals: pages fork left shared and pages copied later */
+	unsigned long cow_shared;
+	unsigned long cow_copied;
+	/* Processes with a live mm, scanned round robin by the page reclaimer */
+	struct pcb_t ** mm_procs;
+	int mm_nr_procs;
+	int mm_procs_cap;
+	int kswapd_next;
+	/* Pages reclaimed ahead of demand by kswapd and inline by a fault */
+	unsigned long steal_kswapd;
+	unsigned long steal_direct;
+	/* Compaction passes, frames they migrated and the index the last left */
+	unsigned long compact_runs;
+	unsigned long compact_moved;
+	int compact_floor;
+
+	/* Shared memory segments of all processes */
+	struct shm_segment * shm_list;
+
+#ifdef ZSWAP
+	struct zswap_entry * zswap_tbl;
+	int zswap_cap;
+	int zswap_freeid;
+	int zswap_head, zswap_tail;
+	struct memphy_struct * zswap_dev;
+	struct zswap_stat zstat;
+#endif
+
+#ifdef KSM
+	/* Same-page merging scan position, totals and the frames of the pass */
+	int ksm_next_proc;
+	int ksm_next_pgn;
+	unsigned long ksm_merged, ksm_freed;
+	unsigned long ksm_scanned, ksm_slots, ksm_ns;
+	struct ksm_node * ksm_nodes;
+	int ksm_nr_nodes, ksm_cap;
+	int ksm_bucket[KSM_NBUCKETS];
+#endif
+#endif
+};
+
+/* New context with nothing configured */
+struct sim_ctx * sim_create(void);
+
+/* Read a config in the "./os <name>" format, return -1 if it cannot be read */
+int sim_config(struct sim_ctx * ctx, const char * path);
+
+/* Run the configured simulation to its end, the totals stay readable
+ * until sim_destroy. Return -1 if the memory devices cannot be set up */
+int sim_run(struct sim_ctx * ctx);
+
+void sim_destroy(struct sim_ctx * ctx);
+
+/* Set up the memory devices of the configured sizes */
+int sim_init_devices(struct sim_ctx * ctx);
+
+/* Write the whole state to a file, every device must wait in next_slot */
+int sim_snapshot(struct sim_ctx * ctx, const char * path);
+
+/* Replace the processes and memory of a configured context by those of
+ * a snapshot, sim_run then resumes at its slot. The time slot and the
+ * number of CPUs stay those of the config. */
+int sim_restore(struct sim_ctx * ctx, const char * path);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* Snapshot file being written or read. The same calls go both ways, so
+ * one list of fields serves the snapshot and the restore. err sticks
+ * from the first short read or write or inconsistent record on. */
+struct snap {
+	FILE * fp;
+	int load;
+	int err;
+};
+
+void snap_io(struct snap * s, void * buf, size_t len);
+
+#define SNAP_VAL(s, v) snap_io((s), &(v), sizeof(v))
+
+#endif
@@ -27,6 +27,9 @@ struct sc_regs {
         uint32_t orig_ax;
 
         int32_t flags;
+
+        /* Segments of SYSMEM_IO_READV and SYSMEM_IO_WRITEV */
+        struct memio_vec *iov;
 };
 
 
@@ -13,16 +13,18 @@ struct timer_id_t {
 	pthread_mutex_t timer_lock;
 };
 
-void start_timer();
+struct sim_ctx;
 
-void stop_timer();
+void start_timer(struct sim_ctx * ctx);
 
-struct timer_id_t * attach_event();
+void stop_timer(struct sim_ctx * ctx);
+
+struct timer_id_t * attach_event(struct sim_ctx * ctx);
 
 void detach_event(struct timer_id_t * event);
 
 void next_slot(struct timer_id_t* timer_id);
 
-uint64_t current_time();
+uint64_t current_time(struct sim_ctx * ctx);
 
 #endif
@@ -0,0 +1,88 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Trace levels, an event is recorded while the current level is at or
+ * above its own. OS_TRACE_LEVEL sets the level at startup, SIGUSR1 and
+ * SIGUSR2 raise and lower it while the simulation runs.
+ */
+#define TRACE_NONE    0
+#define TRACE_INFO    1 /* scheduler, loader, syscall and memory operation events */
+#define TRACE_IO      2 /* every read and write */
+#define TRACE_PGTBL   3 /* page table after each memory operation */
+#define TRACE_MEMDUMP 4 /* non-zero MEMRAM bytes after each read and write */
+#define TRACE_DEBUG   5 /* page faults, swapping and syscalls */
+
+enum trace_type {
+  TR_MSG,      /* preformatted text in the payload */
+  TR_SLOT,     /* slot */
+  TR_LOAD,     /* pid, prio, path in the payload */
+  TR_DISPATCH, /* cpu, pid */
+  TR_PUT,      /* cpu, pid */
+  TR_FINISH,   /* cpu, pid */
+  TR_BLOCK,    /* cpu, pid, ready slot */
+  TR_STOP,     /* cpu */
+  TR_ALLOC,    /* pid, rgid, address, size */
+  TR_FREE,     /* pid, rgid */
+  TR_MMAP,     /* pid, rgid, address, size */
+  TR_MUNMAP,   /* pid, rgid */
+  TR_SHMAT,    /* pid, rgid, key, address, size */
+  TR_READ,     /* region, offset, value, pid */
+  TR_WRITE,    /* region, offset, value, pid */
+  TR_PGTBL,    /* start, end, first pgn, PTEs in the payload */
+  TR_MEMDUMP,  /* address and value pairs of non-zero bytes in the payload */
+  TR_MEMDIFF,  /* address, old and new value triples of changed bytes in the payload */
+  TR_FAULT,    /* pid, pgn, trace_fault kind */
+  TR_SWAPOUT,  /* pid, pgn, frame, swap type, swap offset */
+  TR_SWAPIN,   /* pid, pgn, ready slot */
+  TR_SYSCALL,  /* pid, nr, a1, a2, a3 */
+  TR_READV,    /* region, offset, length, pid */
+  TR_WRITEV,   /* region, offset, length, pid */
+  TR_NR_TYPES
+};
+
+enum trace_fault { TRF_MINOR, TRF_MAJOR, TRF_COW, TRF_HUGE };
+
+#define TRACE_NARGS 5
+
+/* Record of the binary trace, followed by len payload bytes padded to a
+ * multiple of 8. Records of different threads are interleaved in the
+ * file, seq gives their order.
+ */
+struct trace_event {
+  uint64_t seq;
+  uint16_t type;
+  uint16_t level;
+  uint32_t len;
+  int64_t arg[TRACE_NARGS];
+};
+
+#define TRACE_MAGIC "OSTRACE1"
+#define TRACE_PAD(len) (((len) + 7) & ~(uint32_t)7)
+
+/* Trace flags, OS_TRACE_DIFF=1 sets TRACE_F_MEMDIFF */
+#define TRACE_F_MEMDIFF 1 /* memory dumps only show what changed since the previous one */
+
+extern int trace_level;
+extern int trace_flags;
+
+#define trace_on(lvl) ((lvl) <= __atomic_load_n(&trace_level, __ATOMIC_RELAXED))
+
+/* Record an event with up to TRACE_NARGS integer arguments */
+#define trace_ev(type, lvl, ...) do {                     \
+    if (trace_on(lvl)) {                                  \
+      int64_t trace_args_[TRACE_NARGS] = { __VA_ARGS__ }; \
+      trace_emit(type, lvl, trace_args_, NULL, 0);        \
+    }                                                     \
+  } while (0)
+
+int trace_init(void);
+int trace_set_level(int level);
+int trace_emit(int type, int level, const int64_t *arg, const void *payload, uint32_t len);
+int trace_msg(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int trace_format(const struct trace_event *ev, const void *payload, FILE *out);
+int trace_close(void);
+
+#endif
@@ -0,0 +1,454 @@
+/*
+ * Microbenchmarks of the scheduler, timer and memory management paths
+ * plus macro runs of whole configurations, see "make bench".
+ *
+ * Usage: microbench [os binary] [config ...]
+ *
+ * Results go to stdout as CSV, one line per benchmark:
+ *   type,name,iterations,ns_per_op,min_ns_per_op
+ * ns_per_op is the median of BENCH_REPEAT runs, min_ns_per_op the best.
+ * Macro runs time one whole simulation per iteration with its output
+ * discarded.
+ */
+
+#include "common.h"
+#include "queue.h"
+#include "sched.h"
+#include "timer.h"
+#include "mm.h"
+#include "libmem.h"
+#include "trace.h"
+#include "sim.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define BENCH_REPEAT 5
+
+static uint64_t now_ns(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b){
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/*report - print the median and best of the repeated runs
+ *@type: micro or macro
+ *@name: benchmark
+ *@iters: operations per run
+ *@ns: total time of each run
+ *
+ */
+static void report(const char *type, const char *name, long iters, uint64_t *ns){
+  qsort(ns, BENCH_REPEAT, sizeof(uint64_t), cmp_u64);
+  printf("%s,%s,%ld,%.1f,%.1f\n", type, name, iters,
+         (double)ns[BENCH_REPEAT / 2] / iters, (double)ns[0] / iters);
+  fflush(stdout);
+}
+
+/* Scheduler */
+
+static struct pcb_t procs[MAX_QUEUE_SIZE];
+
+static void bench_queue(void){
+  const long rounds = 200000;
+  uint64_t ns[BENCH_REPEAT];
+  struct queue_t q;
+  int r, i;
+
+  for (i = 0; i < MAX_QUEUE_SIZE; i++)
+    procs[i].prio = (i * 7) % MAX_QUEUE_SIZE;
+
+  for (r = 0; r < BENCH_REPEAT; r++){
+    uint64_t t0 = now_ns();
+
+    q.size = 0;
+    for (long n = 0; n < rounds; n++){
+      for (i = 0; i < MAX_QUEUE_SIZE; i++)
+        enqueue(&q, &procs[i]);
+      for (i = 0; i < MAX_QUEUE_SIZE; i++)
+        dequeue(&q);
+    }
+    ns[r] = now_ns() - t0;
+  }
+  report("micro", "enqueue_dequeue", rounds * MAX_QUEUE_SIZE, ns);
+}
+
+static void bench_mlq(void){
+  const long rounds = 500000;
+  uint64_t ns[BENCH_REPEAT];
+  struct sim_ctx *ctx = sim_create();
+  int r, i;
+
+  init_scheduler(ctx);
+  for (i = 0; i < 8; i++){
+    procs[i].ctx = ctx;
+    procs[i].prio = i * 17;
+    add_proc(&procs[i]);
+  }
+
+  for (r = 0; r < BENCH_REPEAT; r++){
+    uint64_t t0 = now_ns();
+
+    for (long n = 0; n < rounds; n++)
+      put_proc(get_proc(ctx));
+    ns[r] = now_ns() - t0;
+  }
+  report("micro", "get_mlq_proc_put_proc", rounds, ns);
+
+  for (i = 0; i < 8; i++)
+    finish_proc(get_proc(ctx));
+  finish_scheduler(ctx);
+  sim_destroy(ctx);
+}
+
+/* Frames */
+
+static void bench_freefp(void){
+  const long rounds = 20000, batch = 64;
+  struct memphy_struct mp;
+  uint64_t ns[BENCH_REPEAT];
+  int fpn[64], r, i;
+
+  init_memphy(&mp, 1 << 20, 1);
+  for (r = 0; r < BENCH_REPEAT; r++){
+    uint64_t t0 = now_ns();
+
+    for (long n = 0; n < rounds; n++){
+      for (i = 0; i < batch; i++)
+        MEMPHY_get_freefp(&mp, &fpn[i]);
+      for (i = 0; i < batch; i++)
+        MEMPHY_put_freefp(&mp, fpn[i]);
+    }
+    ns[r] = now_ns() - t0;
+  }
+  report("micro", "memphy_get_put_freefp", rounds * batch, ns);
+  free_memphy(&mp);
+}
+
+/* Paging */
+
+/* A process alone in a simulation of its own, with its memory devices */
+static struct pcb_t *bench_proc(int pid, int ramsz){
+  struct pcb_t *proc = calloc(1, sizeof(struct pcb_t));
+  struct sim_ctx *ctx = sim_create();
+  int i;
+
+  init_memphy(&ctx->mram, ramsz, 1);
+  init_memphy(&ctx->mswp[0], 1 << 22, 1);
+  for (i = 1; i < PAGING_MAX_MMSWP; i++)
+    init_memphy(&ctx->mswp[i], 0, 1);
+
+  proc->ctx = ctx;
+  proc->pid = pid;
+  proc->mm = malloc(sizeof(struct mm_struct));
+  init_mm(proc->mm, proc);
+  proc->mram = &ctx->mram;
+  proc->mswp = (struct memphy_struct **)&ctx->mswp;
+  proc->active_mswp = &ctx->mswp[0];
+  enlist_mm_proc(proc);
+
+  return proc;
+}
+
+static void bench_proc_free(struct pcb_t *proc){
+  struct sim_ctx *ctx = proc->ctx;
+
+  free_pcb_memph(proc);
+  free_mm(proc->mm);
+  free(proc);
+  sim_destroy(ctx);
+}
+
+static int touch(struct pcb_t *proc, int pgn){
+  int fpn, ret;
+
+  /* A major fault waits for the swap-in once, the retry completes it */
+  while ((ret = pg_getpage(proc->mm, pgn, &fpn, proc)) == PAGING_FAULT_WAIT);
+  if (ret == 0)
+    MEMPHY_write(proc->mram, fpn * PAGING_PAGESZ, (BYTE)pgn);
+  return ret;
+}
+
+static void bench_getpage(void){
+  const long hits = 2000000, faults = 20000, swaps = 50000;
+  const int npages = 8, nswap = 64;
+  uint64_t ns[BENCH_REPEAT];
+  struct pcb_t *proc;
+  int r, addr, base, fpn;
+
+  /* Resident pages */
+  proc = bench_proc(1, 1 << 20);
+  __alloc(proc, 0, 0, npages * PAGING_PAGESZ, &addr);
+  base = PAGING_PGN(addr);
+  for (int i = 0; i < npages; i++)
+    touch(proc, base + i);
+  for (r = 0; r < BENCH_REPEAT; r++){
+    uint64_t t0 = now_ns();
+
+    for (long n = 0; n < hits; n++)
+      pg_getpage(proc->mm, base + (n % npages), &fpn, proc);
+    ns[r] = now_ns() - t0;
+  }
+  report("micro", "pg_getpage_hit", hits, ns);
+  bench_proc_free(proc);
+
+  /* Demand-zero faults on a region allocated and freed again */
+  proc = bench_proc(2, 1 << 20);
+  for (r = 0; r < BENCH_REPEAT; r++){
+    uint64_t total = 0;
+
+    for (long n = 0; n < faults / npages; n++){
+      uint64_t t0;
+
+      __alloc(proc, 0, 1, npages * PAGING_PAGESZ, &addr);
+      base = PAGING_PGN(addr);
+      t0 = now_ns();
+      for (int i = 0; i < npages; i++)
+        touch(proc, base + i);
+      total += now_ns() - t0;
+      __free(proc, 0, 1);
+    }
+    ns[r] = total;
+  }
+  report("micro", "pg_getpage_fault", faults / npages * npages, ns);
+  bench_proc_free(proc);
+
+  /* A working set four times MEMRAM, every access swaps a page in and one out */
+  proc = bench_proc(3, 16 * PAGING_PAGESZ);
+  __alloc(proc, 0, 2, nswap * PAGING_PAGESZ, &addr);
+  base = PAGING_PGN(addr);
+  for (int i = 0; i < nswap; i++)
+    touch(proc, base + i);
+  for (r = 0; r < BENCH_REPEAT; r++){
+    uint64_t t0 = now_ns();
+
+    for (long n = 0; n < swaps; n++)
+      touch(proc, base + (n % nswap));
+    ns[r] = now_ns() - t0;
+  }
+  report("micro", "pg_getpage_swap", swaps, ns);
+  bench_proc_free(proc);
+}
+
+static void bench_vmrg(void){
+  const long rounds = 100000;
+  const int nrg = 32;
+  uint64_t ns[BENCH_REPEAT];
+  struct pcb_t *proc = bench_proc(4, 1 << 20);
+  unsigned int seed = 1;
+  int r, addr;
+
+  /* Half of the regions stay allocated so the free list stays fragmented */
+  for (int i = 0; i < nrg; i += 2)
+    __alloc(proc, 0, i, 1 + (i * 37) % 300, &addr);
+
+  for (r = 0; r < BENCH_REPEAT; r++){
+    uint64_t t0 = now_ns();
+
+    for (long n = 0; n < rounds; n++){
+      int rgid = 1 + 2 * (rand_r(&seed) % (nrg / 2));
+
+      __alloc(proc, 0, rgid, 1 + rand_r(&seed) % 600, &addr);
+      __free(proc, 0, rgid);
+    }
+    ns[r] = now_ns() - t0;
+  }
+  report("micro", "get_free_vmrg_area_churn", rounds, ns);
+  bench_proc_free(proc);
+}
+
+/* Memory transfers */
+
+/* A range in one libread_range or libwrite_range, going on after each
+ * swap-in wait */
+static int memio_range(struct pcb_t *proc, int write, int rgid, BYTE *buf, int len){
+  uint32_t done = 0, n;
+  int ret;
+
+  while (done < (uint32_t)len){
+    n = len - done;
+    ret = write ? libwrite_range(proc, buf + done, &n, rgid, done)
+                : libread_range(proc, rgid, done, buf + done, &n);
+    if (ret < 0)
+      return -1;
+    done += n;
+  }
+  return 0;
+}
+
+/* The same range one libread or libwrite per byte */
+static int memio_bytes(struct pcb_t *proc, int write, int rgid, BYTE *buf, int len){
+  uint32_t data;
+  int i, ret;
+
+  for (i = 0; i < len; i++){
+    do
+      ret = write ? libwrite(proc, buf[i], rgid, i) : libread(proc, rgid, i, &data);
+    while (ret == PAGING_FAULT_WAIT);
+    if (ret < 0)
+      return -1;
+    if (!write)
+      buf[i] = (BYTE)data;
+  }
+  return 0;
+}
+
+/*bench_memio_one - write and read back a region per round, byte by byte
+ *                  and as one range
+ *@name: benchmark, _bytes and _range are appended
+ *@ramsz: MEMRAM size
+ *@len: region size
+ *@rounds: write and read rounds per run
+ *
+ */
+static void bench_memio_one(const char *name, int ramsz, int len, long rounds){
+  int (*memio[2])(struct pcb_t *, int, int, BYTE *, int) = { memio_bytes, memio_range };
+  const char *kind[2] = { "bytes", "range" };
+  BYTE *src = malloc(len), *dst = malloc(len);
+  uint64_t ns[BENCH_REPEAT];
+  char label[64];
+  int k, r, i, addr;
+
+  for (i = 0; i < len; i++)
+    src[i] = 'a' + i % 26;
+
+  for (k = 0; k < 2; k++){
+    struct pcb_t *proc = bench_proc(5, ramsz);
+
+    __alloc(proc, 0, 1, len, &addr);
+    for (r = 0; r < BENCH_REPEAT; r++){
+      uint64_t t0 = now_ns();
+
+      for (long n = 0; n < rounds; n++){
+        memio[k](proc, 1, 1, src, len);
+        memio[k](proc, 0, 1, dst, len);
+      }
+      ns[r] = now_ns() - t0;
+    }
+    if (memcmp(src, dst, len) != 0)
+      printf("micro,%s_%s: read back differs\n", name, kind[k]);
+    snprintf(label, sizeof(label), "%s_%s", name, kind[k]);
+    report("micro", label, rounds, ns);
+    bench_proc_free(proc);
+  }
+  free(src);
+  free(dst);
+}
+
+static void bench_memio(void){
+  /* A process name as killall reads it, an array over 16 pages, and an
+   * array four times MEMRAM that swaps on every round */
+  bench_memio_one("memio_string", 1 << 20, 100, 20000);
+  bench_memio_one("memio_array", 1 << 20, 16 * PAGING_PAGESZ, 200);
+  bench_memio_one("memio_array_swap", 16 * PAGING_PAGESZ, 64 * PAGING_PAGESZ, 20);
+}
+
+/* Timer */
+
+#define BENCH_DEVS 4
+#define BENCH_SLOTS 20000
+
+static void *slot_routine(void *arg){
+  struct timer_id_t *id = arg;
+
+  for (int n = 0; n < BENCH_SLOTS; n++)
+    next_slot(id);
+  detach_event(id);
+  return NULL;
+}
+
+/*bench_next_slot - slot barrier of BENCH_DEVS devices
+ *
+ * Each run gets a timer of its own in a fresh simulation.
+ */
+static void bench_next_slot(void){
+  struct timer_id_t *id[BENCH_DEVS];
+  pthread_t th[BENCH_DEVS];
+  uint64_t ns[BENCH_REPEAT], t0;
+  int r, i;
+
+  for (r = 0; r < BENCH_REPEAT; r++){
+    struct sim_ctx *ctx = sim_create();
+
+    for (i = 0; i < BENCH_DEVS; i++)
+      id[i] = attach_event(ctx);
+    t0 = now_ns();
+    start_timer(ctx);
+    for (i = 0; i < BENCH_DEVS; i++)
+      pthread_create(&th[i], NULL, slot_routine, id[i]);
+    for (i = 0; i < BENCH_DEVS; i++)
+      pthread_join(th[i], NULL);
+    stop_timer(ctx);
+    ns[r] = now_ns() - t0;
+    sim_destroy(ctx);
+  }
+  report("micro", "next_slot_4_devices", BENCH_SLOTS, ns);
+}
+
+/* Whole configurations */
+
+static int run_config(const char *os, const char *cfg, uint64_t *ns){
+  uint64_t t0 = now_ns();
+  int status;
+  pid_t pid = fork();
+
+  if (pid == 0){
+    int fd = open("/dev/null", O_WRONLY);
+
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    execl(os, os, cfg, (char *)NULL);
+    _exit(127);
+  }
+  if (pid < 0 || waitpid(pid, &status, 0) < 0)
+    return -1;
+
+  *ns = now_ns() - t0;
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+static void bench_macro(const char *os, const char *cfg){
+  uint64_t ns[BENCH_REPEAT];
+  int r;
+
+  for (r = 0; r < BENCH_REPEAT; r++){
+    if (run_config(os, cfg, &ns[r]) < 0){
+      printf("macro,%s,0,nan,nan\n", cfg);
+      return;
+    }
+  }
+  report("macro", cfg, 1, ns);
+}
+
+int main(int argc, char *argv[]){
+  int i;
+
+  /* Measure the code paths, not the console */
+  trace_set_level(TRACE_NONE);
+
+  printf("type,name,iterations,ns_per_op,min_ns_per_op\n");
+  bench_queue();
+  bench_mlq();
+  bench_freefp();
+  bench_getpage();
+  bench_vmrg();
+  bench_memio();
+  bench_next_slot();
+
+  for (i = 2; i < argc; i++)
+    bench_macro(argv[1], argv[i]);
+
+  return 0;
+}
@@ -18,26 +18,20 @@
 #include "mm.h"
 #include "syscall.h"
 #include "libmem.h"
+#include "timer.h"
+#include "trace.h"
+#include "sim.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <pthread.h>
 
-static pthread_mutex_t mmvm_lock = PTHREAD_MUTEX_INITIALIZER;
-
 /*enlist_vm_freerg_list - add new rg to freerg_list
  *@mm: memory region
  *@rg_elmt: new region
  *
  */
 int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt){
-  struct vm_rg_struct *rg_node = mm->mmap->vm_freerg_list;
-
-  if (rg_elmt->rg_start >= rg_elmt->rg_end) return -1;
-
-  if (rg_node != NULL) rg_elmt->rg_next = rg_node;
-
-  /* Enlist the new region */
-  mm->mmap->vm_freerg_list = rg_elmt;
+  if (vm_freerg_insert(get_vma_by_num(mm, 0), rg_elmt) == NULL) return -1;
 
   return 0;
 }
@@ -48,7 +42,32 @@ int enlist_vm_freerg_list(struct mm_struct *mm, struct vm_rg_struct *rg_elmt){
  *
  */
 struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid){
-  if (rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ) return NULL;
+  if (rgid < 0 || rgid >= mm->symrgtbl_sz) return NULL;
+  return &mm->symrgtbl[rgid];
+}
+
+/*get_symrg_alloc - get mem region by region ID, growing the symbol table
+ *@mm: memory region
+ *@rgid: region ID act as symbol index of variable
+ *
+ * The table doubles until it covers rgid, new entries are not allocated.
+ */
+struct vm_rg_struct *get_symrg_alloc(struct mm_struct *mm, int rgid){
+  int newsz = (mm->symrgtbl_sz > 0) ? mm->symrgtbl_sz : PAGING_SYMTBL_INIT_SZ;
+  struct vm_rg_struct *newtbl;
+
+  if (rgid < 0 || rgid >= PAGING_MAX_SYMTBL_SZ) return NULL;
+  if (rgid < mm->symrgtbl_sz) return &mm->symrgtbl[rgid];
+
+  while (newsz <= rgid) newsz *= 2;
+
+  newtbl = realloc(mm->symrgtbl, newsz * sizeof(struct vm_rg_struct));
+  if (newtbl == NULL) return NULL;
+
+  memset(&newtbl[mm->symrgtbl_sz], 0, (newsz - mm->symrgtbl_sz) * sizeof(struct vm_rg_struct));
+  mm->symrgtbl = newtbl;
+  mm->symrgtbl_sz = newsz;
+
   return &mm->symrgtbl[rgid];
 }
 
@@ -66,20 +85,27 @@ struct vm_rg_struct *get_symrg_byid(struct mm_struct *mm, int rgid){
 int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr){
   /*Allocate at the toproof */
   struct vm_rg_struct rgnode; // will be modified by get_free_vmrg_area
+  struct vm_rg_struct *symrg;
+  struct sim_ctx *ctx = caller->ctx;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
 
-  pthread_mutex_lock(&mmvm_lock);
+  symrg = get_symrg_alloc(caller->mm, rgid);
+  if (symrg == NULL){
+    pthread_mutex_unlock(&ctx->mmvm_lock);
+    return -1;
+  }
 
   if (get_free_vmrg_area(caller, vmaid, size, &rgnode) == 0){
-    caller->mm->symrgtbl[rgid].rg_start = rgnode.rg_start;
-    caller->mm->symrgtbl[rgid].rg_end = rgnode.rg_end;
+    symrg->rg_start = rgnode.rg_start;
+    symrg->rg_end = rgnode.rg_end;
  
     *alloc_addr = rgnode.rg_start;
 
-    printf("===== PHYSICAL MEMORY AFTER ALLOCATION =====\n");
-    printf("PID=%d - Region=%d - Address=%08lx - Size=%d byte\n", caller->pid, rgid, rgnode.rg_start, size);
+    trace_ev(TR_ALLOC, TRACE_INFO, caller->pid, rgid, rgnode.rg_start, size);
     print_pgtbl(caller, 0, -1);
 
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&ctx->mmvm_lock);
     return 0;
   }
 
@@ -87,6 +113,10 @@ int __alloc(struct pcb_t *caller, int vmaid, int rgid, int size, int *alloc_addr
   /* Handle the region management when get_free_vmrg_area fails */
   /* TODO Retrieve current vma */
   struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+  if (cur_vma == NULL) {
+    pthread_mutex_unlock(&ctx->mmvm_lock);
+    return -1;
+  }
 
   /* Calculate increase size aligned to page size */
   int inc_sz = PAGING_PAGE_ALIGNSZ(size);
@@ -104,27 +134,225 @@ regs.a3 = inc_sz;
   int ret = syscall(caller, 17, &regs);
   
   if (ret < 0) {
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&ctx->mmvm_lock);
     return -1;
   }
   
-  /* TODO Commit the allocation address at the old_sbrk */
-  *alloc_addr = old_sbrk;
+  /* TODO Commit the allocation address at the old_sbrk, a grow-down
+   * area places it at the new (lower) break instead */
+  int rg_start = (cur_vma->vm_flags & VM_GROWSDOWN) ? (int)cur_vma->sbrk : old_sbrk;
+  int rg_end = rg_start + size;
+  int area_end = (cur_vma->vm_flags & VM_GROWSDOWN) ? old_sbrk : (int)cur_vma->sbrk;
+  *alloc_addr = rg_start;
   
   /* Update symbol table for this region */
-  caller->mm->symrgtbl[rgid].rg_start = old_sbrk;
-  caller->mm->symrgtbl[rgid].rg_end = old_sbrk + size;
+  symrg->rg_start = rg_start;
+  symrg->rg_end = rg_end;
+
+  /* The page aligned remainder of the new area is free for later use */
+  if (rg_end < area_end) {
+    struct vm_rg_struct *tailrg = init_vm_rg(rg_end, area_end);
+    if (vm_freerg_insert(cur_vma, tailrg) == NULL)
+      free(tailrg);
+  }
 
-  printf("===== PHYSICAL MEMORY AFTER ALLOCATION =====\n");
-  printf("PID=%d - Region=%d - Address=%08x - Size=%d byte\n", caller->pid, rgid, old_sbrk, size);
+  trace_ev(TR_ALLOC, TRACE_INFO, caller->pid, rgid, rg_start, size);
   print_pgtbl(caller, 0, -1);
 
-  pthread_mutex_unlock(&mmvm_lock);
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+
+
+
+
+
+
+/*swap_entry_get - add a reference to the swap slot of a swapped PTE
+ *@caller: caller
+ *@pte: swapped page table entry
+ *
+ */
+static int swap_entry_get(struct pcb_t *caller, uint32_t pte){
+#ifdef ZSWAP
+  if (PAGING_PTE_SWPTYP(pte) == PAGING_SWPTYP_ZSWAP)
+    return zswap_get(caller->ctx, PAGING_PTE_SWP(pte));
+#endif
+  return MEMPHY_get_fp(caller->active_mswp, PAGING_PTE_SWP(pte));
+}
+
+/*swap_entry_put - drop the reference on the swap slot of a swapped PTE
+ *@caller: caller
+ *@pte: swapped page table entry
+ *
+ */
+static int swap_entry_put(struct pcb_t *caller, uint32_t pte){
+#ifdef ZSWAP
+  if (PAGING_PTE_SWPTYP(pte) == PAGING_SWPTYP_ZSWAP)
+    return zswap_put(caller->ctx, PAGING_PTE_SWP(pte));
+#endif
+  return MEMPHY_put_freefp(caller->active_mswp, PAGING_PTE_SWP(pte));
+}
+
+/*swap_entry_load - copy the page of a swapped PTE into a frame
+ *@caller: caller
+ *@pte: swapped page table entry
+ *@fpn: destination MEMRAM frame
+ *
+ */
+static int swap_entry_load(struct pcb_t *caller, uint32_t pte, int fpn){
+#ifdef ZSWAP
+  if (PAGING_PTE_SWPTYP(pte) == PAGING_SWPTYP_ZSWAP)
+    return zswap_load(caller->ctx, PAGING_PTE_SWP(pte), caller->mram, fpn);
+#endif
+  return __swap_cp_page(caller->active_mswp, PAGING_PTE_SWP(pte), caller->mram, fpn);
+}
+
+#ifdef MEMSWP_LATENCY
+/*swap_entry_io - tell whether a swap-in has to wait for the swap device
+ *@caller: caller
+ *@pte: swapped page table entry
+ *
+ */
+static int swap_entry_io(struct pcb_t *caller, uint32_t pte){
+#ifdef ZSWAP
+  if (PAGING_PTE_SWPTYP(pte) == PAGING_SWPTYP_ZSWAP)
+    return zswap_needs_io(caller->ctx, PAGING_PTE_SWP(pte));
+#endif
+  return 1;
+}
+#endif
+
+/*tlb_flush - drop every cached translation of a memory region
+ *@mm: memory region
+ *
+ * Called whenever a PTE of the region changes frame, swaps out or gets
+ * write protected.
+ */
+int tlb_flush(struct mm_struct *mm){
+#ifdef TLB_ENTRIES
+  memset(mm->tlb, 0, sizeof(mm->tlb));
+#endif
+  return 0;
+}
+
+/*tlb_lookup - translate a page through the software TLB
+ *@mm: memory region
+ *@pgn: PGN
+ *@write: the access is a write, read-only entries do not serve it
+ *@fpn: return FPN
+ *
+ * A huge page entry covers the whole block, it is looked up first.
+ */
+static int tlb_lookup(struct mm_struct *mm, int pgn, int write, int *fpn){
+#ifdef TLB_ENTRIES
+  struct tlb_entry *e;
+
+#ifdef HUGEPAGE_ORDER
+  int blk = pgn >> HUGEPAGE_ORDER;
+
+  e = &mm->tlb[blk % TLB_ENTRIES];
+  if (e->tag == (uint32_t)(blk << 1 | 1) + 1 && (!write || e->writable)){
+    *fpn = e->fpn + (pgn - PAGING_HPAGE_BASE(pgn));
+    mm->tlb_hit++;
+    return 0;
+  }
+#endif
+
+  e = &mm->tlb[pgn % TLB_ENTRIES];
+  if (e->tag == (uint32_t)(pgn << 1) + 1 && (!write || e->writable)){
+    *fpn = e->fpn;
+    mm->tlb_hit++;
+    return 0;
+  }
+
+  mm->tlb_miss++;
+#endif
+  return -1;
+}
+
+/*tlb_fill - cache the translation of a resident page
+ *@mm: memory region
+ *@pgn: PGN, resolved by pg_getpage
+ *@fpn: FPN
+ *
+ */
+static int tlb_fill(struct mm_struct *mm, int pgn, int fpn){
+#ifdef TLB_ENTRIES
+  struct tlb_entry *e;
+
+#ifdef HUGEPAGE_ORDER
+  uint32_t hpte = mm->pgd[PAGING_HPAGE_BASE(pgn)];
+
+  if (PAGING_PAGE_HUGE(hpte)){
+    int blk = pgn >> HUGEPAGE_ORDER;
+
+    e = &mm->tlb[blk % TLB_ENTRIES];
+    e->tag = (uint32_t)(blk << 1 | 1) + 1;
+    e->fpn = PAGING_FPN(hpte);
+    e->writable = 1;
+    return 0;
+  }
+#endif
+
+  e = &mm->tlb[pgn % TLB_ENTRIES];
+  e->tag = (uint32_t)(pgn << 1) + 1;
+  e->fpn = fpn;
+  e->writable = !PAGING_PAGE_COW(mm->pgd[pgn]);
+#endif
   return 0;
 }
 
+/*vm_unmap_range - release the frames behind a virtual range
+ *@caller: caller
+ *@start: page aligned start address
+ *@end: end address, a trailing partial page is kept
+ *
+ */
+int vm_unmap_range(struct pcb_t *caller, uint32_t start, uint32_t end){
+  for (uint32_t addr = start; addr + PAGING_PAGESZ <= end; addr += PAGING_PAGESZ) {
+    uint32_t vpn = PAGING_PGN(addr);
+    uint32_t pte;
+
+#ifdef HUGEPAGE_ORDER
+    /* A whole huge page goes at once, a part of one splits it first */
+    int base = PAGING_HPAGE_BASE(vpn);
+
+    if (PAGING_PAGE_HUGE(caller->mm->pgd[base])){
+      if (vpn == base && addr + PAGING_HPAGE_SZ <= end){
+        int hfpn = PAGING_FPN(caller->mm->pgd[base]);
+
+        for (int i = 0; i < PAGING_HPAGE_NR; i++)
+          MEMPHY_put_freefp(caller->mram, hfpn + i);
+        delist_pgn_node(&caller->mm->fifo_pgn, base);
+        caller->mm->pgd[base] = 0;
+        addr += PAGING_HPAGE_SZ - PAGING_PAGESZ;
+        continue;
+      }
+      pg_hugepage_split(caller->mm, base);
+    }
+#endif
+
+    pte = caller->mm->pgd[vpn];
 
+    if (!PAGING_PAGE_PRESENT(pte))
+      continue;
 
+    if (PAGING_PAGE_SWAPPED(pte)) {
+      swap_entry_put(caller, pte);
+    } else {
+      MEMPHY_put_freefp(caller->mram, PAGING_PTE_FPN(pte));
+      delist_pgn_node(&caller->mm->fifo_pgn, vpn);
+    }
+
+    /* Next access to the page takes a fresh demand-zero fault */
+    caller->mm->pgd[vpn] = 0;
+  }
+
+  tlb_flush(caller->mm);
+  return 0;
+}
 
 
 
@@ -137,58 +365,50 @@ regs.a3 = inc_sz;
  *
  */
 int __free(struct pcb_t *caller, int vmaid, int rgid){
-    if(rgid < 0 || rgid > PAGING_MAX_SYMTBL_SZ) return -1;
-    pthread_mutex_lock(&mmvm_lock);
+    struct sim_ctx *ctx = caller->ctx;
+
+    pthread_mutex_lock(&ctx->mmvm_lock);
 
-    struct vm_rg_struct *symrg = &caller->mm->symrgtbl[rgid];
+    struct vm_rg_struct *symrg = get_symrg_byid(caller->mm, rgid);
+    struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
     /* Validate region */
-    if (symrg->rg_start == 0 && symrg->rg_end == 0) {
-        pthread_mutex_unlock(&mmvm_lock);
+    if (cur_vma == NULL || symrg == NULL || symrg->rg_start == symrg->rg_end) {
+        pthread_mutex_unlock(&ctx->mmvm_lock);
         return -1;
     }
 
-    /* Remove page mappings */
-    for (uint32_t addr = symrg->rg_start; addr < symrg->rg_end; addr += PAGING_PAGESZ) {
-        uint32_t vpn = PAGING_PGN(addr);
-        uint32_t pte = caller->mm->pgd[vpn];
-
-        if (pte & PAGING_PTE_PRESENT_MASK) {
-            int pfn = PAGING_PTE_FPN(pte);
-            struct framephy_struct *frame = malloc(sizeof(struct framephy_struct));
-            frame->fpn = pfn;
-            frame->fp_next = caller->mram->free_fp_list;
-            caller->mram->free_fp_list = frame;
-        }
-
-        caller->mm->pgd[vpn] &= ~PAGING_PTE_PRESENT_MASK;
+    /* Mapped regions belong to their own area, they go through munmap */
+    if (symrg->rg_start < cur_vma->vm_start || symrg->rg_end > cur_vma->vm_end) {
+        pthread_mutex_unlock(&ctx->mmvm_lock);
+        return -1;
     }
 
-    /* Reset symbol table entry */
-    struct vm_rg_struct *rgnode = malloc(sizeof(struct vm_rg_struct));
+    struct vm_rg_struct *rgnode = init_vm_rg(symrg->rg_start, symrg->rg_end);
     if (rgnode == NULL){
-        pthread_mutex_unlock(&mmvm_lock);
+        pthread_mutex_unlock(&ctx->mmvm_lock);
         return -1;
     }
 
-    rgnode->rg_start = symrg->rg_start;
-    rgnode->rg_end = symrg->rg_end;
-    rgnode->rg_next = NULL;
+    /* Coalesce with free neighbours, a rejected region stays allocated */
+    struct vm_rg_struct *freerg = vm_freerg_insert(cur_vma, rgnode);
+    if (freerg == NULL) {
+        free(rgnode);
+        pthread_mutex_unlock(&ctx->mmvm_lock);
+        return -1;
+    }
 
+    /* Reset symbol table entry */
     symrg->rg_start = 0;
     symrg->rg_end = 0;
 
-    if (enlist_vm_freerg_list(caller->mm, rgnode) != 0) {
-        free(rgnode);
-        pthread_mutex_unlock(&mmvm_lock);
-        return -1;
-    }
+    /* Remove page mappings of every page now completely free */
+    vm_unmap_range(caller, PAGING_PAGE_ALIGNSZ(freerg->rg_start), freerg->rg_end);
 
-    printf("===== PHYSICAL MEMORY AFTER DEALLOCATION =====\n");
-    printf("PID=%d - Region=%d\n", caller->pid, rgid);
+    trace_ev(TR_FREE, TRACE_INFO, caller->pid, rgid);
     print_pgtbl(caller, 0, -1);
 
-    pthread_mutex_unlock(&mmvm_lock);
+    pthread_mutex_unlock(&ctx->mmvm_lock);
     return 0;
 }
 
@@ -197,6 +417,138 @@ int __free(struct pcb_t *caller, int vmaid, int rgid){
 
 
 
+/*__mmap - map an anonymous area into its own vm area
+ *@caller: caller
+ *@rgid: memory region ID (used to identify variable in symbole table)
+ *@size: mapped size
+ *@alloc_addr: address of the mapping
+ *
+ * Frames are not populated here, every page of the area is demand-zero.
+ */
+int __mmap(struct pcb_t *caller, int rgid, int size, int *alloc_addr){
+  struct sim_ctx *ctx = caller->ctx;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+
+  struct vm_rg_struct *symrg = get_symrg_alloc(caller->mm, rgid);
+  struct vm_area_struct *vma;
+
+  if (symrg == NULL || symrg->rg_start != symrg->rg_end || size <= 0) {
+    pthread_mutex_unlock(&ctx->mmvm_lock);
+    return -1;
+  }
+
+  vma = vm_map_area(caller->mm, PAGING_PAGE_ALIGNSZ(size));
+  if (vma == NULL) {
+    pthread_mutex_unlock(&ctx->mmvm_lock);
+    return -1;
+  }
+
+  symrg->rg_start = vma->vm_start;
+  symrg->rg_end = vma->vm_start + size;
+  *alloc_addr = vma->vm_start;
+
+  trace_ev(TR_MMAP, TRACE_INFO, caller->pid, rgid, vma->vm_start, size);
+
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+/*__munmap - remove a mapping made by __mmap
+ *@caller: caller
+ *@rgid: memory region ID (used to identify variable in symbole table)
+ *
+ * The frames of the area go back to MEMRAM and MEMSWP right away, a
+ * shared area drops its segment reference instead.
+ */
+int __munmap(struct pcb_t *caller, int rgid){
+  struct sim_ctx *ctx = caller->ctx;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+
+  struct vm_rg_struct *symrg = get_symrg_byid(caller->mm, rgid);
+  struct vm_area_struct *vma = NULL;
+
+  if (symrg != NULL && symrg->rg_start != symrg->rg_end)
+    vma = get_vma_by_addr(caller->mm, symrg->rg_start);
+
+  if (vma == NULL || !(vma->vm_flags & VM_MAPPED) || vma->vm_start != symrg->rg_start) {
+    pthread_mutex_unlock(&ctx->mmvm_lock);
+    return -1;
+  }
+
+  vm_unmap_range(caller, vma->vm_start, vma->vm_end);
+  if (vma->vm_flags & VM_SHARED)
+    shm_detach(ctx, vma);
+  remove_vm_area(caller->mm, vma->vm_id);
+
+  symrg->rg_start = 0;
+  symrg->rg_end = 0;
+
+  trace_ev(TR_MUNMAP, TRACE_INFO, caller->pid, rgid);
+
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+
+
+
+
+
+/*__shmget - create a shared memory segment
+ *@caller: caller
+ *@key: segment key
+ *@size: segment size
+ *
+ */
+int __shmget(struct pcb_t *caller, int key, int size){
+  struct sim_ctx *ctx = caller->ctx;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+
+  struct shm_segment *seg = shm_create(ctx, key, size);
+
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return (seg == NULL) ? -1 : 0;
+}
+
+/*__shmat - attach a shared memory segment to a region
+ *@caller: caller
+ *@rgid: memory region ID (used to identify variable in symbole table)
+ *@key: segment key
+ *@alloc_addr: address of the attached area
+ *
+ */
+int __shmat(struct pcb_t *caller, int rgid, int key, int *alloc_addr){
+  struct sim_ctx *ctx = caller->ctx;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+
+  struct vm_rg_struct *symrg = get_symrg_alloc(caller->mm, rgid);
+  struct vm_area_struct *vma;
+
+  if (symrg == NULL || symrg->rg_start != symrg->rg_end ||
+      (vma = shm_attach(ctx, caller->mm, key)) == NULL) {
+    pthread_mutex_unlock(&ctx->mmvm_lock);
+    return -1;
+  }
+
+  symrg->rg_start = vma->vm_start;
+  symrg->rg_end = vma->vm_start + vma->vm_shm->size;
+  *alloc_addr = vma->vm_start;
+
+  trace_ev(TR_SHMAT, TRACE_INFO, caller->pid, rgid, key, vma->vm_start, vma->vm_shm->size);
+
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+
+
+
+
+
 /*liballoc - PAGING-based allocate a region memory
  *@proc:  Process executing the instruction
  *@size: allocated size
@@ -228,6 +580,164 @@ int libfree(struct pcb_t *proc, uint32_t reg_index){
 
 
 
+/*pg_swapout - move the oldest resident page of a process to swap
+ *@mm: memory region
+ *@private: pass over the pages whose frame another mapping shares
+ *@vicfpn: return the frame the page left, still referenced by the caller
+ *@caller: caller
+ *
+ */
+int pg_swapout(struct mm_struct *mm, int private, int *vicfpn, struct pcb_t *caller){
+  int vicpgn, swpfpn;
+
+  if (find_victim_page(mm, private ? caller->mram : NULL, &vicpgn) < 0)
+    return -1;
+
+#ifdef HUGEPAGE_ORDER
+  /* Huge pages go out one base page at a time */
+  if (PAGING_PAGE_HUGE(mm->pgd[vicpgn]))
+    pg_hugepage_split(mm, vicpgn);
+#endif
+  tlb_flush(mm);
+
+  *vicfpn = PAGING_FPN(mm->pgd[vicpgn]);
+
+#ifdef ZSWAP
+  /* Compressible pages stay in RAM, only the rest reach the device */
+  if ((swpfpn = zswap_store(caller->ctx, caller->mram, *vicfpn, caller->active_mswp)) >= 0){
+    pte_set_swap(&mm->pgd[vicpgn], PAGING_SWPTYP_ZSWAP, swpfpn);
+    trace_ev(TR_SWAPOUT, TRACE_DEBUG, caller->pid, vicpgn, *vicfpn, PAGING_SWPTYP_ZSWAP, swpfpn);
+    return 0;
+  }
+#endif
+
+  if (MEMPHY_get_freefp(caller->active_mswp, &swpfpn) < 0){
+    enlist_pgn_node(&mm->fifo_pgn, vicpgn);
+    return -1;
+  }
+
+  // Victim -> Swap
+  struct sc_regs regs;
+  regs.a1 = SYSMEM_SWP_OP;
+  regs.a2 = *vicfpn;
+  regs.a3 = swpfpn;
+  syscall(caller, 17, &regs);
+
+  // Update victim to swapped
+  pte_set_swap(&mm->pgd[vicpgn], PAGING_SWPTYP_DEV, swpfpn);
+  trace_ev(TR_SWAPOUT, TRACE_DEBUG, caller->pid, vicpgn, *vicfpn, PAGING_SWPTYP_DEV, swpfpn);
+
+  return 0;
+}
+
+
+
+
+/*pg_getfreefp - get a free frame in ram, evict a victim page to swap if needed
+ *@mm: memory region
+ *@fpn: return FPN
+ *@caller: caller
+ *
+ */
+int pg_getfreefp(struct mm_struct *mm, int *fpn, struct pcb_t *caller){
+  int vicfpn;
+
+  while (MEMPHY_get_freefp(caller->mram, fpn) < 0){
+    /* MEMRAM is exhausted, swap out the oldest page of the caller */
+    if (pg_swapout(mm, 0, &vicfpn, caller) < 0)
+      return -1;
+    caller->ctx->steal_direct++;
+
+    /* A frame still mapped by a fork sibling only loses our reference,
+     * keep evicting until one is really free */
+    if (caller->mram->fp_refcnt[vicfpn] == 1){
+      *fpn = vicfpn;
+      return 0;
+    }
+    MEMPHY_put_freefp(caller->mram, vicfpn);
+  }
+
+  return 0;
+}
+
+
+
+
+#ifdef HUGEPAGE_ORDER
+/*pg_hugepage_fault - map the huge page around a first touched page
+ *@mm: memory region
+ *@vma: vm area of the page
+ *@pgn: PGN
+ *@fpn: return FPN
+ *@caller: caller
+ *
+ * Only an aligned block lying inside one allocated region of a private
+ * area, with none of its pages touched yet, gets a huge page. Without a
+ * free aligned run the frames are compacted once, after that the fault
+ * falls back to a base page.
+ */
+static int pg_hugepage_fault(struct mm_struct *mm, struct vm_area_struct *vma, int pgn, int *fpn, struct pcb_t *caller){
+  int base = PAGING_HPAGE_BASE(pgn);
+  unsigned long start = (unsigned long)base * PAGING_PAGESZ;
+  unsigned long end = start + PAGING_HPAGE_SZ;
+  int i, hfpn;
+
+  if ((vma->vm_flags & (VM_SHARED | VM_GROWSDOWN)) || start < vma->vm_start || end > vma->vm_end)
+    return -1;
+
+  for (i = 0; i < mm->symrgtbl_sz; i++)
+    if (mm->symrgtbl[i].rg_start <= start && end <= mm->symrgtbl[i].rg_end)
+      break;
+  if (i == mm->symrgtbl_sz)
+    return -1;
+
+  for (i = 0; i < PAGING_HPAGE_NR; i++)
+    if (mm->pgd[base + i] != 0)
+      return -1;
+
+  if (MEMPHY_get_freerun(caller->mram, HUGEPAGE_ORDER, &hfpn) < 0){
+    struct frag_stat before, after;
+
+    compact_frag_stat(caller->mram, HUGEPAGE_ORDER, &before);
+    if (before.nr_free < PAGING_HPAGE_NR || before.unusable_pct <= caller->ctx->compact_floor)
+      return -1;
+    if (__compact_memory(caller->ctx, caller->mram, &before, &after) <= 0 ||
+        MEMPHY_get_freerun(caller->mram, HUGEPAGE_ORDER, &hfpn) < 0)
+      return -1;
+  }
+
+  MEMPHY_write_range(caller->mram, hfpn * PAGING_PAGESZ, NULL, PAGING_HPAGE_SZ);
+  pte_set_fpn(&mm->pgd[base], hfpn);
+  SETBIT(mm->pgd[base], PAGING_PTE_HUGE_MASK);
+  enlist_pgn_node(&mm->fifo_pgn, base);
+  mm->thpflt++;
+
+  *fpn = hfpn + (pgn - base);
+  return 0;
+}
+
+/*pg_hugepage_split - map a huge page with base page PTEs again
+ *@mm: memory region
+ *@pgn: PGN of the huge page head
+ *
+ * The frames keep their own references, so each base page can be
+ * swapped out or released on its own afterwards.
+ */
+int pg_hugepage_split(struct mm_struct *mm, int pgn){
+  int hfpn = PAGING_FPN(mm->pgd[pgn]);
+  int i;
+
+  for (i = 0; i < PAGING_HPAGE_NR; i++)
+    pte_set_fpn(&mm->pgd[pgn + i], hfpn + i);
+  for (i = 1; i < PAGING_HPAGE_NR; i++)
+    enlist_pgn_node(&mm->fifo_pgn, pgn + i);
+
+  mm->thpsplit++;
+  tlb_flush(mm);
+  return 0;
+}
+#endif
+
 /*pg_getpage - get the page in ram
  *@mm: memory region
  *@pagenum: PGN
@@ -236,50 +746,133 @@ int libfree(struct pcb_t *proc, uint32_t reg_index){
  *
  */
 int pg_getpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller){
-uint32_t pte = mm->pgd[pgn];
+  uint32_t pte = mm->pgd[pgn];
+  int newfpn;
 
-if (!PAGING_PAGE_PRESENT(pte)){
+#ifdef HUGEPAGE_ORDER
+  /* Inside a huge page the head PTE maps the whole block */
+  uint32_t hpte = mm->pgd[PAGING_HPAGE_BASE(pgn)];
 
-if (!PAGING_PAGE_SWAPPED(pte)) {
-printf("=========invalid page access=========\n");
-return -1; // invalid page access: not in mem, not in swap
-}
+  if (PAGING_PAGE_HUGE(hpte)){
+    *fpn = PAGING_FPN(hpte) + (pgn - PAGING_HPAGE_BASE(pgn));
+    return 0;
+  }
+#endif
+
+  if (PAGING_PAGE_PRESENT(pte) && !PAGING_PAGE_SWAPPED(pte)){
+    *fpn = PAGING_FPN(pte);
+    return 0;
+  }
 
-int tgtfpn = PAGING_PTE_SWP(pte);
+  /* Never touched page is only valid inside a reserved vm area */
+  if (!PAGING_PAGE_PRESENT(pte)){
+    struct vm_area_struct *vma = get_vma_by_addr(mm, pgn * PAGING_PAGESZ);
 
-int vicpgn;
-find_victim_page(mm, &vicpgn);
+    if (vma == NULL){
+      trace_msg(TRACE_INFO, "=========invalid page access=========\n");
+      return -1; // invalid page access: not in mem, not in swap
+    }
 
-uint32_t vicpte = mm->pgd[vicpgn];
-int vicfpn = PAGING_FPN(vicpte);
+    /* Shared page: map the segment frame instead of a private one */
+    if (vma->vm_flags & VM_SHARED){
+      if (shm_getpage(caller, vma, pgn, fpn) < 0){
+        trace_msg(TRACE_INFO, "=========out of frame=========\n");
+        return -1;
+      }
+      mm->minflt++;
+      trace_ev(TR_FAULT, TRACE_DEBUG, caller->pid, pgn, TRF_MINOR);
+      return 0;
+    }
 
-int swpfpn;
-MEMPHY_get_freefp(caller->active_mswp, &swpfpn);
+#ifdef HUGEPAGE_ORDER
+    if (pg_hugepage_fault(mm, vma, pgn, fpn, caller) == 0){
+      mm->minflt++;
+      trace_ev(TR_FAULT, TRACE_DEBUG, caller->pid, pgn, TRF_HUGE);
+      return 0;
+    }
+#endif
+  }
 
-// Victim -> Swap
-struct sc_regs regs;
-regs.a1 = SYSMEM_SWP_OP;
-regs.a2 = vicfpn;
-regs.a3 = swpfpn;
-syscall(caller, 17, &regs);
+#ifdef MEMSWP_LATENCY
+  /* Major fault: start the swap transfer and let the process wait for
+   * it, the retried access after wake up completes the fault. Pages
+   * still in the compressed pool are decompressed right away. */
+  if (PAGING_PAGE_PRESENT(pte) && mm->pf_pgn != pgn && swap_entry_io(caller, pte)){
+    mm->pf_pgn = pgn;
+    mm->pf_ready = current_time(caller->ctx) + MEMSWP_LATENCY;
+    trace_ev(TR_SWAPIN, TRACE_DEBUG, caller->pid, pgn, mm->pf_ready);
+    return PAGING_FAULT_WAIT;
+  }
+  mm->pf_pgn = -1;
+#endif
 
-// Target -> Mem
-regs.a2 = vicfpn;
-regs.a3 = tgtfpn;
-syscall(caller, 17, &regs);
+  if (pg_getfreefp(mm, &newfpn, caller) < 0){
+    trace_msg(TRACE_INFO, "=========out of frame=========\n");
+    return -1;
+  }
 
-// Update victim to swapped
-pte_set_swap(&mm->pgd[vicpgn], 0, swpfpn);
+  if (PAGING_PAGE_PRESENT(pte)){
+    /* Major fault: target page is on swap, copy it back to the new frame */
+    swap_entry_load(caller, pte, newfpn);
+    swap_entry_put(caller, pte);
+    mm->majflt++;
+    trace_ev(TR_FAULT, TRACE_DEBUG, caller->pid, pgn, TRF_MAJOR);
+  } else {
+    /* Minor fault: first touch gets a demand-zero frame */
+    MEMPHY_write_range(caller->mram, newfpn * PAGING_PAGESZ, NULL, PAGING_PAGESZ);
+    mm->minflt++;
+    trace_ev(TR_FAULT, TRACE_DEBUG, caller->pid, pgn, TRF_MINOR);
+  }
 
-// Update target to memory
-pte_set_fpn(&mm->pgd[pgn], vicfpn);
-PAGING_PTE_SET_PRESENT(mm->pgd[pgn]);
+  // Update target to memory
+  pte_set_fpn(&mm->pgd[pgn], newfpn);
+  enlist_pgn_node(&mm->fifo_pgn, pgn);
 
-enlist_pgn_node(&mm->fifo_pgn, pgn);
+  *fpn = newfpn;
+  return 0;
 }
 
-*fpn = PAGING_FPN(mm->pgd[pgn]);
-return 0;
+
+
+
+/*pg_cowpage - give a copy-on-write page its own frame before a write
+ *@mm: memory region
+ *@pgn: PGN
+ *@fpn: FPN of the page, the new frame on return
+ *@caller: caller
+ *
+ */
+int pg_cowpage(struct mm_struct *mm, int pgn, int *fpn, struct pcb_t *caller){
+  int oldfpn = *fpn, newfpn, ret;
+
+  mm->cowflt++;
+  trace_ev(TR_FAULT, TRACE_DEBUG, caller->pid, pgn, TRF_COW);
+  tlb_flush(mm);
+
+  /* The other mappings are gone, the frame is ours to write */
+  if (caller->mram->fp_refcnt[oldfpn] == 1){
+    CLRBIT(mm->pgd[pgn], PAGING_PTE_COW_MASK);
+    return 0;
+  }
+
+  /* Keep the source page off the victim list while a frame is found */
+  delist_pgn_node(&mm->fifo_pgn, pgn);
+  ret = pg_getfreefp(mm, &newfpn, caller);
+  enlist_pgn_node(&mm->fifo_pgn, pgn);
+  if (ret < 0){
+    trace_msg(TRACE_INFO, "=========out of frame=========\n");
+    return -1;
+  }
+
+  MEMPHY_copy_frame(caller->mram, oldfpn, caller->mram, newfpn);
+  MEMPHY_put_freefp(caller->mram, oldfpn);
+
+  pte_set_fpn(&mm->pgd[pgn], newfpn);
+  CLRBIT(mm->pgd[pgn], PAGING_PTE_COW_MASK);
+  caller->ctx->cow_copied++;
+
+  *fpn = newfpn;
+  return 0;
 }
 
 
@@ -298,7 +891,11 @@ int off = PAGING_OFFST(addr);
 int fpn;
 
 /* Get the page to MEMRAM, swap from MEMSWAP if needed */
-if (pg_getpage(mm, pgn, &fpn, caller) != 0) return -1; /* invalid page access */
+if (tlb_lookup(mm, pgn, 0, &fpn) != 0){
+  int ret = pg_getpage(mm, pgn, &fpn, caller);
+  if (ret != 0) return ret; /* invalid page access or swap-in started */
+  tlb_fill(mm, pgn, fpn);
+}
 
 /* Calculate physical address */
 int phyaddr = (fpn << (PAGING_ADDR_OFFST_HIBIT + 1)) | off;
@@ -308,7 +905,7 @@ struct sc_regs regs;
 regs.a1 = SYSMEM_IO_READ;
 regs.a2 = phyaddr;
 if(syscall(caller, 17, &regs) < 0){
-printf("=========syscall 17 SYSMEM_IO_READ fail=========\n");
+trace_msg(TRACE_INFO, "=========syscall 17 SYSMEM_IO_READ fail=========\n");
 return -1;
 }
 
@@ -331,7 +928,14 @@ int pgn = PAGING_PGN(addr);
 int off = PAGING_OFFST(addr);
 int fpn;
 /* Get the page to MEMRAM, swap from MEMSWAP if needed */
-if (pg_getpage(mm, pgn, &fpn, caller) != 0) return -1;
+if (tlb_lookup(mm, pgn, 1, &fpn) != 0){
+  int ret = pg_getpage(mm, pgn, &fpn, caller);
+  if (ret != 0) return ret;
+
+  /* Break the sharing left by fork before the first write */
+  if (PAGING_PAGE_COW(mm->pgd[pgn]) && pg_cowpage(mm, pgn, &fpn, caller) != 0) return -1;
+  tlb_fill(mm, pgn, fpn);
+}
 
 /* Calculate physical address */
 int phyaddr = (fpn << (PAGING_ADDR_OFFST_HIBIT + 1)) | off;
@@ -343,7 +947,7 @@ regs.a2 = phyaddr;
 regs.a3 = value;
 
 if(syscall(caller, 17, &regs) < 0){
-printf("=========syscall 17 SYSMEM_IO_WRITE fail=========\n");
+trace_msg(TRACE_INFO, "=========syscall 17 SYSMEM_IO_WRITE fail=========\n");
 return -1;
 }
   
@@ -353,6 +957,113 @@ return 0;
 
 
 
+/*pg_resident - whether pg_getpage finds the frame of a page without
+ *               taking a free one
+ *@mm: memory region
+ *@pgn: PGN
+ *
+ */
+static int pg_resident(struct mm_struct *mm, int pgn){
+#ifdef HUGEPAGE_ORDER
+  if (PAGING_PAGE_HUGE(mm->pgd[PAGING_HPAGE_BASE(pgn)]))
+    return 1;
+#endif
+  return PAGING_PAGE_PRESENT(mm->pgd[pgn]) && !PAGING_PAGE_SWAPPED(mm->pgd[pgn]);
+}
+
+/*pg_iov_flush - move the gathered segments with one SYSMEM_IO_READV or
+ *               SYSMEM_IO_WRITEV
+ *@caller: caller
+ *@regs: syscall registers, op and segment array set
+ *@nr: number of segments, zero on return
+ *
+ */
+static int pg_iov_flush(struct pcb_t *caller, struct sc_regs *regs, int *nr){
+  if (*nr == 0)
+    return 0;
+
+  regs->a2 = *nr;
+  *nr = 0;
+  if (syscall(caller, 17, regs) < 0){
+    trace_msg(TRACE_INFO, "=========syscall 17 SYSMEM_IO_%s fail=========\n",
+              regs->a1 == SYSMEM_IO_READV ? "READV" : "WRITEV");
+    return -1;
+  }
+  return 0;
+}
+
+/*pg_rangeio - read or write a range of virtual memory
+ *@mm: memory region
+ *@addr: virtual address of the first byte
+ *@buf: bytes read or written
+ *@len: number of bytes
+ *@write: write instead of read
+ *@caller: caller
+ *@moved: return the bytes moved, the ones before the page of a swap-in
+ *        wait when PAGING_FAULT_WAIT is returned
+ *
+ * Each page is translated as pg_getval and pg_setval do, the frame
+ * pieces are gathered and moved by one syscall instead of one per byte.
+ * A fault may take the frame of a page gathered before it, so what is
+ * gathered moves first. The caller goes on from *moved after the wait,
+ * a range larger than MEMRAM would never complete from its start.
+ */
+static int pg_rangeio(struct mm_struct *mm, int addr, BYTE *buf, int len, int write, struct pcb_t *caller, int *moved){
+  struct memio_vec iov[SYSMEM_IOV_MAX];
+  struct sc_regs regs;
+  int nr = 0, done, n, vaddr, pgn, fpn, phyaddr, ret;
+
+  regs.a1 = write ? SYSMEM_IO_WRITEV : SYSMEM_IO_READV;
+  regs.iov = iov;
+  *moved = 0;
+
+  for (done = 0; done < len; done += n){
+    vaddr = addr + done;
+    pgn = PAGING_PGN(vaddr);
+    n = PAGING_PAGESZ - PAGING_OFFST(vaddr);
+    if (n > len - done)
+      n = len - done;
+
+    if (tlb_lookup(mm, pgn, write, &fpn) != 0){
+      if (!pg_resident(mm, pgn) || (write && PAGING_PAGE_COW(mm->pgd[pgn]))){
+        if (pg_iov_flush(caller, &regs, &nr) < 0)
+          return -1;
+        *moved = done;
+      }
+
+      ret = pg_getpage(mm, pgn, &fpn, caller);
+      if (ret != 0) return ret;
+      if (write && PAGING_PAGE_COW(mm->pgd[pgn]) && pg_cowpage(mm, pgn, &fpn, caller) != 0) return -1;
+      tlb_fill(mm, pgn, fpn);
+    }
+
+    phyaddr = (fpn << (PAGING_ADDR_OFFST_HIBIT + 1)) | PAGING_OFFST(vaddr);
+
+    /* Pages in consecutive frames make one segment */
+    if (nr > 0 && iov[nr - 1].addr + iov[nr - 1].len == (uint32_t)phyaddr){
+      iov[nr - 1].len += n;
+      continue;
+    }
+    if (nr == SYSMEM_IOV_MAX){
+      if (pg_iov_flush(caller, &regs, &nr) < 0)
+        return -1;
+      *moved = done;
+    }
+    iov[nr].addr = phyaddr;
+    iov[nr].len = n;
+    iov[nr].buf = buf + done;
+    nr++;
+  }
+
+  if (pg_iov_flush(caller, &regs, &nr) < 0)
+    return -1;
+  *moved = len;
+  return 0;
+}
+
+
+
+
 /*__read - read value in region memory
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -366,13 +1077,15 @@ struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
 struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 
 /* Invalid memory identify */
-if (currg == NULL || cur_vma == NULL){
-printf("========fail to read========\n");
+if (currg == NULL || cur_vma == NULL || currg->rg_start == currg->rg_end){
+trace_msg(TRACE_INFO, "========fail to read========\n");
 return -1;
 }
 
-if(pg_getval(caller->mm, currg->rg_start + offset, data, caller) < 0){
-printf("========fail to read========\n");
+int ret = pg_getval(caller->mm, currg->rg_start + offset, data, caller);
+if (ret == PAGING_FAULT_WAIT) return ret;
+if (ret < 0){
+trace_msg(TRACE_INFO, "========fail to read========\n");
 return -1;
 }
 
@@ -388,19 +1101,22 @@ int libread(
     uint32_t source,    // Index of source register
     uint32_t offset,    // Source address = [source] + [offset]
     uint32_t* destination){
-pthread_mutex_lock(&mmvm_lock);
-BYTE data;
+struct sim_ctx *ctx = proc->ctx;
+pthread_mutex_lock(&ctx->mmvm_lock);
+BYTE data = 0; /* what a failed read reports */
 int val = __read(proc, 0, source, offset, &data);
 
+/* The access is retried once the swap-in completes */
+if (val == PAGING_FAULT_WAIT){
+pthread_mutex_unlock(&ctx->mmvm_lock);
+return val;
+}
+
 *destination = (uint32_t)data;
-#ifdef IODUMP
-printf("read region=%d offset=%d value=%d PID=%d\n", source, offset, data, proc->pid);
-#ifdef PAGETBL_DUMP
+trace_ev(TR_READ, TRACE_IO, source, offset, data, proc->pid);
 print_pgtbl(proc, 0, -1); //print max TBL
-#endif
 MEMPHY_dump(proc->mram);
-#endif
-pthread_mutex_unlock(&mmvm_lock);
+pthread_mutex_unlock(&ctx->mmvm_lock);
 return val;
 }
 
@@ -419,13 +1135,15 @@ int __write(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE value){
 struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
 struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
 /* Invalid memory identify */
-if (currg == NULL || cur_vma == NULL){
-printf("========fail to write========\n");
+if (currg == NULL || cur_vma == NULL || currg->rg_start == currg->rg_end){
+trace_msg(TRACE_INFO, "========fail to write========\n");
 return -1;
 }
 
-if(pg_setval(caller->mm, currg->rg_start + offset, value, caller) < 0){
-printf("========fail to write========\n");
+int ret = pg_setval(caller->mm, currg->rg_start + offset, value, caller);
+if (ret == PAGING_FAULT_WAIT) return ret;
+if (ret < 0){
+trace_msg(TRACE_INFO, "========fail to write========\n");
 return -1;
 }
 
@@ -435,76 +1153,468 @@ return 0;
 
 
 
+/*__read_range - read a byte range of region memory
+ *@caller: caller
+ *@vmaid: ID vm area of the region
+ *@rgid: memory region ID (used to identify variable in symbole table)
+ *@offset: offset of the first byte in memory region
+ *@buf: bytes read
+ *@len: bytes wanted, return the bytes read, those up to the region end
+ *      or up to a swap-in wait
+ *
+ */
+int __read_range(struct pcb_t *caller, int vmaid, int rgid, int offset, BYTE *buf, int *len){
+  struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+  int want = *len, ret;
+
+  if (currg == NULL || cur_vma == NULL || offset < 0 || want < 0 ||
+      currg->rg_start + offset >= currg->rg_end){
+    trace_msg(TRACE_INFO, "========fail to read========\n");
+    return -1;
+  }
+  if (want > currg->rg_end - currg->rg_start - offset)
+    want = currg->rg_end - currg->rg_start - offset;
+
+  ret = pg_rangeio(caller->mm, currg->rg_start + offset, buf, want, 0, caller, len);
+  if (ret == PAGING_FAULT_WAIT) return ret;
+  if (ret < 0){
+    trace_msg(TRACE_INFO, "========fail to read========\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*__write_range - write a byte range of region memory
+ *@caller: caller
+ *@vmaid: ID vm area of the region
+ *@rgid: memory region ID (used to identify variable in symbole table)
+ *@offset: offset of the first byte in memory region
+ *@buf: bytes to write
+ *@len: number of bytes, all inside the region, return the bytes written,
+ *      those up to a swap-in wait
+ *
+ */
+int __write_range(struct pcb_t *caller, int vmaid, int rgid, int offset, const BYTE *buf, int *len){
+  struct vm_rg_struct *currg = get_symrg_byid(caller->mm, rgid);
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+  int want = *len, ret;
+
+  if (currg == NULL || cur_vma == NULL || offset < 0 || want < 0 ||
+      currg->rg_start + offset + want > currg->rg_end){
+    trace_msg(TRACE_INFO, "========fail to write========\n");
+    return -1;
+  }
+
+  ret = pg_rangeio(caller->mm, currg->rg_start + offset, (BYTE *)buf, want, 1, caller, len);
+  if (ret == PAGING_FAULT_WAIT) return ret;
+  if (ret < 0){
+    trace_msg(TRACE_INFO, "========fail to write========\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+
+
+
 /*libwrite - PAGING-based write a region memory */
 int libwrite(
     struct pcb_t *proc,   // Process executing the instruction
     BYTE data,            // Data to be wrttien into memory
     uint32_t destination, // Index of destination register
     uint32_t offset){
-pthread_mutex_lock(&mmvm_lock);
+struct sim_ctx *ctx = proc->ctx;
+pthread_mutex_lock(&ctx->mmvm_lock);
 int return_flag = __write(proc, 0, destination, offset, data);
 
-#ifdef IODUMP
-printf("write region=%d offset=%d value=%d PID=%d\n", destination, offset, data, proc->pid);
-#ifdef PAGETBL_DUMP
+/* The access is retried once the swap-in completes */
+if (return_flag == PAGING_FAULT_WAIT){
+pthread_mutex_unlock(&ctx->mmvm_lock);
+return return_flag;
+}
+
+trace_ev(TR_WRITE, TRACE_IO, destination, offset, data, proc->pid);
 print_pgtbl(proc, 0, -1); //print max TBL
-#endif
 MEMPHY_dump(proc->mram);
-#endif
-pthread_mutex_unlock(&mmvm_lock);
+pthread_mutex_unlock(&ctx->mmvm_lock);
 return return_flag;
 }
 
 
 
 
+/*libread_range - PAGING-based read of a byte range of a region
+ *@proc: process executing the read
+ *@source: region
+ *@offset: offset of the first byte
+ *@buf: bytes read
+ *@len: bytes wanted, return the bytes read
+ *
+ * After PAGING_FAULT_WAIT *len bytes are read, the rest is read by a
+ * call for offset + *len once the swap-in completes.
+ */
+int libread_range(struct pcb_t *proc, uint32_t source, uint32_t offset, BYTE *buf, uint32_t *len){
+  struct sim_ctx *ctx = proc->ctx;
+  int n = *len, ret;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+  ret = __read_range(proc, 0, source, offset, buf, &n);
+  if (ret != 0){
+    if (ret == PAGING_FAULT_WAIT)
+      *len = n;
+    pthread_mutex_unlock(&ctx->mmvm_lock);
+    return ret;
+  }
+
+  *len = n;
+  trace_ev(TR_READV, TRACE_IO, source, offset, n, proc->pid);
+  print_pgtbl(proc, 0, -1);
+  MEMPHY_dump(proc->mram);
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+/*libwrite_range - PAGING-based write of a byte range of a region
+ *@proc: process executing the write
+ *@buf: bytes to write
+ *@len: number of bytes, return the bytes written
+ *@destination: region
+ *@offset: offset of the first byte
+ *
+ * After PAGING_FAULT_WAIT *len bytes are written, as in libread_range.
+ */
+int libwrite_range(struct pcb_t *proc, const BYTE *buf, uint32_t *len, uint32_t destination, uint32_t offset){
+  struct sim_ctx *ctx = proc->ctx;
+  int n = *len, ret;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+  ret = __write_range(proc, 0, destination, offset, buf, &n);
+  if (ret != 0){
+    if (ret == PAGING_FAULT_WAIT)
+      *len = n;
+    pthread_mutex_unlock(&ctx->mmvm_lock);
+    return ret;
+  }
+
+  trace_ev(TR_WRITEV, TRACE_IO, destination, offset, n, proc->pid);
+  print_pgtbl(proc, 0, -1);
+  MEMPHY_dump(proc->mram);
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+
+
+
 /*free_pcb_memphy - collect all memphy of pcb
  *@caller: caller
- *@vmaid: ID vm area to alloc memory region
- *@incpgnum: number of page
+ *
+ * Every frame mapped by the process goes back to MEMRAM and MEMSWP and
+ * its shared areas are detached. The vm areas themselves stay for free_mm.
  */
 int free_pcb_memph(struct pcb_t *caller){
-  int pagenum, fpn;
-  uint32_t pte;
+  struct vm_area_struct *vma, *vma_next;
+  struct pgn_t *pgn, *pgn_next;
+  struct sim_ctx *ctx = caller->ctx;
 
+  delist_mm_proc(caller);
 
-  for(pagenum = 0; pagenum < PAGING_MAX_PGN; pagenum++)
-  {
-    pte= caller->mm->pgd[pagenum];
+  pthread_mutex_lock(&ctx->mmvm_lock);
 
-    if (!PAGING_PAGE_PRESENT(pte))
-    {
-      fpn = PAGING_PTE_FPN(pte);
-      MEMPHY_put_freefp(caller->mram, fpn);
-    } else {
-      fpn = PAGING_PTE_SWP(pte);
-      MEMPHY_put_freefp(caller->active_mswp, fpn);    
+  /* Nothing stays resident, drop the FIFO up front instead of per page */
+  for (pgn = caller->mm->fifo_pgn; pgn != NULL; pgn = pgn_next){
+    pgn_next = pgn->pg_next;
+    free(pgn);
+  }
+  caller->mm->fifo_pgn = NULL;
+
+  for (vma = caller->mm->mmap; vma != NULL; vma = vma_next){
+    vma_next = vma->vm_next;
+    vm_unmap_range(caller, vma->vm_start, PAGING_PAGE_ALIGNSZ(vma->vm_end));
+    if (vma->vm_flags & VM_SHARED){
+      shm_detach(ctx, vma);
+      remove_vm_area(caller->mm, vma->vm_id);
+    }
+  }
+
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+
+
+/*__dup_mm - copy the memory of a process for fork
+ *@caller: parent process
+ *@newmm: uninitialized memory region of the child
+ *
+ * Areas, free regions and the symbol table are copied. Private resident
+ * pages are not: both page tables map the same frame marked COW, and
+ * swapped pages share their swap slot. Shared segments get attached.
+ */
+int __dup_mm(struct pcb_t *caller, struct mm_struct *newmm){
+  struct mm_struct *mm = caller->mm;
+  struct pgn_t *pgit, **pgtail;
+  struct vm_rg_struct *rg;
+  struct sim_ctx *ctx = caller->ctx;
+  int i;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+
+  newmm->pgd = malloc(PAGING_MAX_PGN * sizeof(uint32_t));
+  memset(newmm->pgd, 0, PAGING_MAX_PGN * sizeof(uint32_t));
+  newmm->mmap = NULL;
+  newmm->vma_addr = NULL;
+  newmm->vma_id = NULL;
+  newmm->vma_cnt = 0;
+  newmm->vma_cap = 0;
+  newmm->vma_next_id = 0;
+  newmm->minflt = 0;
+  newmm->majflt = 0;
+  newmm->cowflt = 0;
+  newmm->pf_pgn = -1;
+  newmm->pf_ready = 0;
+  newmm->thpflt = 0;
+  newmm->thpsplit = 0;
+#ifdef TLB_ENTRIES
+  newmm->tlb_hit = 0;
+  newmm->tlb_miss = 0;
+#endif
+  tlb_flush(newmm);
+  /* The parent pages turn copy-on-write below */
+  tlb_flush(mm);
+
+#ifdef HUGEPAGE_ORDER
+  /* Copy-on-write works on base pages, huge pages are split first */
+  for (i = 0; i < mm->vma_cnt; i++){
+    unsigned long pgn;
+
+    for (pgn = mm->vma_id[i]->vm_start / PAGING_PAGESZ; pgn < DIV_ROUND_UP(mm->vma_id[i]->vm_end, PAGING_PAGESZ); pgn++)
+      if (PAGING_PAGE_HUGE(mm->pgd[pgn]))
+        pg_hugepage_split(mm, pgn);
+  }
+#endif
+
+  newmm->symrgtbl_sz = mm->symrgtbl_sz;
+  newmm->symrgtbl = malloc(mm->symrgtbl_sz * sizeof(struct vm_rg_struct));
+  memcpy(newmm->symrgtbl, mm->symrgtbl, mm->symrgtbl_sz * sizeof(struct vm_rg_struct));
+
+  /* Same FIFO order, so both processes pick the same victims */
+  newmm->fifo_pgn = NULL;
+  pgtail = &newmm->fifo_pgn;
+  for (pgit = mm->fifo_pgn; pgit != NULL; pgit = pgit->pg_next){
+    *pgtail = malloc(sizeof(struct pgn_t));
+    (*pgtail)->pgn = pgit->pgn;
+    (*pgtail)->pg_next = NULL;
+    pgtail = &(*pgtail)->pg_next;
+  }
+
+  /* Going by ID keeps the copied IDs sorted in vma_id */
+  for (i = 0; i < mm->vma_cnt; i++){
+    struct vm_area_struct *vma = mm->vma_id[i];
+    struct vm_area_struct *newvma = create_vm_area(newmm, vma->vm_start, vma->vm_end, vma->vm_flags);
+    unsigned long pgn;
+
+    newvma->vm_id = vma->vm_id;
+    newvma->sbrk = vma->sbrk;
+    for (rg = vma->vm_freerg_list; rg != NULL; rg = rg->rg_next)
+      vm_freerg_insert(newvma, init_vm_rg(rg->rg_start, rg->rg_end));
+
+    if (vma->vm_flags & VM_SHARED){
+      newvma->vm_shm = vma->vm_shm;
+      vma->vm_shm->nattch++;
+    }
+
+    for (pgn = vma->vm_start / PAGING_PAGESZ; pgn < DIV_ROUND_UP(vma->vm_end, PAGING_PAGESZ); pgn++){
+      uint32_t pte = mm->pgd[pgn];
+
+      if (!PAGING_PAGE_PRESENT(pte))
+        continue;
+
+      if (PAGING_PAGE_SWAPPED(pte)){
+        swap_entry_get(caller, pte);
+      } else {
+        MEMPHY_get_fp(caller->mram, PAGING_PTE_FPN(pte));
+        if (!(vma->vm_flags & VM_SHARED)){
+          SETBIT(mm->pgd[pgn], PAGING_PTE_COW_MASK);
+          ctx->cow_shared++;
+        }
+      }
+      newmm->pgd[pgn] = mm->pgd[pgn];
     }
   }
+  newmm->vma_next_id = mm->vma_next_id;
 
+  pthread_mutex_unlock(&ctx->mmvm_lock);
   return 0;
 }
 
+/*cow_stat - copy-on-write totals of all processes
+ *@ctx: simulation
+ *@shared: return pages left shared by fork
+ *@copied: return pages copied on a later write
+ *
+ * Every shared page not copied yet is a frame fork did not spend.
+ */
+int cow_stat(struct sim_ctx *ctx, unsigned long *shared, unsigned long *copied){
+  pthread_mutex_lock(&ctx->mmvm_lock);
+  *shared = ctx->cow_shared;
+  *copied = ctx->cow_copied;
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+
+
+
+/*enlist_mm_proc - make a process visible to the page reclaimer
+ *@proc: process with an initialized mm
+ *
+ */
+int enlist_mm_proc(struct pcb_t *proc){
+  struct sim_ctx *ctx = proc->ctx;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+
+  if (ctx->mm_nr_procs == ctx->mm_procs_cap){
+    int newcap = (ctx->mm_procs_cap > 0) ? ctx->mm_procs_cap * 2 : 16;
+    struct pcb_t **newprocs = realloc(ctx->mm_procs, newcap * sizeof(*newprocs));
+    if (newprocs == NULL){
+      pthread_mutex_unlock(&ctx->mmvm_lock);
+      return -1;
+    }
+    ctx->mm_procs = newprocs;
+    ctx->mm_procs_cap = newcap;
+  }
+  ctx->mm_procs[ctx->mm_nr_procs++] = proc;
+
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+/*delist_mm_proc - hide a finishing process from the page reclaimer
+ *@proc: process
+ *
+ */
+int delist_mm_proc(struct pcb_t *proc){
+  struct sim_ctx *ctx = proc->ctx;
+  int i;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+
+  for (i = 0; i < ctx->mm_nr_procs; i++){
+    if (ctx->mm_procs[i] == proc){
+      ctx->mm_procs[i] = ctx->mm_procs[--ctx->mm_nr_procs];
+      break;
+    }
+  }
+#ifdef KSM
+  /* Scan nodes may point into the mm about to be freed */
+  ksm_reset(ctx);
+#endif
+  if (ctx->mm_nr_procs == 0){
+    free(ctx->mm_procs);
+    ctx->mm_procs = NULL;
+    ctx->mm_procs_cap = 0;
+  }
+
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+/*kswapd_balance - refill the free frames of MEMRAM ahead of demand
+ *@ctx: simulation
+ *@mram: MEMRAM device
+ *
+ * Nothing happens above the low watermark. Below it the oldest resident
+ * page of each process is swapped out in turn until the high watermark
+ * is reached or no process has a page left to give.
+ */
+int kswapd_balance(struct sim_ctx *ctx, struct memphy_struct *mram){
+  int nrfp = mram->maxsz / PAGING_PAGESZ;
+  int low = nrfp * KSWAPD_WMARK_LOW / 100;
+  int high = nrfp * KSWAPD_WMARK_HIGH / 100;
+  int reclaimed = 0, idle = 0, vicfpn;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+
+  if (MEMPHY_nr_freefp(mram) >= low){
+    pthread_mutex_unlock(&ctx->mmvm_lock);
+    return 0;
+  }
+
+  while (MEMPHY_nr_freefp(mram) < high && idle < ctx->mm_nr_procs){
+    struct pcb_t *proc = ctx->mm_procs[ctx->kswapd_next++ % ctx->mm_nr_procs];
+
+    /* A shared frame would only lose a reference, those stay */
+    if (proc->mram != mram || pg_swapout(proc->mm, 1, &vicfpn, proc) < 0){
+      idle++;
+      continue;
+    }
+
+    idle = 0;
+    if (mram->fp_refcnt[vicfpn] == 1){
+      ctx->steal_kswapd++;
+      reclaimed++;
+    }
+    MEMPHY_put_freefp(mram, vicfpn);
+  }
+
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return reclaimed;
+}
+
+/*reclaim_stat - pages reclaimed by kswapd and by the fault path
+ *@ctx: simulation
+ *@kswapd: return pages swapped out in the background
+ *@direct: return pages swapped out while a fault waited
+ *
+ */
+int reclaim_stat(struct sim_ctx *ctx, unsigned long *kswapd, unsigned long *direct){
+  pthread_mutex_lock(&ctx->mmvm_lock);
+  *kswapd = ctx->steal_kswapd;
+  *direct = ctx->steal_direct;
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+
 
 
 // TODO here (need fix ?)
 /*find_victim_page - find victim page
  *@caller: caller
+ *@mram: if not NULL, pages whose frame is shared there are passed over
  *@pgn: return page number
+ *
+ * Pages are enlisted at the head, so the FIFO victim is the oldest page
+ * still resident in MEMRAM, i.e. the last one found walking the list.
  */
-int find_victim_page(struct mm_struct *mm, int *retpgn){
-struct pgn_t *pg = mm->fifo_pgn;
+int find_victim_page(struct mm_struct *mm, struct memphy_struct *mram, int *retpgn){
+  struct pgn_t **pgit = &mm->fifo_pgn;
+  struct pgn_t **victim = NULL;
+  struct pgn_t *pg;
+
+  for (; *pgit != NULL; pgit = &(*pgit)->pg_next){
+    uint32_t pte = mm->pgd[(*pgit)->pgn];
+    if (!PAGING_PAGE_PRESENT(pte) || PAGING_PAGE_SWAPPED(pte))
+      continue;
+    if (mram != NULL && mram->fp_refcnt[PAGING_FPN(pte)] > 1)
+      continue;
+    victim = pgit;
+  }
 
-// fifo so get first, second move to first
-if (pg != NULL){
-*retpgn = pg->pgn;
-mm->fifo_pgn = pg->pg_next;
-free(pg);
-}
-//If no page in queue, use a simple approach - page 0
-else *retpgn = 0;
+  if (victim == NULL)
+    return -1;
 
-return 0;
+  pg = *victim;
+  *retpgn = pg->pgn;
+  *victim = pg->pg_next;
+  free(pg);
+
+  return 0;
 }
 
 
@@ -518,45 +1628,16 @@ return 0;
  *
  */
 int get_free_vmrg_area(struct pcb_t *caller, int vmaid, int size, struct vm_rg_struct *newrg){
-if(caller == NULL || newrg == NULL) return -1;
-// debug
-// printf("The value of vmaid is: %d\n", vmaid);
-struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
-if (cur_vma == NULL) return -1;
-struct vm_rg_struct *rgit = cur_vma->vm_freerg_list;
-if (rgit == NULL) return -1;
-
-/* Probe unintialized newrg */
-// mean reset this mem region pointer for use
-newrg->rg_end = -1;
-newrg->rg_start = -1;
-
-/* TODO Traverse on list of free vm region to find a fit space */
-for(;rgit != NULL;){
-
-// found fit region
-if(rgit->rg_end - rgit->rg_start >= size){
-newrg->rg_start = rgit->rg_start;
-newrg->rg_end = rgit->rg_start + size;
-
-// Update the used region
-//if not used all free space
-if (rgit->rg_end - newrg->rg_end > 0){
-rgit->rg_start = newrg->rg_end;
-}
-// if used all free space, remove this rg from free list
-else{
-cur_vma->vm_freerg_list = rgit->rg_next;
-free(rgit);
-}
-      
-return 0;
-}
+  if (caller == NULL || newrg == NULL) return -1;
 
-rgit = rgit->rg_next;
-}
+  struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
+  if (cur_vma == NULL) return -1;
 
-return -1;
+  /* Probe unintialized newrg */
+  newrg->rg_end = -1;
+  newrg->rg_start = -1;
+
+  return vm_freerg_take(cur_vma, size, newrg);
 }
 
 //#endif
@@ -10,6 +10,7 @@
 
 #include "common.h"
 #include "syscall.h"
+#include "trace.h"
 
 int libsyscall (struct pcb_t *caller,
              uint32_t syscall_idx,
@@ -23,5 +24,6 @@ int libsyscall (struct pcb_t *caller,
    regs.a2 = a2;
    regs.a3 = a3;
 
+   trace_ev(TR_SYSCALL, TRACE_DEBUG, caller->pid, syscall_idx, a1, a2, a3);
    return syscall(caller, syscall_idx, &regs);
 }
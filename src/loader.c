@@ -1,10 +1,10 @@
 
 #include "loader.h"
+#include "sim.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-static uint32_t avail_pid = 1;
+#include <pthread.h>
 
 #define OPT_CALC	"calc"
 #define OPT_ALLOC	"alloc"
@@ -13,7 +13,7 @@ static uint32_t avail_pid = 1;
 #define OPT_WRITE	"write"
 #define OPT_SYSCALL	"syscall"
 
-static enum ins_opcode_t get_opcode(char * opt) {
+static int get_opcode(char * opt) {
 	if (!strcmp(opt, OPT_CALC)) {
 		return CALC;
 	}else if (!strcmp(opt, OPT_ALLOC)) {
@@ -28,38 +28,43 @@ static enum ins_opcode_t get_opcode(char * opt) {
 		return SYSCALL;
 	}else{
 		printf("get_opcode return Opcode: %s\n", opt);
-		exit(1);
+		return -1;
 	}
 }
 
-struct pcb_t * load(const char * path) {
-	/* Create new PCB for the new process */
-	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
-	proc->pid = avail_pid;
-	avail_pid++;
-	proc->page_table =
-		(struct page_table_t*)malloc(sizeof(struct page_table_t));
-	proc->bp = PAGE_SIZE;
-	proc->pc = 0;
-
+struct pcb_t * load(struct sim_ctx * ctx, const char * path) {
 	/* Read process code from file */
 	FILE * file;
 	if ((file = fopen(path, "r")) == NULL) {
 		printf("Cannot find process description at '%s'\n", path);
-		exit(1);		
+		return NULL;
 	}
+
+	/* Create new PCB for the new process, zeroed: a snapshot may see it
+	 * held by the loader before it gets its mm */
+	struct pcb_t * proc = (struct pcb_t * )calloc(1, sizeof(struct pcb_t));
+	proc->ctx = ctx;
+	proc->page_table =
+		(struct page_table_t*)malloc(sizeof(struct page_table_t));
+	proc->bp = PAGE_SIZE;
+	proc->pc = 0;
+
 	snprintf(proc->path, 2*sizeof(path)+1, "%s", path);
 	char opcode[10];
 	proc->code = (struct code_seg_t*)malloc(sizeof(struct code_seg_t));
+	proc->code->refcnt = 1;
 	fscanf(file, "%u %u", &proc->priority, &proc->code->size);
 	proc->code->text = (struct inst_t*)malloc(
 		sizeof(struct inst_t) * proc->code->size
 	);
 	uint32_t i = 0;
 	char buf[200];
+	int op;
 	for (i = 0; i < proc->code->size; i++) {
-		fscanf(file, "%s", opcode);
-		proc->code->text[i].opcode = get_opcode(opcode);
+		if (fscanf(file, "%9s", opcode) != 1 || (op = get_opcode(opcode)) < 0) {
+			break;
+		}
+		proc->code->text[i].opcode = op;
 		switch(proc->code->text[i].opcode) {
 		case CALC:
 			break;
@@ -93,13 +98,53 @@ struct pcb_t * load(const char * path) {
 			           &proc->code->text[i].arg_3
 			);
 			break;
-		default:
-			printf("Opcode: %s\n", opcode);
-			exit(1);
 		}
 	}
+	fclose(file);
+	if (i < proc->code->size) {
+		free(proc->code->text);
+		free(proc->code);
+		free(proc->page_table);
+		free(proc);
+		return NULL;
+	}
+
+	/* CPUs fork while the loader runs */
+	pthread_mutex_lock(&ctx->pid_lock);
+	proc->pid = ctx->avail_pid;
+	ctx->avail_pid++;
+	pthread_mutex_unlock(&ctx->pid_lock);
+	return proc;
+}
+
+struct pcb_t * clone_pcb(struct pcb_t * parent) {
+	struct pcb_t * proc = (struct pcb_t * )malloc(sizeof(struct pcb_t));
+
+	/* Registers, PC and priority come along, the child resumes right
+	 * after the instruction that forked it */
+	*proc = *parent;
+	proc->page_table =
+		(struct page_table_t*)malloc(sizeof(struct page_table_t));
+	memcpy(proc->page_table, parent->page_table, sizeof(struct page_table_t));
+
+	pthread_mutex_lock(&proc->ctx->pid_lock);
+	proc->pid = proc->ctx->avail_pid;
+	proc->ctx->avail_pid++;
+	proc->code->refcnt++;
+	pthread_mutex_unlock(&proc->ctx->pid_lock);
+
 	return proc;
 }
 
+void free_code(struct sim_ctx * ctx, struct code_seg_t * code) {
+	uint32_t refcnt;
 
+	pthread_mutex_lock(&ctx->pid_lock);
+	refcnt = --code->refcnt;
+	pthread_mutex_unlock(&ctx->pid_lock);
 
+	if (refcnt == 0) {
+		free(code->text);
+		free(code);
+	}
+}
@@ -0,0 +1,312 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Physical memory compaction module mm/mm-compact.c
+ */
+
+#include "mm.h"
+#include "sim.h"
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+/* One mapping of a frame: a PTE or a frame slot of a shared segment */
+struct rmap_item {
+  uint32_t *pte;
+  int *slot;
+  int next;
+};
+
+static int frame_is_free(struct memphy_struct *mram, int fpn){
+  return fpn >= mram->fp_hiwm || mram->fp_refcnt[fpn] == 0;
+}
+
+/*compact_frag_stat - free frame runs of MEMRAM
+ *@mram: MEMRAM device
+ *@order: runs of 2^order frames are the ones asked for
+ *@stat: return statistics
+ *
+ * The unusable free space index is the share of free frames that cannot
+ * be handed out as part of a run of 2^order frames, 0 when all of them
+ * can and 100 when no free run is that long. The fragmentation index
+ * tells whether a missing run is due to fragmentation or low memory.
+ */
+int compact_frag_stat(struct memphy_struct *mram, int order, struct frag_stat *stat){
+  int nrfp = mram->maxsz / PAGING_PAGESZ;
+  int runsz = 1 << order;
+  int fpn, run = 0, usable = 0;
+
+  memset(stat, 0, sizeof(*stat));
+
+  for (fpn = 0; fpn <= nrfp; fpn++){
+    if (fpn < nrfp && frame_is_free(mram, fpn)){
+      stat->nr_free++;
+      run++;
+      continue;
+    }
+    if (run > 0){
+      stat->nr_runs++;
+      if (run > stat->largest)
+        stat->largest = run;
+      usable += run / runsz * runsz;
+    }
+    run = 0;
+  }
+
+  stat->unusable_pct = stat->nr_free ? 100 * (stat->nr_free - usable) / stat->nr_free : 0;
+
+  /* Near 0 a run is missing for lack of free frames, near 1000 for
+   * lack of contiguity only, compaction can help in the latter case */
+  if (stat->largest >= runsz)
+    stat->frag_index = -1;
+  else if (stat->nr_runs == 0)
+    stat->frag_index = 0;
+  else {
+    stat->frag_index = 1000 - (1000 + stat->nr_free * 1000 / runsz) / stat->nr_runs;
+    /* Few runs holding nearly a block each overshoot below 0 */
+    if (stat->frag_index < 0)
+      stat->frag_index = 0;
+  }
+  return 0;
+}
+
+/*compact_init - start collecting the reverse map of a device
+ *@cc: compaction control
+ *@mram: MEMRAM device
+ *
+ */
+int compact_init(struct compact_control *cc, struct memphy_struct *mram){
+  int fpn;
+
+  cc->mram = mram;
+  cc->nrfp = mram->maxsz / PAGING_PAGESZ;
+  cc->head = malloc(cc->nrfp * sizeof(int));
+  cc->nref = calloc(cc->nrfp, sizeof(unsigned int));
+  cc->items = NULL;
+  cc->nr_items = cc->cap = 0;
+
+  if (cc->head == NULL || cc->nref == NULL){
+    compact_free(cc);
+    return -1;
+  }
+  for (fpn = 0; fpn < cc->nrfp; fpn++)
+    cc->head[fpn] = -1;
+
+  return 0;
+}
+
+static int compact_add(struct compact_control *cc, int fpn, uint32_t *pte, int *slot){
+  struct rmap_item *item;
+
+  if (fpn < 0 || fpn >= cc->nrfp)
+    return -1;
+
+  if (cc->nr_items == cc->cap){
+    int cap = cc->cap ? cc->cap * 2 : 64;
+    struct rmap_item *items = realloc(cc->items, cap * sizeof(struct rmap_item));
+
+    if (items == NULL)
+      return -1;
+    cc->items = items;
+    cc->cap = cap;
+  }
+
+  item = &cc->items[cc->nr_items];
+  item->pte = pte;
+  item->slot = slot;
+  item->next = cc->head[fpn];
+  cc->head[fpn] = cc->nr_items++;
+  cc->nref[fpn]++;
+
+  return 0;
+}
+
+/*compact_add_pte - record a resident PTE in the reverse map
+ *@cc: compaction control
+ *@pte: page table entry mapping a MEMRAM frame
+ *
+ */
+int compact_add_pte(struct compact_control *cc, uint32_t *pte){
+  return compact_add(cc, PAGING_FPN(*pte), pte, NULL);
+}
+
+/*compact_add_slot - record a frame number held outside a page table
+ *@cc: compaction control
+ *@slot: location of the frame number
+ *
+ */
+int compact_add_slot(struct compact_control *cc, int *slot){
+  return compact_add(cc, *slot, NULL, slot);
+}
+
+/*compact_run - migrate in-use frames down into the free holes
+ *@cc: compaction control with the complete reverse map
+ *
+ * A free scanner walks up from frame 0 and a migration scanner walks
+ * down from the high water mark, each frame taken from the top is copied
+ * into the lowest hole and all of its mappings are repointed. Frames
+ * with references the reverse map does not account for are left where
+ * they are. The free list is rebuilt in ascending order afterwards, so
+ * consecutive allocations get consecutive frames.
+ */
+int compact_run(struct compact_control *cc){
+  struct memphy_struct *mram = cc->mram;
+  int lo = 0, hi = mram->fp_hiwm - 1, moved = 0;
+
+  for (;;){
+    while (lo < hi && !frame_is_free(mram, lo))
+      lo++;
+    while (lo < hi && (frame_is_free(mram, hi) || cc->nref[hi] != mram->fp_refcnt[hi]))
+      hi--;
+    if (lo >= hi)
+      break;
+
+    MEMPHY_copy_frame(mram, hi, mram, lo);
+    for (int idx = cc->head[hi]; idx >= 0; idx = cc->items[idx].next){
+      if (cc->items[idx].pte != NULL)
+        SETVAL(*cc->items[idx].pte, lo, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
+      else
+        *cc->items[idx].slot = lo;
+    }
+    mram->fp_refcnt[lo] = mram->fp_refcnt[hi];
+    mram->fp_refcnt[hi] = 0;
+    lo++;
+    hi--;
+    moved++;
+  }
+
+  MEMPHY_rebuild_freelist(mram);
+  return moved;
+}
+
+/*compact_free - release the reverse map
+ *@cc: compaction control
+ *
+ */
+int compact_free(struct compact_control *cc){
+  free(cc->head);
+  free(cc->nref);
+  free(cc->items);
+  cc->head = NULL;
+  cc->nref = NULL;
+  cc->items = NULL;
+
+  return 0;
+}
+
+/*__compact_memory - migrate the frames of MEMRAM into one end
+ *@ctx: simulation
+ *@mram: MEMRAM device
+ *@before: return fragmentation before the pass
+ *@after: return fragmentation after the pass
+ *
+ * The reverse map is collected from the page tables of the registered
+ * processes and from the shared segments, the caller holds the libmem
+ * lock.
+ */
+int __compact_memory(struct sim_ctx *ctx, struct memphy_struct *mram, struct frag_stat *before, struct frag_stat *after){
+  struct compact_control cc;
+  struct vm_area_struct *vma;
+  int i, moved;
+
+  compact_frag_stat(mram, COMPACT_ORDER, before);
+  if (compact_init(&cc, mram) < 0)
+    return -1;
+
+  for (i = 0; i < ctx->mm_nr_procs; i++){
+    struct mm_struct *mm = ctx->mm_procs[i]->mm;
+
+    if (ctx->mm_procs[i]->mram != mram)
+      continue;
+    for (vma = mm->mmap; vma != NULL; vma = vma->vm_next){
+      unsigned long pgn;
+
+      for (pgn = vma->vm_start / PAGING_PAGESZ; pgn < DIV_ROUND_UP(vma->vm_end, PAGING_PAGESZ); pgn++)
+        if (PAGING_PAGE_PRESENT(mm->pgd[pgn]) && !PAGING_PAGE_SWAPPED(mm->pgd[pgn]) &&
+            !PAGING_PAGE_HUGE(mm->pgd[pgn]))
+          compact_add_pte(&cc, &mm->pgd[pgn]);
+    }
+  }
+  shm_rmap(ctx, &cc);
+
+  moved = compact_run(&cc);
+  compact_free(&cc);
+  for (i = 0; i < ctx->mm_nr_procs; i++)
+    tlb_flush(ctx->mm_procs[i]->mm);
+#ifdef KSM
+  /* Scan nodes hold frame numbers */
+  ksm_reset(ctx);
+#endif
+
+  ctx->compact_runs++;
+  ctx->compact_moved += moved;
+  compact_frag_stat(mram, COMPACT_ORDER, after);
+  ctx->compact_floor = after->unusable_pct;
+
+  return moved;
+}
+
+/*compact_memory - compact MEMRAM on demand
+ *@ctx: simulation
+ *@mram: MEMRAM device
+ *@before: return fragmentation before the pass
+ *@after: return fragmentation after the pass
+ *
+ */
+int compact_memory(struct sim_ctx *ctx, struct memphy_struct *mram, struct frag_stat *before, struct frag_stat *after){
+  int moved;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+  moved = __compact_memory(ctx, mram, before, after);
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+
+  return moved;
+}
+
+#ifdef COMPACT_PROACTIVE
+/*compact_proactive - compact MEMRAM once it is fragmented enough
+ *@ctx: simulation
+ *@mram: MEMRAM device
+ *
+ * A pass runs when no free run of 2^COMPACT_ORDER frames is left, the
+ * fragmentation index says enough frames are free to build one and the
+ * unusable free space is worse than what the last pass left, so frames
+ * that cannot move do not trigger a pass every slot.
+ */
+int compact_proactive(struct sim_ctx *ctx, struct memphy_struct *mram){
+  struct frag_stat before, after;
+  int moved;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+
+  compact_frag_stat(mram, COMPACT_ORDER, &before);
+  if (before.unusable_pct < ctx->compact_floor)
+    ctx->compact_floor = before.unusable_pct;
+  if (before.frag_index < COMPACT_PROACTIVE || before.unusable_pct <= ctx->compact_floor){
+    pthread_mutex_unlock(&ctx->mmvm_lock);
+    return 0;
+  }
+
+  moved = __compact_memory(ctx, mram, &before, &after);
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+
+  trace_msg(TRACE_INFO, "\tkcompactd: moved %d frames, unusable index %d%% -> %d%%, largest free run %d -> %d\n",
+         moved, before.unusable_pct, after.unusable_pct, before.largest, after.largest);
+  return moved;
+}
+#endif
+
+/*compact_stat - compaction totals
+ *@ctx: simulation
+ *@runs: return compaction passes
+ *@moved: return frames migrated
+ *
+ */
+int compact_stat(struct sim_ctx *ctx, unsigned long *runs, unsigned long *moved){
+  pthread_mutex_lock(&ctx->mmvm_lock);
+  *runs = ctx->compact_runs;
+  *moved = ctx->compact_moved;
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
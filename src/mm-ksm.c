@@ -0,0 +1,246 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Same-page merging module mm/mm-ksm.c
+ */
+
+#include "mm.h"
+#include "sim.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifdef KSM
+
+/* A frame seen during the current scan pass, found again by content */
+struct ksm_node {
+  uint32_t hash;
+  int fpn;
+  struct mm_struct *mm; /* a mapping of the frame, rechecked before use */
+  int pgn;
+  int next;
+};
+
+/* The nodes of a pass live in the simulation context, callers serialize
+ * through the libmem lock */
+
+/*ksm_hash - FNV-1a hash of a frame
+ *@data: frame content
+ *
+ */
+static uint32_t ksm_hash(const BYTE *data){
+  uint32_t h = 2166136261u;
+  int i;
+
+  for (i = 0; i < PAGING_PAGESZ; i++){
+    h ^= (unsigned char)data[i];
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+/*ksm_reset - forget the frames of the current pass
+ *@ctx: simulation
+ *
+ * Called when a pass wraps around and whenever a process goes away, so
+ * no node outlives the mm it points to.
+ */
+int ksm_reset(struct sim_ctx *ctx){
+  int i;
+
+  for (i = 0; i < KSM_NBUCKETS; i++)
+    ctx->ksm_bucket[i] = -1;
+  ctx->ksm_nr_nodes = 0;
+
+  return 0;
+}
+
+/*ksm_insert - remember a frame for the rest of the pass
+ *@ctx: simulation
+ *@hash: content hash
+ *@mm: memory region mapping the frame
+ *@pgn: PGN of the mapping
+ *@fpn: frame
+ *
+ */
+static int ksm_insert(struct sim_ctx *ctx, uint32_t hash, struct mm_struct *mm, int pgn, int fpn){
+  struct ksm_node *node;
+
+  if (ctx->ksm_nr_nodes == ctx->ksm_cap){
+    int cap = ctx->ksm_cap ? ctx->ksm_cap * 2 : 64;
+    struct ksm_node *nodes = realloc(ctx->ksm_nodes, cap * sizeof(struct ksm_node));
+
+    if (nodes == NULL)
+      return -1;
+    if (ctx->ksm_cap == 0)
+      ksm_reset(ctx);
+    ctx->ksm_nodes = nodes;
+    ctx->ksm_cap = cap;
+  }
+
+  node = &ctx->ksm_nodes[ctx->ksm_nr_nodes];
+  node->hash = hash;
+  node->fpn = fpn;
+  node->mm = mm;
+  node->pgn = pgn;
+  node->next = ctx->ksm_bucket[hash % KSM_NBUCKETS];
+  ctx->ksm_bucket[hash % KSM_NBUCKETS] = ctx->ksm_nr_nodes++;
+
+  return 0;
+}
+
+/*ksm_merge_page - map a page onto an identical frame seen earlier
+ *@ctx: simulation
+ *@mram: MEMRAM device
+ *@mm: memory region
+ *@pgn: PGN of a resident private page
+ *
+ * Both mappings end up copy-on-write, so a later write gives the writer
+ * its own frame back. Return 1 if the page was merged, 2 if its frame
+ * was freed as well, 0 if it is the first of its content in this pass.
+ */
+int ksm_merge_page(struct sim_ctx *ctx, struct memphy_struct *mram, struct mm_struct *mm, int pgn){
+  int fpn = PAGING_FPN(mm->pgd[pgn]);
+  BYTE *data = mram->storage + fpn * PAGING_PAGESZ;
+  uint32_t hash = ksm_hash(data);
+  int idx, freed;
+
+  for (idx = ctx->ksm_bucket[hash % KSM_NBUCKETS]; ctx->ksm_cap > 0 && idx >= 0; idx = ctx->ksm_nodes[idx].next){
+    struct ksm_node *node = &ctx->ksm_nodes[idx];
+    uint32_t pte;
+
+    if (node->hash != hash)
+      continue;
+    if (node->fpn == fpn)
+      return 0;
+
+    /* The mapping may have moved since the frame was hashed */
+    pte = node->mm->pgd[node->pgn];
+    if (!PAGING_PAGE_PRESENT(pte) || PAGING_PAGE_SWAPPED(pte) || PAGING_FPN(pte) != node->fpn)
+      continue;
+    if (memcmp(data, mram->storage + node->fpn * PAGING_PAGESZ, PAGING_PAGESZ) != 0)
+      continue;
+
+    SETBIT(node->mm->pgd[node->pgn], PAGING_PTE_COW_MASK);
+    MEMPHY_get_fp(mram, node->fpn);
+
+    freed = (mram->fp_refcnt[fpn] == 1);
+    pte_set_fpn(&mm->pgd[pgn], node->fpn);
+    SETBIT(mm->pgd[pgn], PAGING_PTE_COW_MASK);
+    MEMPHY_put_freefp(mram, fpn);
+    tlb_flush(node->mm);
+    tlb_flush(mm);
+
+    return freed ? 2 : 1;
+  }
+
+  ksm_insert(ctx, hash, mm, pgn, fpn);
+  return 0;
+}
+
+/*ksm_cleanup - free the scan state at system shutdown
+ *@ctx: simulation
+ *
+ */
+int ksm_cleanup(struct sim_ctx *ctx){
+  free(ctx->ksm_nodes);
+  ctx->ksm_nodes = NULL;
+  ctx->ksm_nr_nodes = ctx->ksm_cap = 0;
+
+  return 0;
+}
+
+/*ksm_scan - merge identical MEMRAM frames, a slice of the pass per call
+ *@ctx: simulation
+ *@mram: MEMRAM device
+ *@nr_pages: resident pages to look at
+ *
+ * The vm areas of the registered processes are walked in turn from
+ * where the last call stopped. Frames of shared memory segments are skipped,
+ * a write to them must stay visible to every attached process.
+ */
+int ksm_scan(struct sim_ctx *ctx, struct memphy_struct *mram, int nr_pages){
+  struct timespec t0, t1;
+  int scanned = 0, merged = 0, wrapped = 0;
+
+  pthread_mutex_lock(&ctx->mmvm_lock);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  while (scanned < nr_pages && ctx->mm_nr_procs > 0){
+    struct pcb_t *proc;
+    unsigned long addr;
+    uint32_t pte;
+    int pgn, fpn, ret;
+
+    if (ctx->ksm_next_proc >= ctx->mm_nr_procs){
+      /* Pass done, the next one starts with an empty table */
+      ctx->ksm_next_proc = ctx->ksm_next_pgn = 0;
+      ksm_reset(ctx);
+      if (wrapped++)
+        break;
+    }
+
+    /* Only pages inside a vm area can be resident, skip the holes */
+    proc = ctx->mm_procs[ctx->ksm_next_proc];
+    addr = vm_next_mapped(proc->mm, (unsigned long)ctx->ksm_next_pgn * PAGING_PAGESZ);
+    if (addr >= PAGING_VMA_TOP || proc->mram != mram){
+      ctx->ksm_next_proc++;
+      ctx->ksm_next_pgn = 0;
+      continue;
+    }
+
+    pgn = addr / PAGING_PAGESZ;
+    ctx->ksm_next_pgn = pgn + 1;
+    pte = proc->mm->pgd[pgn];
+    if (!PAGING_PAGE_PRESENT(pte) || PAGING_PAGE_SWAPPED(pte))
+      continue;
+
+    fpn = PAGING_FPN(pte);
+    if ((mram->fp_refcnt[fpn] > 1 && !PAGING_PAGE_COW(pte)) || PAGING_PAGE_HUGE(pte))
+      continue;
+
+    scanned++;
+    ret = ksm_merge_page(ctx, mram, proc->mm, pgn);
+    if (ret > 0){
+      merged++;
+      ctx->cow_shared++;
+      if (ret == 2)
+        ctx->ksm_freed++;
+    }
+  }
+
+  ctx->ksm_merged += merged;
+  ctx->ksm_scanned += scanned;
+  ctx->ksm_slots++;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ctx->ksm_ns += (t1.tv_sec - t0.tv_sec) * 1000000000L + (t1.tv_nsec - t0.tv_nsec);
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+
+  return merged;
+}
+
+/*ksm_stat - same-page merging totals
+ *@ctx: simulation
+ *@merged: return pages mapped onto an identical frame
+ *@freed: return frames released by merging
+ *@scanned: return pages looked at
+ *@slots: return slots the scanner ran
+ *@ns: return time spent scanning
+ *
+ */
+int ksm_stat(struct sim_ctx *ctx, unsigned long *merged, unsigned long *freed, unsigned long *scanned,
+             unsigned long *slots, unsigned long *ns){
+  pthread_mutex_lock(&ctx->mmvm_lock);
+  *merged = ctx->ksm_merged;
+  *freed = ctx->ksm_freed;
+  *scanned = ctx->ksm_scanned;
+  *slots = ctx->ksm_slots;
+  *ns = ctx->ksm_ns;
+  pthread_mutex_unlock(&ctx->mmvm_lock);
+  return 0;
+}
+
+#endif
@@ -5,28 +5,86 @@
  */
 
 #include "mm.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 /*
  *  MEMPHY_mv_csr - move MEMPHY cursor
  *  @mp: memphy struct
  *  @offset: offset
+ *
+ *  The head jumps straight to @offset, the distance it travelled is
+ *  accumulated in seekdist for the cost accounting of serial devices.
  */
 int MEMPHY_mv_csr(struct memphy_struct *mp, int offset)
 {
-   int numstep = 0;
+   if (offset < 0 || offset >= mp->maxsz)
+      offset = 0;
 
-   mp->cursor = 0;
-   while (numstep < offset && numstep < mp->maxsz)
+   mp->seekdist += (offset > mp->cursor) ? offset - mp->cursor : mp->cursor - offset;
+   mp->seekcnt++;
+   mp->cursor = offset;
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_in_range - check [addr, addr + len) lies in the device
+ */
+static int MEMPHY_in_range(struct memphy_struct *mp, int addr, int len)
+{
+   return (mp != NULL && mp->storage != NULL && addr >= 0 && len >= 0 &&
+           addr <= mp->maxsz - len);
+}
+
+/*
+ *  MEMPHY_track - account the bytes of a range in the frame counters
+ *  @mp: memphy struct
+ *  @addr: start address
+ *  @len: number of bytes
+ *  @sign: -1 before the range is overwritten, 1 after
+ */
+static void MEMPHY_track(struct memphy_struct *mp, int addr, int len, int sign)
+{
+   int end = addr + len;
+
+   if (mp->fp_nzcnt == NULL)
+      return;
+
+   while (addr < end)
    {
-      /* Traverse sequentially */
-      mp->cursor = (mp->cursor + 1) % mp->maxsz;
-      numstep++;
+      int fpn = addr / PAGING_PAGESZ;
+      int fend = (fpn + 1) * PAGING_PAGESZ;
+      int nz = 0;
+
+      if (fend > end)
+         fend = end;
+      for (; addr < fend; addr++)
+         nz += (mp->storage[addr] != 0);
+
+      mp->fp_nzcnt[fpn] += sign * nz;
+      mp->fp_dirty[fpn / 64] |= (uint64_t)1 << (fpn % 64);
    }
+}
 
-   return 0;
+/*
+ *  MEMPHY_store - write a byte, keeping the frame counters up to date
+ */
+static void MEMPHY_store(struct memphy_struct *mp, int addr, BYTE value)
+{
+   if (mp->fp_nzcnt != NULL && mp->storage[addr] != value)
+   {
+      int fpn = addr / PAGING_PAGESZ;
+
+      mp->fp_nzcnt[fpn] += (value != 0) - (mp->storage[addr] != 0);
+      mp->fp_dirty[fpn / 64] |= (uint64_t)1 << (fpn % 64);
+   }
+   mp->storage[addr] = value;
 }
 
 /*
@@ -40,7 +98,7 @@ int MEMPHY_seq_read(struct memphy_struct *mp, int addr, BYTE *value)
    if (mp == NULL)
       return -1;
 
-   if (!mp->rdmflg)
+   if (mp->rdmflg)
       return -1; /* Not compatible mode for sequential read */
 
    MEMPHY_mv_csr(mp, addr);
@@ -57,7 +115,7 @@ int MEMPHY_seq_read(struct memphy_struct *mp, int addr, BYTE *value)
  */
 int MEMPHY_read(struct memphy_struct *mp, int addr, BYTE *value)
 {
-   if (mp == NULL)
+   if (!MEMPHY_in_range(mp, addr, 1))
       return -1;
 
    if (mp->rdmflg)
@@ -80,11 +138,11 @@ int MEMPHY_seq_write(struct memphy_struct *mp, int addr, BYTE value)
    if (mp == NULL)
       return -1;
 
-   if (!mp->rdmflg)
-      return -1; /* Not compatible mode for sequential read */
+   if (mp->rdmflg)
+      return -1; /* Not compatible mode for sequential write */
 
    MEMPHY_mv_csr(mp, addr);
-   mp->storage[addr] = value;
+   MEMPHY_store(mp, addr, value);
 
    return 0;
 }
@@ -97,45 +155,142 @@ int MEMPHY_seq_write(struct memphy_struct *mp, int addr, BYTE value)
  */
 int MEMPHY_write(struct memphy_struct *mp, int addr, BYTE data)
 {
-   if (mp == NULL)
+   if (!MEMPHY_in_range(mp, addr, 1))
       return -1;
 
    if (mp->rdmflg)
-      mp->storage[addr] = data;
+      MEMPHY_store(mp, addr, data);
    else /* Sequential access device */
       return MEMPHY_seq_write(mp, addr, data);
 
    return 0;
 }
 
+/*
+ *  MEMPHY_read_range - read a byte range of MEMPHY device
+ *  @mp: memphy struct
+ *  @addr: start address
+ *  @buf: obtained bytes
+ *  @len: number of bytes
+ *
+ *  A serial device seeks once and streams the range, leaving the
+ *  cursor right after it.
+ */
+int MEMPHY_read_range(struct memphy_struct *mp, int addr, BYTE *buf, int len)
+{
+   if (!MEMPHY_in_range(mp, addr, len))
+      return -1;
+
+   if (!mp->rdmflg)
+      MEMPHY_mv_csr(mp, addr);
+
+   memcpy(buf, mp->storage + addr, len);
+
+   if (!mp->rdmflg)
+      mp->cursor = (addr + len) % mp->maxsz;
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_write_range - write a byte range of MEMPHY device
+ *  @mp: memphy struct
+ *  @addr: start address
+ *  @buf: written bytes, NULL fills the range with zero
+ *  @len: number of bytes
+ */
+int MEMPHY_write_range(struct memphy_struct *mp, int addr, const BYTE *buf, int len)
+{
+   if (!MEMPHY_in_range(mp, addr, len))
+      return -1;
+
+   if (!mp->rdmflg)
+      MEMPHY_mv_csr(mp, addr);
+
+   MEMPHY_track(mp, addr, len, -1);
+   if (buf != NULL)
+      memcpy(mp->storage + addr, buf, len);
+   else
+      memset(mp->storage + addr, 0, len);
+   MEMPHY_track(mp, addr, len, 1);
+
+   if (!mp->rdmflg)
+      mp->cursor = (addr + len) % mp->maxsz;
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_copy_frame - copy a whole frame between MEMPHY devices
+ *  @mpsrc: source memphy
+ *  @srcfpn: source frame
+ *  @mpdst: destination memphy
+ *  @dstfpn: destination frame
+ */
+int MEMPHY_copy_frame(struct memphy_struct *mpsrc, int srcfpn,
+                      struct memphy_struct *mpdst, int dstfpn)
+{
+   int srcaddr = srcfpn * PAGING_PAGESZ;
+   int dstaddr = dstfpn * PAGING_PAGESZ;
+
+   if (!MEMPHY_in_range(mpsrc, srcaddr, PAGING_PAGESZ) ||
+       !MEMPHY_in_range(mpdst, dstaddr, PAGING_PAGESZ))
+      return -1;
+
+   if (mpsrc->rdmflg && mpdst->rdmflg)
+   {
+      MEMPHY_track(mpdst, dstaddr, PAGING_PAGESZ, -1);
+      memmove(mpdst->storage + dstaddr, mpsrc->storage + srcaddr, PAGING_PAGESZ);
+      MEMPHY_track(mpdst, dstaddr, PAGING_PAGESZ, 1);
+      return 0;
+   }
+
+   /* Go through the range calls so serial devices account their seeks */
+   BYTE page[PAGING_PAGESZ];
+   MEMPHY_read_range(mpsrc, srcaddr, page, PAGING_PAGESZ);
+   return MEMPHY_write_range(mpdst, dstaddr, page, PAGING_PAGESZ);
+}
+
 /*
  *  MEMPHY_format-format MEMPHY device
  *  @mp: memphy struct
+ *
+ *  Frames are not listed up front, every frame at or above fp_hiwm is
+ *  free and handed out in order by MEMPHY_get_freefp.
  */
 int MEMPHY_format(struct memphy_struct *mp, int pagesz)
 {
    /* This setting come with fixed constant PAGESZ */
    int numfp = mp->maxsz / pagesz;
-   struct framephy_struct *newfst, *fst;
-   int iter = 0;
+   int nrtrack = DIV_ROUND_UP(mp->maxsz, PAGING_PAGESZ);
+
+   mp->free_fp_list = NULL;
+   mp->used_fp_list = NULL;
+   mp->fp_hiwm = 0;
+   mp->fp_refcnt = NULL;
+   mp->free_fp_cnt = (numfp > 0) ? numfp : 0;
+   mp->fp_nzcnt = NULL;
+   mp->fp_dirty = NULL;
+   mp->dump_shadow = NULL;
+
+   if (nrtrack > 0)
+   {
+      /* The storage is all zero and nothing is dirty yet */
+      mp->fp_nzcnt = calloc(nrtrack, sizeof(*mp->fp_nzcnt));
+      mp->fp_dirty = calloc(DIV_ROUND_UP(nrtrack, 64), sizeof(*mp->fp_dirty));
+      if (mp->fp_nzcnt == NULL || mp->fp_dirty == NULL)
+      {
+         free(mp->fp_nzcnt);
+         free(mp->fp_dirty);
+         mp->fp_nzcnt = NULL;
+         mp->fp_dirty = NULL;
+      }
+   }
 
    if (numfp <= 0)
       return -1;
 
-   /* Init head of free framephy list */
-   fst = malloc(sizeof(struct framephy_struct));
-   fst->fpn = iter;
-   mp->free_fp_list = fst;
-
-   /* We have list with first element, fill in the rest num-1 element member*/
-   for (iter = 1; iter < numfp; iter++)
-   {
-      newfst = malloc(sizeof(struct framephy_struct));
-      newfst->fpn = iter;
-      newfst->fp_next = NULL;
-      fst->fp_next = newfst;
-      fst = newfst;
-   }
+   mp->fp_refcnt = calloc(numfp, sizeof(*mp->fp_refcnt));
 
    return 0;
 }
@@ -145,10 +300,21 @@ int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
    struct framephy_struct *fp = mp->free_fp_list;
 
    if (fp == NULL)
-      return -1;
+   {
+      /* Take the next never used frame */
+      if (mp->fp_hiwm >= mp->maxsz / PAGING_PAGESZ)
+         return -1;
+
+      *retfpn = mp->fp_hiwm++;
+      mp->fp_refcnt[*retfpn] = 1;
+      mp->free_fp_cnt--;
+      return 0;
+   }
 
    *retfpn = fp->fpn;
    mp->free_fp_list = fp->fp_next;
+   mp->fp_refcnt[*retfpn] = 1;
+   mp->free_fp_cnt--;
 
    /* MEMPHY is iteratively used up until its exhausted
     * No garbage collector acting then it not been released
@@ -161,36 +327,174 @@ int MEMPHY_get_freefp(struct memphy_struct *mp, int *retfpn)
 
 
 
-  /*TODO dump memphy contnt mp->storage
-   *     for tracing the memory content
-   */
+/*
+ *  MEMPHY_cell_add - append a tuple of @n ints to a dump record
+ */
+static int MEMPHY_cell_add(int32_t **cell, int *nr, int *cap, int n, const int32_t *val)
+{
+   if (*nr == *cap)
+   {
+      int32_t *grown;
+
+      *cap = *cap ? *cap * 2 : 64;
+      grown = realloc(*cell, *cap * n * sizeof(int32_t));
+      if (grown == NULL)
+         return -1;
+      *cell = grown;
+   }
+   memcpy(*cell + *nr * n, val, n * sizeof(int32_t));
+   (*nr)++;
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_dump_diff - trace the bytes changed since the last diff dump
+ *  @mp: memphy struct
+ *
+ *  Only frames written in between are compared against the copy kept
+ *  from the last diff dump. Each change is an address, old and new
+ *  value triple.
+ */
+static int MEMPHY_dump_diff(struct memphy_struct *mp)
+{
+   static const int64_t noargs[TRACE_NARGS];
+   int nrtrack = DIV_ROUND_UP(mp->maxsz, PAGING_PAGESZ);
+   int32_t *cell = NULL;
+   int nr = 0, cap = 0, w;
+
+   if (mp->dump_shadow == NULL)
+   {
+      /* Storage starts out zero, so does the copy */
+      mp->dump_shadow = calloc(mp->maxsz, sizeof(BYTE));
+      if (mp->dump_shadow == NULL)
+         return -1;
+   }
+
+   for (w = 0; w < DIV_ROUND_UP(nrtrack, 64); w++)
+   {
+      while (mp->fp_dirty[w] != 0)
+      {
+         int fpn = w * 64 + __builtin_ctzll(mp->fp_dirty[w]);
+         int addr = fpn * PAGING_PAGESZ;
+         int end = (addr + PAGING_PAGESZ < mp->maxsz) ? addr + PAGING_PAGESZ : mp->maxsz;
+
+         mp->fp_dirty[w] &= mp->fp_dirty[w] - 1;
+         for (; addr < end; addr++)
+         {
+            int32_t val[3] = { addr, mp->dump_shadow[addr], mp->storage[addr] };
+
+            if (val[1] == val[2])
+               continue;
+            if (MEMPHY_cell_add(&cell, &nr, &cap, 3, val) < 0)
+            {
+               free(cell);
+               return -1;
+            }
+            mp->dump_shadow[addr] = mp->storage[addr];
+         }
+      }
+   }
+
+   trace_emit(TR_MEMDIFF, TRACE_MEMDUMP, noargs, cell, nr * 3 * sizeof(int32_t));
+   free(cell);
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_dump - trace the non-zero bytes of the device
+ *  @mp: memphy struct
+ *
+ *  Each byte goes into the record as an address and value pair. Frames
+ *  without a non-zero byte are skipped. With TRACE_F_MEMDIFF only the
+ *  changes since the previous dump are recorded.
+ */
 int MEMPHY_dump(struct memphy_struct *mp) {
-    int has_content = 0;
-
-    printf("===== PHYSICAL MEMORY DUMP =====\n");
-    
-    for (int i = 0; i < mp->maxsz; i++) {
-        if (mp->storage[i] != 0) {
-            printf("BYTE %08x: %d\n", i, mp->storage[i]);
-            has_content = 1;
+    static const int64_t noargs[TRACE_NARGS];
+    int nrtrack = DIV_ROUND_UP(mp->maxsz, PAGING_PAGESZ);
+    int32_t *cell = NULL;
+    int nr = 0, cap = 0;
+
+    if (!trace_on(TRACE_MEMDUMP))
+       return 0;
+    if (mp->fp_nzcnt != NULL && (trace_flags & TRACE_F_MEMDIFF))
+       return MEMPHY_dump_diff(mp);
+
+    for (int fpn = 0; fpn < nrtrack; fpn++) {
+        int addr = fpn * PAGING_PAGESZ;
+        int end = (addr + PAGING_PAGESZ < mp->maxsz) ? addr + PAGING_PAGESZ : mp->maxsz;
+
+        if (mp->fp_nzcnt != NULL && mp->fp_nzcnt[fpn] == 0)
+           continue;
+        for (; addr < end; addr++) {
+            int32_t val[2] = { addr, mp->storage[addr] };
+
+            if (val[1] == 0)
+               continue;
+            if (MEMPHY_cell_add(&cell, &nr, &cap, 2, val) < 0) {
+               free(cell);
+               return -1;
+            }
         }
     }
-    
-    if (!has_content) {
-        printf("Empty physical memory\n");
-    }
-    
-    printf("===== PHYSICAL MEMORY END-DUMP =====\n");
-    printf("================================================================\n");
-    
+
+    trace_emit(TR_MEMDUMP, TRACE_MEMDUMP, noargs, cell, nr * 2 * sizeof(int32_t));
+    free(cell);
+
     return 0;
 }
 
 
+/*
+ *  MEMPHY_nr_freefp - number of free frames
+ *  @mp: memphy struct
+ */
+int MEMPHY_nr_freefp(struct memphy_struct *mp)
+{
+   return mp->free_fp_cnt;
+}
+
+/*
+ *  MEMPHY_get_fp - take one more reference on a frame in use
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ */
+int MEMPHY_get_fp(struct memphy_struct *mp, int fpn)
+{
+   if (fpn < 0 || fpn >= mp->fp_hiwm || mp->fp_refcnt[fpn] == 0)
+      return -1;
+
+   mp->fp_refcnt[fpn]++;
+   return 0;
+}
+
+/*
+ *  MEMPHY_put_freefp - drop a reference on a frame
+ *  @mp: memphy struct
+ *  @fpn: frame number
+ *
+ *  The frame goes back to the free list with its last reference, a
+ *  frame not in use is refused.
+ */
 int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
 {
    struct framephy_struct *fp = mp->free_fp_list;
-   struct framephy_struct *newnode = malloc(sizeof(struct framephy_struct));
+   struct framephy_struct *newnode;
+
+   /* Never handed out or already free, listing it again would give
+    * the frame to two owners */
+   if (fpn < 0 || fpn >= mp->fp_hiwm || mp->fp_refcnt[fpn] == 0)
+   {
+      trace_msg(TRACE_INFO, "MEMPHY_put_freefp: frame %d is not in use\n", fpn);
+      return -1;
+   }
+
+   if (--mp->fp_refcnt[fpn] > 0)
+      return 0;
+   mp->free_fp_cnt++;
+
+   newnode = malloc(sizeof(struct framephy_struct));
 
    /* Create new node with value fpn */
    newnode->fpn = fpn;
@@ -200,21 +504,262 @@ int MEMPHY_put_freefp(struct memphy_struct *mp, int fpn)
    return 0;
 }
 
+/*
+ *  MEMPHY_get_freerun - take an aligned run of free frames
+ *  @mp: memphy struct
+ *  @order: the run is 2^order frames, aligned to its size
+ *  @retfpn: first frame of the run
+ *
+ *  Every frame of the run gets a reference of its own, so the run can be
+ *  released frame by frame with MEMPHY_put_freefp.
+ */
+int MEMPHY_get_freerun(struct memphy_struct *mp, int order, int *retfpn)
+{
+   struct framephy_struct **fpit, *fp;
+   int nrfp = mp->maxsz / PAGING_PAGESZ;
+   int n = 1 << order;
+   int start, fpn;
+
+   for (start = 0; start + n <= nrfp; start += n)
+   {
+      for (fpn = start; fpn < start + n; fpn++)
+         if (fpn < mp->fp_hiwm && mp->fp_refcnt[fpn] != 0)
+            break;
+      if (fpn == start + n)
+         break;
+   }
+   if (start + n > nrfp)
+      return -1;
+
+   /* Unlist the frames below the high water mark */
+   for (fpit = &mp->free_fp_list; *fpit != NULL;)
+   {
+      fp = *fpit;
+      if (fp->fpn >= start && fp->fpn < start + n)
+      {
+         *fpit = fp->fp_next;
+         free(fp);
+      }
+      else
+         fpit = &fp->fp_next;
+   }
+
+   /* Never used frames skipped over below the run become listed ones */
+   for (fpn = mp->fp_hiwm; fpn < start; fpn++)
+   {
+      fp = malloc(sizeof(struct framephy_struct));
+      fp->fpn = fpn;
+      fp->fp_next = mp->free_fp_list;
+      mp->free_fp_list = fp;
+   }
+   if (mp->fp_hiwm < start + n)
+      mp->fp_hiwm = start + n;
+
+   for (fpn = start; fpn < start + n; fpn++)
+      mp->fp_refcnt[fpn] = 1;
+   mp->free_fp_cnt -= n;
+
+   *retfpn = start;
+   return 0;
+}
+
+/*
+ *  MEMPHY_rebuild_freelist - relist the free frames in ascending order
+ *  @mp: memphy struct
+ *
+ *  The high water mark drops to just above the last frame in use, the
+ *  frames freed above it rejoin the never used range.
+ */
+int MEMPHY_rebuild_freelist(struct memphy_struct *mp)
+{
+   struct framephy_struct *fp, *next;
+   int fpn, hiwm = mp->fp_hiwm;
+
+   for (fp = mp->free_fp_list; fp != NULL; fp = next)
+   {
+      next = fp->fp_next;
+      free(fp);
+   }
+   mp->free_fp_list = NULL;
+
+   while (hiwm > 0 && mp->fp_refcnt[hiwm - 1] == 0)
+      hiwm--;
+   mp->fp_hiwm = hiwm;
+   mp->free_fp_cnt = mp->maxsz / PAGING_PAGESZ - hiwm;
+
+   for (fpn = hiwm - 1; fpn >= 0; fpn--)
+   {
+      if (mp->fp_refcnt[fpn] != 0)
+         continue;
+      fp = malloc(sizeof(struct framephy_struct));
+      fp->fpn = fpn;
+      fp->fp_next = mp->free_fp_list;
+      mp->free_fp_list = fp;
+      mp->free_fp_cnt++;
+   }
+
+   return 0;
+}
+
+/*
+ *  MEMPHY_alloc_storage - get the backing store of a MEMPHY device
+ *  @mp: memphy struct with maxsz, backend and fd set
+ */
+static int MEMPHY_alloc_storage(struct memphy_struct *mp)
+{
+   mp->storage = NULL;
+   if (mp->maxsz <= 0)
+      return 0;
+
+   switch (mp->backend)
+   {
+   case MEMPHY_BACKEND_ANON:
+      /* Zero pages are faulted in by the host only when touched */
+      mp->storage = mmap(NULL, mp->maxsz, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      break;
+   case MEMPHY_BACKEND_FILE:
+      /* Sparse file, blocks are allocated on first write */
+      if (ftruncate(mp->fd, mp->maxsz) < 0)
+         return -1;
+      mp->storage = mmap(NULL, mp->maxsz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, mp->fd, 0);
+      break;
+   default:
+      mp->storage = (BYTE *)malloc(mp->maxsz * sizeof(BYTE));
+      if (mp->storage != NULL)
+         memset(mp->storage, 0, mp->maxsz * sizeof(BYTE));
+      return (mp->storage == NULL) ? -1 : 0;
+   }
+
+   if (mp->storage == MAP_FAILED)
+   {
+      mp->storage = NULL;
+      return -1;
+   }
+
+   return 0;
+}
+
 /*
  *  Init MEMPHY struct
  */
 int init_memphy(struct memphy_struct *mp, int max_size, int randomflg)
 {
-   mp->storage = (BYTE *)malloc(max_size * sizeof(BYTE));
    mp->maxsz = max_size;
-   memset(mp->storage, 0, max_size * sizeof(BYTE));
+#ifdef MEMPHY_MMAP
+   mp->backend = MEMPHY_BACKEND_ANON;
+#else
+   mp->backend = MEMPHY_BACKEND_HEAP;
+#endif
+   mp->fd = -1;
+   mp->path = NULL;
+
+   if (MEMPHY_alloc_storage(mp) < 0)
+   {
+      trace_msg(TRACE_INFO, "init_memphy: cannot allocate %d bytes\n", max_size);
+      return -1;
+   }
+
+   MEMPHY_format(mp, PAGING_PAGESZ);
+
+   mp->rdmflg = (randomflg != 0) ? 1 : 0;
+
+   mp->cursor = 0; /* Only meaningful for a serial device */
+   mp->seekdist = 0;
+   mp->seekcnt = 0;
+
+   return 0;
+}
+
+/*
+ *  Init MEMPHY struct backed by a swap file
+ *  @path: swap file, created or truncated to max_size
+ */
+int init_memphy_file(struct memphy_struct *mp, int max_size, int randomflg, const char *path)
+{
+   if (max_size <= 0)
+      return init_memphy(mp, max_size, randomflg);
+
+   mp->maxsz = max_size;
+   mp->backend = MEMPHY_BACKEND_FILE;
+   mp->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+   if (mp->fd < 0)
+   {
+      trace_msg(TRACE_INFO, "init_memphy_file: cannot open swap file %s\n", path);
+      return -1;
+   }
+   mp->path = strdup(path);
+
+   if (MEMPHY_alloc_storage(mp) < 0)
+   {
+      trace_msg(TRACE_INFO, "init_memphy_file: cannot map swap file %s\n", path);
+      close(mp->fd);
+      unlink(mp->path);
+      free(mp->path);
+      mp->fd = -1;
+      mp->path = NULL;
+      return -1;
+   }
 
    MEMPHY_format(mp, PAGING_PAGESZ);
 
    mp->rdmflg = (randomflg != 0) ? 1 : 0;
 
-   if (!mp->rdmflg) /* Not Ramdom acess device, then it serial device*/
-      mp->cursor = 0;
+   mp->cursor = 0; /* Only meaningful for a serial device */
+   mp->seekdist = 0;
+   mp->seekcnt = 0;
+
+   return 0;
+}
+
+/*
+ *  free_memphy - release storage and frame lists of a MEMPHY device
+ */
+int free_memphy(struct memphy_struct *mp)
+{
+   struct framephy_struct *fp, *fp_next;
+
+   if (mp->storage != NULL)
+   {
+      if (mp->backend == MEMPHY_BACKEND_HEAP)
+         free(mp->storage);
+      else
+         munmap(mp->storage, mp->maxsz);
+   }
+   mp->storage = NULL;
+
+   if (mp->fd >= 0)
+   {
+      close(mp->fd);
+      unlink(mp->path);
+      mp->fd = -1;
+   }
+   free(mp->path);
+   mp->path = NULL;
+
+   for (fp = mp->free_fp_list; fp != NULL; fp = fp_next)
+   {
+      fp_next = fp->fp_next;
+      free(fp);
+   }
+   mp->free_fp_list = NULL;
+
+   for (fp = mp->used_fp_list; fp != NULL; fp = fp_next)
+   {
+      fp_next = fp->fp_next;
+      free(fp);
+   }
+   mp->used_fp_list = NULL;
+
+   free(mp->fp_refcnt);
+   mp->fp_refcnt = NULL;
+   free(mp->fp_nzcnt);
+   free(mp->fp_dirty);
+   free(mp->dump_shadow);
+   mp->fp_nzcnt = NULL;
+   mp->fp_dirty = NULL;
+   mp->dump_shadow = NULL;
 
    return 0;
 }
@@ -0,0 +1,193 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Shared memory module mm/mm-shm.c
+ */
+
+#include "mm.h"
+#include "sim.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Segments live in ctx->shm_list, callers serialize through the libmem lock */
+
+/*shm_lookup - find a shared memory segment by key
+ *@ctx: simulation
+ *@key: segment key
+ *
+ */
+struct shm_segment *shm_lookup(struct sim_ctx *ctx, int key){
+  struct shm_segment *seg;
+
+  for (seg = ctx->shm_list; seg != NULL; seg = seg->next)
+    if (seg->key == key)
+      return seg;
+
+  return NULL;
+}
+
+/*shm_create - create a shared memory segment
+ *@ctx: simulation
+ *@key: segment key
+ *@size: segment size
+ *
+ * An existing segment of the same key is reused if it is large enough.
+ */
+struct shm_segment *shm_create(struct sim_ctx *ctx, int key, int size){
+  struct shm_segment *seg = shm_lookup(ctx, key);
+  int i;
+
+  if (seg != NULL)
+    return (size <= seg->size) ? seg : NULL;
+
+  if (size <= 0)
+    return NULL;
+
+  seg = malloc(sizeof(struct shm_segment));
+  seg->key = key;
+  seg->size = size;
+  seg->npages = DIV_ROUND_UP(size, PAGING_PAGESZ);
+  seg->fpn = malloc(seg->npages * sizeof(int));
+  for (i = 0; i < seg->npages; i++) seg->fpn[i] = -1;
+  seg->nattch = 0;
+  seg->mram = NULL;
+
+  seg->next = ctx->shm_list;
+  ctx->shm_list = seg;
+
+  return seg;
+}
+
+/*shm_destroy - release a segment and the frames it still holds
+ *@ctx: simulation
+ *@seg: segment
+ *
+ */
+static void shm_destroy(struct sim_ctx *ctx, struct shm_segment *seg){
+  struct shm_segment **pseg;
+  int i;
+
+  for (pseg = &ctx->shm_list; *pseg != NULL; pseg = &(*pseg)->next){
+    if (*pseg == seg){
+      *pseg = seg->next;
+      break;
+    }
+  }
+
+  for (i = 0; i < seg->npages; i++)
+    if (seg->fpn[i] >= 0)
+      MEMPHY_put_freefp(seg->mram, seg->fpn[i]);
+
+  free(seg->fpn);
+  free(seg);
+}
+
+/*shm_attach - map a segment into a new vm area
+ *@ctx: simulation
+ *@mm: memory region
+ *@key: segment key
+ *
+ */
+struct vm_area_struct *shm_attach(struct sim_ctx *ctx, struct mm_struct *mm, int key){
+  struct shm_segment *seg = shm_lookup(ctx, key);
+  struct vm_area_struct *vma;
+
+  if (seg == NULL)
+    return NULL;
+
+  vma = vm_map_area(mm, seg->npages * PAGING_PAGESZ);
+  if (vma == NULL)
+    return NULL;
+
+  vma->vm_flags |= VM_SHARED;
+  vma->vm_shm = seg;
+  seg->nattch++;
+
+  return vma;
+}
+
+/*shm_detach - drop the segment reference of a shared area
+ *@ctx: simulation
+ *@vma: shared vm area, its pages are already unmapped
+ *
+ */
+int shm_detach(struct sim_ctx *ctx, struct vm_area_struct *vma){
+  struct shm_segment *seg = vma->vm_shm;
+
+  if (seg == NULL)
+    return -1;
+
+  vma->vm_shm = NULL;
+  if (--seg->nattch == 0)
+    shm_destroy(ctx, seg);
+
+  return 0;
+}
+
+/*shm_getpage - map the frame of a shared page, faulting it in if needed
+ *@caller: caller
+ *@vma: shared vm area
+ *@pgn: PGN
+ *@fpn: return FPN
+ *
+ * The segment keeps one reference on each frame, every mapping adds
+ * another. Shared frames are never on a FIFO list, so they are not
+ * picked for swap out.
+ */
+int shm_getpage(struct pcb_t *caller, struct vm_area_struct *vma, int pgn, int *fpn){
+  struct shm_segment *seg = vma->vm_shm;
+  int idx = pgn - PAGING_PGN(vma->vm_start);
+
+  if (seg == NULL || idx < 0 || idx >= seg->npages)
+    return -1;
+
+  if (seg->fpn[idx] < 0){
+    if (pg_getfreefp(caller->mm, &seg->fpn[idx], caller) < 0){
+      seg->fpn[idx] = -1;
+      return -1;
+    }
+    MEMPHY_write_range(caller->mram, seg->fpn[idx] * PAGING_PAGESZ, NULL, PAGING_PAGESZ);
+    seg->mram = caller->mram;
+  }
+
+  MEMPHY_get_fp(caller->mram, seg->fpn[idx]);
+  pte_set_fpn(&caller->mm->pgd[pgn], seg->fpn[idx]);
+
+  *fpn = seg->fpn[idx];
+  return 0;
+}
+
+/*shm_rmap - add the frame slots of every segment to a reverse map
+ *@ctx: simulation
+ *@cc: compaction control
+ *
+ * A segment holds its own reference on each frame besides those of the
+ * attached page tables.
+ */
+int shm_rmap(struct sim_ctx *ctx, struct compact_control *cc){
+  struct shm_segment *seg;
+  int i;
+
+  for (seg = ctx->shm_list; seg != NULL; seg = seg->next){
+    if (seg->mram != cc->mram)
+      continue;
+    for (i = 0; i < seg->npages; i++)
+      if (seg->fpn[i] >= 0)
+        compact_add_slot(cc, &seg->fpn[i]);
+  }
+
+  return 0;
+}
+
+/*shm_cleanup - release every remaining segment
+ *@ctx: simulation
+ *
+ */
+int shm_cleanup(struct sim_ctx *ctx){
+  while (ctx->shm_list != NULL)
+    shm_destroy(ctx, ctx->shm_list);
+
+  return 0;
+}
+
+// #endif
@@ -13,24 +13,228 @@
 
 
 
+/*vma_addr_upper - number of vm areas ordered before a virtual address
+ *@mm: memory region
+ *@addr: virtual address
+ *
+ * vma_addr is sorted by (vm_start, vm_end), the result is the index of the
+ * first area starting above addr.
+ */
+static int vma_addr_upper(struct mm_struct *mm, unsigned long addr){
+  int lo = 0, hi = mm->vma_cnt;
+
+  while (lo < hi){
+    int mid = (lo + hi) / 2;
+    if (mm->vma_addr[mid]->vm_start <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+/*vma_id_index - index of a vm area ID in vma_id, or where it would go
+ *@mm: memory region
+ *@vmaid: ID vm area
+ *
+ */
+static int vma_id_index(struct mm_struct *mm, unsigned long vmaid){
+  int lo = 0, hi = mm->vma_cnt;
+
+  while (lo < hi){
+    int mid = (lo + hi) / 2;
+    if (mm->vma_id[mid]->vm_id < vmaid)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+
+
+
 /*get_vma_by_num - get vm area by numID
  *@mm: memory region
  *@vmaid: ID vm area to alloc memory region
  *
  */
 struct vm_area_struct *get_vma_by_num(struct mm_struct *mm, int vmaid){
-struct vm_area_struct *pvma = mm->mmap;
-if (mm->mmap == NULL)return NULL;
+  int idx;
+
+  if (vmaid < 0) return NULL;
+
+  idx = vma_id_index(mm, vmaid);
+  if (idx < mm->vma_cnt && mm->vma_id[idx]->vm_id == (unsigned long)vmaid)
+    return mm->vma_id[idx];
+
+  return NULL;
+}
 
-int vmait = pvma->vm_id;
-while (vmait < vmaid){
-if (pvma == NULL) return NULL;
 
-pvma = pvma->vm_next;
-vmait = pvma->vm_id;
+
+
+/*get_vma_by_addr - get vm area covering a virtual address
+ *@mm: memory region
+ *@addr: virtual address
+ *
+ */
+struct vm_area_struct *get_vma_by_addr(struct mm_struct *mm, unsigned long addr){
+  int idx = vma_addr_upper(mm, addr) - 1;
+
+  if (idx >= 0 && addr < mm->vma_addr[idx]->vm_end)
+    return mm->vma_addr[idx];
+
+  return NULL;
 }
 
-return pvma;
+/*vm_next_mapped - lowest address at or above addr covered by a vm area
+ *@mm: memory region
+ *@addr: virtual address
+ *
+ * Return PAGING_VMA_TOP when no vm area is left above addr.
+ */
+unsigned long vm_next_mapped(struct mm_struct *mm, unsigned long addr){
+  int idx = vma_addr_upper(mm, addr) - 1;
+
+  if (idx >= 0 && addr < mm->vma_addr[idx]->vm_end)
+    return addr;
+
+  for (idx++; idx < mm->vma_cnt; idx++)
+    if (mm->vma_addr[idx]->vm_start < mm->vma_addr[idx]->vm_end)
+      return mm->vma_addr[idx]->vm_start;
+
+  return PAGING_VMA_TOP;
+}
+
+
+
+
+/*create_vm_area - add a new vm area to a memory region
+ *@mm: memory region
+ *@vmastart: area start
+ *@vmaend: area end
+ *@flags: VM_* flags
+ *
+ * The area gets the next free ID. Returns NULL if [vmastart, vmaend)
+ * overlaps an existing area.
+ */
+struct vm_area_struct *create_vm_area(struct mm_struct *mm, unsigned long vmastart, unsigned long vmaend, unsigned long flags){
+  struct vm_area_struct *vma;
+  int idx, i;
+
+  if (vmastart > vmaend || __validate_overlap_vm_area(mm, -1, vmastart, vmaend) < 0)
+    return NULL;
+
+  if (mm->vma_cnt == mm->vma_cap){
+    int newcap = (mm->vma_cap > 0) ? mm->vma_cap * 2 : 4;
+    struct vm_area_struct **newaddr = realloc(mm->vma_addr, newcap * sizeof(*newaddr));
+    if (newaddr == NULL) return NULL;
+    mm->vma_addr = newaddr;
+    struct vm_area_struct **newid = realloc(mm->vma_id, newcap * sizeof(*newid));
+    if (newid == NULL) return NULL;
+    mm->vma_id = newid;
+    mm->vma_cap = newcap;
+  }
+
+  vma = malloc(sizeof(struct vm_area_struct));
+  vma->vm_id = mm->vma_next_id++;
+  vma->vm_start = vmastart;
+  vma->vm_end = vmaend;
+  vma->vm_flags = flags;
+  vma->sbrk = (flags & VM_GROWSDOWN) ? vmastart : vmaend;
+  vma->vm_mm = mm;
+  vma->vm_freerg_list = NULL;
+  for (i = 0; i < PAGING_FREERG_NBINS; i++) vma->vm_freerg_bin[i] = NULL;
+  vma->vm_shm = NULL;
+
+  /* IDs only grow, the new area is the last one by ID */
+  mm->vma_id[mm->vma_cnt] = vma;
+
+  /* Keep vma_addr sorted by (vm_start, vm_end) */
+  idx = vma_addr_upper(mm, vmastart);
+  while (idx > 0 && mm->vma_addr[idx - 1]->vm_start == vmastart &&
+         mm->vma_addr[idx - 1]->vm_end > vmaend)
+    idx--;
+  memmove(&mm->vma_addr[idx + 1], &mm->vma_addr[idx], (mm->vma_cnt - idx) * sizeof(*mm->vma_addr));
+  mm->vma_addr[idx] = vma;
+  mm->vma_cnt++;
+
+  /* mmap list follows the address order */
+  vma->vm_next = (idx + 1 < mm->vma_cnt) ? mm->vma_addr[idx + 1] : NULL;
+  if (idx > 0)
+    mm->vma_addr[idx - 1]->vm_next = vma;
+  else
+    mm->mmap = vma;
+
+  return vma;
+}
+
+
+
+
+/*remove_vm_area - drop a vm area from a memory region
+ *@mm: memory region
+ *@vmaid: ID vm area
+ *
+ * Only the area bookkeeping is released, the caller unmaps its pages.
+ */
+int remove_vm_area(struct mm_struct *mm, int vmaid){
+  struct vm_area_struct *vma = get_vma_by_num(mm, vmaid);
+  struct vm_rg_struct *rg, *rg_next;
+  int idx;
+
+  if (vma == NULL) return -1;
+
+  idx = vma_id_index(mm, vmaid);
+  memmove(&mm->vma_id[idx], &mm->vma_id[idx + 1], (mm->vma_cnt - idx - 1) * sizeof(*mm->vma_id));
+
+  /* Past the last area of its start, only empty areas share one */
+  for (idx = vma_addr_upper(mm, vma->vm_start) - 1; mm->vma_addr[idx] != vma; idx--);
+  if (idx > 0)
+    mm->vma_addr[idx - 1]->vm_next = vma->vm_next;
+  else
+    mm->mmap = vma->vm_next;
+  memmove(&mm->vma_addr[idx], &mm->vma_addr[idx + 1], (mm->vma_cnt - idx - 1) * sizeof(*mm->vma_addr));
+  mm->vma_cnt--;
+
+  for (rg = vma->vm_freerg_list; rg != NULL; rg = rg_next){
+    rg_next = rg->rg_next;
+    free(rg);
+  }
+  free(vma);
+
+  return 0;
+}
+
+
+
+
+/*vm_map_area - create an anonymous vm area in the highest free gap
+ *@mm: memory region
+ *@size: page aligned area size
+ *
+ * The gap search walks down from PAGING_MMAP_BASE, the heap below and
+ * the stack above keep growing toward the mappings.
+ */
+struct vm_area_struct *vm_map_area(struct mm_struct *mm, unsigned long size){
+  unsigned long hole_end = PAGING_MMAP_BASE;
+  unsigned long hole_start;
+  int idx = vma_addr_upper(mm, hole_end - 1) - 1;
+
+  if (size == 0 || size > hole_end) return NULL;
+
+  for (;; idx--){
+    hole_start = (idx >= 0) ? mm->vma_addr[idx]->vm_end : 0;
+    if (hole_start < hole_end && hole_end - hole_start >= size)
+      return create_vm_area(mm, hole_end - size, hole_end, VM_MAPPED);
+    if (idx < 0)
+      return NULL;
+    if (mm->vma_addr[idx]->vm_start < hole_end)
+      hole_end = mm->vma_addr[idx]->vm_start;
+  }
 }
 
 
@@ -59,8 +263,24 @@ if(cur_vma == NULL) return NULL;
 struct vm_rg_struct* newrg = malloc(sizeof(struct vm_rg_struct));
 
 // TODO: update the newrg boundary
+if (cur_vma->vm_flags & VM_GROWSDOWN){
+/* Stack like area grows below its break */
+if (cur_vma->sbrk < (unsigned long)alignedsz){
+free(newrg);
+return NULL;
+}
+newrg->rg_start = cur_vma->sbrk - alignedsz;
+newrg->rg_end = cur_vma->sbrk;
+} else {
 newrg->rg_start = cur_vma->sbrk;
 newrg->rg_end = newrg->rg_start + alignedsz;
+}
+
+/* Never go past the virtual address space */
+if (newrg->rg_end > PAGING_VMA_TOP){
+free(newrg);
+return NULL;
+}
 newrg->rg_next = NULL; /* Initialize next pointer to NULL */
 
 return newrg;
@@ -69,6 +289,33 @@ return newrg;
 
 
 
+/*__validate_overlap_vm_area - check a planned range against the vm areas
+ *@mm: memory region
+ *@vmaid: ID vm area to skip (the one being extended), -1 for none
+ *@vmastart: planned start
+ *@vmaend: planned end
+ *
+ * Only the areas around [vmastart, vmaend) in address order are visited.
+ */
+int __validate_overlap_vm_area(struct mm_struct *mm, int vmaid, unsigned long vmastart, unsigned long vmaend){
+  int idx = vma_addr_upper(mm, vmastart) - 1;
+
+  if (idx < 0) idx = 0;
+
+  for (; idx < mm->vma_cnt && mm->vma_addr[idx]->vm_start < vmaend; idx++){
+    struct vm_area_struct *vma = mm->vma_addr[idx];
+
+    /* Skip the vmaid we're trying to extend */
+    if (vmaid >= 0 && vma->vm_id == (unsigned long)vmaid)
+      continue;
+
+    if (OVERLAP(vmastart, vmaend, vma->vm_start, vma->vm_end))
+      return -1;
+  }
+
+  return 0;
+}
+
 /*validate_overlap_vm_area
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
@@ -76,23 +323,235 @@ return newrg;
  *@vmaend: vma end
  */
 int validate_overlap_vm_area(struct pcb_t *caller, int vmaid, int vmastart, int vmaend){
-/* TODO validate the planned memory area is not overlapped */
-struct vm_area_struct *vma = caller->mm->mmap;
-
-/* Check if the planned memory area overlaps with existing areas */
-while (vma != NULL){
-/* Skip the vmaid we're trying to extend */
-if (vma->vm_id != vmaid){
-if (OVERLAP(vmastart, vmaend, vma->vm_start, vma->vm_end)){
-printf("=====vma overlap detected=====\n");
-return -1;
+  if (__validate_overlap_vm_area(caller->mm, vmaid, vmastart, vmaend) < 0){
+    printf("=====vma overlap detected=====\n");
+    return -1;
+  }
+
+  return 0;
 }
+
+
+
+
+/*vm_freerg_binidx - size class of a free region
+ *@size: region size
+ *
+ */
+static int vm_freerg_binidx(unsigned long size){
+  int bin = 0;
+
+  while ((size >>= 1) != 0 && bin < PAGING_FREERG_NBINS - 1)
+    bin++;
+
+  return bin;
 }
 
-vma = vma->vm_next;
+static void vm_freerg_bin_add(struct vm_area_struct *vma, struct vm_rg_struct *rg){
+  int bin = vm_freerg_binidx(rg->rg_end - rg->rg_start);
+
+  rg->bin_prev = NULL;
+  rg->bin_next = vma->vm_freerg_bin[bin];
+  if (rg->bin_next != NULL)
+    rg->bin_next->bin_prev = rg;
+  vma->vm_freerg_bin[bin] = rg;
 }
 
-return 0;
+static void vm_freerg_bin_del(struct vm_area_struct *vma, struct vm_rg_struct *rg){
+  int bin = vm_freerg_binidx(rg->rg_end - rg->rg_start);
+
+  if (rg->bin_prev != NULL)
+    rg->bin_prev->bin_next = rg->bin_next;
+  else
+    vma->vm_freerg_bin[bin] = rg->bin_next;
+  if (rg->bin_next != NULL)
+    rg->bin_next->bin_prev = rg->bin_prev;
+  rg->bin_next = rg->bin_prev = NULL;
+}
+
+/* Drop a free region from both lists and release the node */
+static void vm_freerg_unlink(struct vm_area_struct *vma, struct vm_rg_struct *rg){
+  vm_freerg_bin_del(vma, rg);
+
+  if (rg->rg_prev != NULL)
+    rg->rg_prev->rg_next = rg->rg_next;
+  else
+    vma->vm_freerg_list = rg->rg_next;
+  if (rg->rg_next != NULL)
+    rg->rg_next->rg_prev = rg->rg_prev;
+
+  free(rg);
+}
+
+
+
+
+/*vm_freerg_insert - put a region back to the free lists of a vm area
+ *@vma: vm area
+ *@rg_elmt: freed region, the node is owned (and may be released) here
+ *
+ * The address ordered list is kept coalesced: a region touching its
+ * neighbours is merged into them. Returns the resulting free region, or
+ * NULL if the region is empty or overlaps a region already free.
+ */
+struct vm_rg_struct *vm_freerg_insert(struct vm_area_struct *vma, struct vm_rg_struct *rg_elmt){
+  struct vm_rg_struct *prev = NULL;
+  struct vm_rg_struct *next = vma->vm_freerg_list;
+
+  if (rg_elmt->rg_start >= rg_elmt->rg_end)
+    return NULL;
+
+  while (next != NULL && next->rg_start < rg_elmt->rg_start){
+    prev = next;
+    next = next->rg_next;
+  }
+
+  /* Double free or corrupted region */
+  if ((prev != NULL && prev->rg_end > rg_elmt->rg_start) ||
+      (next != NULL && next->rg_start < rg_elmt->rg_end))
+    return NULL;
+
+  if (prev != NULL && prev->rg_end == rg_elmt->rg_start){
+    /* Grow the lower neighbour */
+    vm_freerg_bin_del(vma, prev);
+    prev->rg_end = rg_elmt->rg_end;
+    free(rg_elmt);
+    rg_elmt = prev;
+  } else {
+    rg_elmt->rg_prev = prev;
+    rg_elmt->rg_next = next;
+    if (prev != NULL)
+      prev->rg_next = rg_elmt;
+    else
+      vma->vm_freerg_list = rg_elmt;
+    if (next != NULL)
+      next->rg_prev = rg_elmt;
+  }
+
+  if (next != NULL && next->rg_start == rg_elmt->rg_end){
+    /* Swallow the upper neighbour */
+    rg_elmt->rg_end = next->rg_end;
+    vm_freerg_unlink(vma, next);
+  }
+
+  vm_freerg_bin_add(vma, rg_elmt);
+  return rg_elmt;
+}
+
+
+
+
+/*vm_freerg_take - carve a region out of the free lists of a vm area
+ *@vma: vm area
+ *@size: requested size
+ *@newrg: obtained region
+ *
+ * The bin of the request is searched first fit, any region of a larger
+ * bin fits as is. The region is cut from the start of the free one.
+ */
+int vm_freerg_take(struct vm_area_struct *vma, int size, struct vm_rg_struct *newrg){
+  struct vm_rg_struct *rgit = NULL;
+  int bin;
+
+  if (size <= 0)
+    return -1;
+
+  for (bin = vm_freerg_binidx(size); bin < PAGING_FREERG_NBINS; bin++){
+    for (rgit = vma->vm_freerg_bin[bin]; rgit != NULL; rgit = rgit->bin_next){
+      if (rgit->rg_end - rgit->rg_start >= size)
+        break;
+    }
+    if (rgit != NULL)
+      break;
+  }
+
+  if (rgit == NULL)
+    return -1;
+
+  newrg->rg_start = rgit->rg_start;
+  newrg->rg_end = rgit->rg_start + size;
+
+  if (rgit->rg_end == newrg->rg_end){
+    /* Used all free space, remove exactly this region */
+    vm_freerg_unlink(vma, rgit);
+  } else {
+    vm_freerg_bin_del(vma, rgit);
+    rgit->rg_start = newrg->rg_end;
+    vm_freerg_bin_add(vma, rgit);
+  }
+
+  return 0;
+}
+
+
+
+
+/*vm_freerg_stat - fragmentation metrics of the free regions of a vm area
+ *@vma: vm area
+ *@stat: obtained statistics
+ *
+ */
+int vm_freerg_stat(struct vm_area_struct *vma, struct vm_freerg_stat *stat){
+  struct vm_rg_struct *rgit;
+
+  stat->nr_regions = 0;
+  stat->total = 0;
+  stat->largest = 0;
+  stat->frag_pct = 0;
+
+  for (rgit = vma->vm_freerg_list; rgit != NULL; rgit = rgit->rg_next){
+    unsigned long sz = rgit->rg_end - rgit->rg_start;
+
+    stat->nr_regions++;
+    stat->total += sz;
+    if (sz > stat->largest)
+      stat->largest = sz;
+  }
+
+  if (stat->total > 0)
+    stat->frag_pct = 100 - (int)(stat->largest * 100 / stat->total);
+
+  return 0;
+}
+
+
+
+
+/*vm_rss_stat - resident pages of a memory region
+ *@mm: memory region
+ *@rss_private: return resident pages owned by the process alone
+ *@rss_shared: return resident pages of shared segments
+ *
+ */
+int vm_rss_stat(struct mm_struct *mm, int *rss_private, int *rss_shared){
+  struct vm_area_struct *vma;
+  unsigned long pgn;
+
+  *rss_private = 0;
+  *rss_shared = 0;
+
+  for (vma = mm->mmap; vma != NULL; vma = vma->vm_next){
+    for (pgn = vma->vm_start / PAGING_PAGESZ; pgn < DIV_ROUND_UP(vma->vm_end, PAGING_PAGESZ); pgn++){
+      uint32_t pte = mm->pgd[pgn];
+
+      if (!PAGING_PAGE_PRESENT(pte) || PAGING_PAGE_SWAPPED(pte))
+        continue;
+
+#ifdef HUGEPAGE_ORDER
+      if (PAGING_PAGE_HUGE(pte)){
+        *rss_private += PAGING_HPAGE_NR;
+        continue;
+      }
+#endif
+
+      if (vma->vm_flags & VM_SHARED)
+        (*rss_shared)++;
+      else
+        (*rss_private)++;
+    }
+  }
+
+  return 0;
 }
 
 
@@ -102,36 +561,40 @@ return 0;
  *@caller: caller
  *@vmaid: ID vm area to alloc memory region
  *@inc_sz: increment size
+ *
+ * Only the virtual range is reserved here, no frame is mapped. Each page of
+ * the new range is populated on its first access by the demand-zero fault
+ * in pg_getpage.
  */
 int inc_vma_limit(struct pcb_t *caller, int vmaid, int inc_sz){
-struct vm_rg_struct * newrg = malloc(sizeof(struct vm_rg_struct)); // not used elsewhere -> leak
 int inc_amt = PAGING_PAGE_ALIGNSZ(inc_sz);
-int incnumpage =inc_amt / PAGING_PAGESZ;
-struct vm_rg_struct *area = get_vm_area_node_at_brk(caller, vmaid, inc_sz, inc_amt); // this too
+struct vm_rg_struct *area = get_vm_area_node_at_brk(caller, vmaid, inc_sz, inc_amt);
 if(area == NULL) return -1;
 /* TODO: Obtain the new vm area based on vmaid */
 struct vm_area_struct *cur_vma = get_vma_by_num(caller->mm, vmaid);
-if(cur_vma == NULL) return -1;
-
-int old_end = cur_vma->vm_end;
+if(cur_vma == NULL){
+free(area);
+return -1;
+}
 
 /*Validate overlap of obtained region */
-if (validate_overlap_vm_area(caller, vmaid, area->rg_start, area->rg_end) < 0) return -1; /*Overlap and failed allocation */
-
+if (validate_overlap_vm_area(caller, vmaid, area->rg_start, area->rg_end) < 0){
+free(area);
+return -1; /*Overlap and failed allocation */
+}
 
+if (cur_vma->vm_flags & VM_GROWSDOWN){
+/* Update the VM area start limit */
+cur_vma->vm_start = area->rg_start;
+cur_vma->sbrk = area->rg_start; /* Update the break point */
+} else {
 /* Update the VM area end limit */
 cur_vma->vm_end = area->rg_end;
 cur_vma->sbrk = area->rg_end; /* Update the break point */
+}
 
-int inc_limit_ret = vm_map_ram(caller, area->rg_start, area->rg_end, old_end, incnumpage, newrg);
-int return_sig = 0;
-if (inc_limit_ret < 0) return_sig = -1; /* Failed to map the memory to MEMRAM */
-
-// clean up unused malloc
-free(newrg);
 free(area);
-
-return return_sig;
+return 0;
 }
 
 // #endif
@@ -0,0 +1,407 @@
+// #ifdef MM_PAGING
+/*
+ * PAGING based Memory Management
+ * Compressed swap cache module mm/mm-zswap.c
+ */
+
+#include "mm.h"
+#include "sim.h"
+#include "snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef ZSWAP
+
+/* A swapped PTE of type PAGING_SWPTYP_ZSWAP names one of these entries,
+ * the entry holds the compressed page or, once pushed out of the pool,
+ * the MEMSWP frame it was written back to.
+ */
+struct zswap_entry {
+  int refcnt;     /* PTEs naming the entry, 0 while the slot is free */
+  int len;        /* compressed length in the pool, -1 once written back */
+  BYTE *data;     /* compressed page, NULL for a zero-filled page */
+  int swpfpn;     /* MEMSWP frame after write back */
+  int prev, next; /* pool order oldest first, next links the free slots */
+};
+
+/* The pool lives in the simulation context, callers serialize through
+ * the libmem lock */
+
+/*zswap_compress - PackBits style run length encoding of a page
+ *@src: page
+ *@dst: output buffer
+ *@limit: give up once the output would grow past this
+ *
+ * A control byte c < 128 is followed by c + 1 literal bytes, c >= 129
+ * repeats the next byte 257 - c times.
+ */
+static int zswap_compress(const BYTE *src, BYTE *dst, int limit){
+  int i = 0, n = 0;
+
+  while (i < PAGING_PAGESZ){
+    int run = 1, lit = 0;
+
+    while (i + run < PAGING_PAGESZ && run < 128 && src[i + run] == src[i])
+      run++;
+
+    if (run >= 3){
+      if (n + 2 > limit)
+        return -1;
+      dst[n++] = (BYTE)(257 - run);
+      dst[n++] = src[i];
+      i += run;
+      continue;
+    }
+
+    /* Literals up to the next run worth encoding */
+    while (i + lit < PAGING_PAGESZ && lit < 128){
+      if (i + lit + 2 < PAGING_PAGESZ && src[i + lit] == src[i + lit + 1] &&
+          src[i + lit] == src[i + lit + 2])
+        break;
+      lit++;
+    }
+
+    if (n + 1 + lit > limit)
+      return -1;
+    dst[n++] = (BYTE)(lit - 1);
+    memcpy(dst + n, src + i, lit);
+    n += lit;
+    i += lit;
+  }
+
+  return n;
+}
+
+/*zswap_decompress - expand a page encoded by zswap_compress
+ *@src: compressed page, NULL for a zero-filled page
+ *@len: compressed length
+ *@dst: page
+ *
+ */
+static int zswap_decompress(const BYTE *src, int len, BYTE *dst){
+  int i = 0, n = 0;
+
+  if (src == NULL){
+    memset(dst, 0, PAGING_PAGESZ);
+    return 0;
+  }
+
+  while (i < len){
+    int c = (unsigned char)src[i++];
+
+    if (c < 128){
+      if (n + c + 1 > PAGING_PAGESZ || i + c + 1 > len)
+        return -1;
+      memcpy(dst + n, src + i, c + 1);
+      n += c + 1;
+      i += c + 1;
+    } else {
+      if (n + 257 - c > PAGING_PAGESZ || i >= len)
+        return -1;
+      memset(dst + n, (unsigned char)src[i++], 257 - c);
+      n += 257 - c;
+    }
+  }
+
+  return (n == PAGING_PAGESZ) ? 0 : -1;
+}
+
+static void zswap_lru_del(struct sim_ctx *ctx, int id){
+  struct zswap_entry *e = &ctx->zswap_tbl[id];
+
+  if (e->prev >= 0) ctx->zswap_tbl[e->prev].next = e->next;
+  else ctx->zswap_head = e->next;
+  if (e->next >= 0) ctx->zswap_tbl[e->next].prev = e->prev;
+  else ctx->zswap_tail = e->prev;
+  e->prev = e->next = -1;
+}
+
+static void zswap_lru_add(struct sim_ctx *ctx, int id){
+  struct zswap_entry *e = &ctx->zswap_tbl[id];
+
+  e->prev = ctx->zswap_tail;
+  e->next = -1;
+  if (ctx->zswap_tail >= 0) ctx->zswap_tbl[ctx->zswap_tail].next = id;
+  else ctx->zswap_head = id;
+  ctx->zswap_tail = id;
+}
+
+/*zswap_alloc_id - take a free entry slot, growing the table if needed
+ *@ctx: simulation
+ *
+ */
+static int zswap_alloc_id(struct sim_ctx *ctx){
+  int id;
+
+  if (ctx->zswap_freeid < 0){
+    int cap = ctx->zswap_cap ? ctx->zswap_cap * 2 : 64;
+    struct zswap_entry *tbl;
+
+    if (cap > BIT(PAGING_PTE_SWPOFF_HIBIT - PAGING_PTE_SWPOFF_LOBIT + 1))
+      return -1;
+    tbl = realloc(ctx->zswap_tbl, cap * sizeof(struct zswap_entry));
+    if (tbl == NULL)
+      return -1;
+    ctx->zswap_tbl = tbl;
+    for (id = cap - 1; id >= ctx->zswap_cap; id--){
+      ctx->zswap_tbl[id].refcnt = 0;
+      ctx->zswap_tbl[id].data = NULL;
+      ctx->zswap_tbl[id].next = ctx->zswap_freeid;
+      ctx->zswap_freeid = id;
+    }
+    ctx->zswap_cap = cap;
+  }
+
+  id = ctx->zswap_freeid;
+  ctx->zswap_freeid = ctx->zswap_tbl[id].next;
+  return id;
+}
+
+/*zswap_writeback - push the oldest pool entry out to the swap device
+ *@ctx: simulation
+ *
+ * Zero-filled entries take no pool space and are left in place.
+ */
+static int zswap_writeback(struct sim_ctx *ctx){
+  int id = ctx->zswap_head, swpfpn;
+  struct zswap_entry *e;
+  BYTE page[PAGING_PAGESZ];
+
+  while (id >= 0 && ctx->zswap_tbl[id].len == 0)
+    id = ctx->zswap_tbl[id].next;
+  if (id < 0 || ctx->zswap_dev == NULL)
+    return -1;
+  e = &ctx->zswap_tbl[id];
+
+  if (MEMPHY_get_freefp(ctx->zswap_dev, &swpfpn) < 0)
+    return -1;
+
+  zswap_decompress(e->data, e->len, page);
+  MEMPHY_write_range(ctx->zswap_dev, swpfpn * PAGING_PAGESZ, page, PAGING_PAGESZ);
+
+  zswap_lru_del(ctx, id);
+  ctx->zstat.pool_bytes -= e->len;
+  ctx->zstat.pool_pages--;
+  free(e->data);
+  e->data = NULL;
+  e->len = -1;
+  e->swpfpn = swpfpn;
+  ctx->zstat.written_back++;
+
+  return 0;
+}
+
+/*zswap_store - compress a frame into the pool
+ *@ctx: simulation
+ *@mram: memory device of the frame
+ *@fpn: frame to store
+ *@mswp: swap device taking the pages pushed out of the pool
+ *
+ * Return the entry id with one reference, or -1 when the page does not
+ * compress below ZSWAP_MAX_LEN and has to go to the swap device.
+ */
+int zswap_store(struct sim_ctx *ctx, struct memphy_struct *mram, int fpn, struct memphy_struct *mswp){
+  BYTE page[PAGING_PAGESZ], buf[ZSWAP_MAX_LEN];
+  int i, id, len = 0;
+
+  ctx->zswap_dev = mswp;
+  MEMPHY_read_range(mram, fpn * PAGING_PAGESZ, page, PAGING_PAGESZ);
+
+  for (i = 0; i < PAGING_PAGESZ && page[i] == 0; i++);
+  if (i < PAGING_PAGESZ){
+    len = zswap_compress(page, buf, ZSWAP_MAX_LEN);
+    if (len < 0){
+      ctx->zstat.rejected++;
+      return -1;
+    }
+  }
+
+  /* Make room by writing back the oldest entries */
+  while (ctx->zstat.pool_bytes + len > ZSWAP_POOL_SZ)
+    if (zswap_writeback(ctx) < 0){
+      ctx->zstat.rejected++;
+      return -1;
+    }
+
+  id = zswap_alloc_id(ctx);
+  if (id < 0){
+    ctx->zstat.rejected++;
+    return -1;
+  }
+
+  struct zswap_entry *e = &ctx->zswap_tbl[id];
+  e->refcnt = 1;
+  e->len = len;
+  e->swpfpn = -1;
+  e->data = NULL;
+  if (len > 0){
+    e->data = malloc(len);
+    memcpy(e->data, buf, len);
+  } else {
+    ctx->zstat.zero_pages++;
+  }
+  zswap_lru_add(ctx, id);
+
+  ctx->zstat.stored++;
+  ctx->zstat.orig_bytes += PAGING_PAGESZ;
+  ctx->zstat.comp_bytes += len;
+  ctx->zstat.pool_bytes += len;
+  ctx->zstat.pool_pages++;
+
+  return id;
+}
+
+/*zswap_load - copy the page of an entry into a frame
+ *@ctx: simulation
+ *@id: entry id
+ *@mram: memory device
+ *@fpn: destination frame
+ *
+ * The entry keeps its reference, drop it with zswap_put.
+ */
+int zswap_load(struct sim_ctx *ctx, int id, struct memphy_struct *mram, int fpn){
+  struct zswap_entry *e = &ctx->zswap_tbl[id];
+  BYTE page[PAGING_PAGESZ];
+
+  if (e->len < 0){
+    ctx->zstat.misses++;
+    return MEMPHY_copy_frame(ctx->zswap_dev, e->swpfpn, mram, fpn);
+  }
+
+  ctx->zstat.hits++;
+  if (zswap_decompress(e->data, e->len, page) < 0)
+    return -1;
+  return MEMPHY_write_range(mram, fpn * PAGING_PAGESZ, page, PAGING_PAGESZ);
+}
+
+/*zswap_needs_io - tell whether loading an entry reads the swap device
+ *@ctx: simulation
+ *@id: entry id
+ *
+ */
+int zswap_needs_io(struct sim_ctx *ctx, int id){
+  return ctx->zswap_tbl[id].len < 0;
+}
+
+/*zswap_get - add a reference to an entry
+ *@ctx: simulation
+ *@id: entry id
+ *
+ */
+int zswap_get(struct sim_ctx *ctx, int id){
+  ctx->zswap_tbl[id].refcnt++;
+  return 0;
+}
+
+/*zswap_put - drop a reference, freeing the entry with the last one
+ *@ctx: simulation
+ *@id: entry id
+ *
+ */
+int zswap_put(struct sim_ctx *ctx, int id){
+  struct zswap_entry *e = &ctx->zswap_tbl[id];
+
+  if (--e->refcnt > 0)
+    return 0;
+
+  if (e->len < 0){
+    MEMPHY_put_freefp(ctx->zswap_dev, e->swpfpn);
+  } else {
+    zswap_lru_del(ctx, id);
+    ctx->zstat.pool_bytes -= e->len;
+    ctx->zstat.pool_pages--;
+    free(e->data);
+    e->data = NULL;
+  }
+
+  e->next = ctx->zswap_freeid;
+  ctx->zswap_freeid = id;
+  return 0;
+}
+
+/*zswap_get_stat - compressed swap totals
+ *@ctx: simulation
+ *@stat: return statistics
+ *
+ */
+int zswap_get_stat(struct sim_ctx *ctx, struct zswap_stat *stat){
+  *stat = ctx->zstat;
+  return 0;
+}
+
+/*zswap_cleanup - free the pool at system shutdown
+ *@ctx: simulation
+ *
+ */
+int zswap_cleanup(struct sim_ctx *ctx){
+  int id;
+
+  for (id = 0; id < ctx->zswap_cap; id++)
+    free(ctx->zswap_tbl[id].data);
+  free(ctx->zswap_tbl);
+  ctx->zswap_tbl = NULL;
+  ctx->zswap_cap = 0;
+  ctx->zswap_freeid = ctx->zswap_head = ctx->zswap_tail = -1;
+
+  return 0;
+}
+
+/*zswap_snap - write or read the pool of a snapshot
+ *@ctx: simulation, its swap devices already restored on load
+ *@s: snapshot
+ *
+ * Entry ids are kept as they are, swapped PTEs name them.
+ */
+int zswap_snap(struct sim_ctx *ctx, struct snap *s){
+  int id, dev = -1;
+
+  if (!s->load && ctx->zswap_dev != NULL)
+    dev = ctx->zswap_dev - ctx->mswp;
+  SNAP_VAL(s, dev);
+  SNAP_VAL(s, ctx->zswap_cap);
+  SNAP_VAL(s, ctx->zswap_freeid);
+  SNAP_VAL(s, ctx->zswap_head);
+  SNAP_VAL(s, ctx->zswap_tail);
+  SNAP_VAL(s, ctx->zstat);
+  if (s->load){
+    if (s->err || dev >= PAGING_MAX_MMSWP || ctx->zswap_cap < 0 ||
+        ctx->zswap_cap > BIT(PAGING_PTE_SWPOFF_HIBIT - PAGING_PTE_SWPOFF_LOBIT + 1)){
+      ctx->zswap_cap = 0;
+      s->err = 1;
+      return -1;
+    }
+    ctx->zswap_dev = (dev >= 0) ? &ctx->mswp[dev] : NULL;
+    ctx->zswap_tbl = calloc(ctx->zswap_cap, sizeof(struct zswap_entry));
+    if (ctx->zswap_cap > 0 && ctx->zswap_tbl == NULL){
+      ctx->zswap_cap = 0;
+      s->err = 1;
+      return -1;
+    }
+  }
+
+  for (id = 0; id < ctx->zswap_cap && !s->err; id++){
+    struct zswap_entry *e = &ctx->zswap_tbl[id];
+    int has_data = (e->data != NULL);
+
+    SNAP_VAL(s, e->refcnt);
+    SNAP_VAL(s, e->len);
+    SNAP_VAL(s, e->swpfpn);
+    SNAP_VAL(s, e->prev);
+    SNAP_VAL(s, e->next);
+    SNAP_VAL(s, has_data);
+    if (!has_data)
+      continue;
+    if (s->load){
+      if (e->len <= 0 || e->len > ZSWAP_MAX_LEN || (e->data = malloc(e->len)) == NULL){
+        e->data = NULL;
+        s->err = 1;
+        break;
+      }
+    }
+    snap_io(s, e->data, e->len);
+  }
+
+  return s->err ? -1 : 0;
+}
+
+#endif
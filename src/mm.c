@@ -5,6 +5,7 @@
  */
 
 #include "mm.h"
+#include "trace.h"
 #include <stdlib.h>
 #include <stdio.h>
 
@@ -69,6 +70,7 @@ int pte_set_swap(uint32_t *pte, int swptyp, int swpoff){
 int pte_set_fpn(uint32_t *pte, int fpn){
 SETBIT(*pte, PAGING_PTE_PRESENT_MASK);
 CLRBIT(*pte, PAGING_PTE_SWAPPED_MASK);
+CLRBIT(*pte, PAGING_PTE_SWPOFF_MASK); /* drop stale swap offset bits */
 
 SETVAL(*pte, fpn, PAGING_PTE_FPN_MASK, PAGING_PTE_FPN_LOBIT);
 return 0;
@@ -241,19 +243,7 @@ return 0;
 int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
                    struct memphy_struct *mpdst, int dstfpn)
 {
-  int cellidx;
-  int addrsrc, addrdst;
-  for (cellidx = 0; cellidx < PAGING_PAGESZ; cellidx++)
-  {
-    addrsrc = srcfpn * PAGING_PAGESZ + cellidx;
-    addrdst = dstfpn * PAGING_PAGESZ + cellidx;
-
-    BYTE data;
-    MEMPHY_read(mpsrc, addrsrc, &data);
-    MEMPHY_write(mpdst, addrdst, data);
-  }
-
-  return 0;
+  return MEMPHY_copy_frame(mpsrc, srcfpn, mpdst, dstfpn);
 }
 
 
@@ -265,28 +255,68 @@ int __swap_cp_page(struct memphy_struct *mpsrc, int srcfpn,
  * @caller: mm owner
  */
 int init_mm(struct mm_struct *mm, struct pcb_t *caller){
-  struct vm_area_struct *vma0 = malloc(sizeof(struct vm_area_struct));
-
   mm->pgd = malloc(PAGING_MAX_PGN * sizeof(uint32_t));
   // Initialize as not present, not swapped
   for (int i = 0; i < PAGING_MAX_PGN; i++) mm->pgd[i] = 0x00000000; // Clear all bits
   mm->fifo_pgn = NULL;
+  mm->symrgtbl = NULL;
+  mm->symrgtbl_sz = 0;
+  mm->minflt = 0;
+  mm->majflt = 0;
+  mm->cowflt = 0;
+  mm->pf_pgn = -1;
+  mm->pf_ready = 0;
+  mm->thpflt = 0;
+  mm->thpsplit = 0;
+#ifdef TLB_ENTRIES
+  mm->tlb_hit = 0;
+  mm->tlb_miss = 0;
+#endif
+  tlb_flush(mm);
+
+  mm->mmap = NULL;
+  mm->vma_addr = NULL;
+  mm->vma_id = NULL;
+  mm->vma_cnt = 0;
+  mm->vma_cap = 0;
+  mm->vma_next_id = 0;
+
+  /* By default the owner comes with the heap as VMA 0, growing up from
+   * address 0, and the stack as VMA 1, growing down from the top */
+  if (create_vm_area(mm, 0, 0, 0) == NULL)
+    return -1;
+  if (create_vm_area(mm, PAGING_VMA_TOP, PAGING_VMA_TOP, VM_GROWSDOWN) == NULL)
+    return -1;
+
+  return 0;
+}
+
+
+
+
+/*
+ * free_mm - release a Memory Management instance and the struct itself
+ * @mm: self mm
+ *
+ * Frames are not given back here, only the bookkeeping is freed.
+ */
+int free_mm(struct mm_struct *mm){
+  struct pgn_t *pgn, *pgn_next;
+
+  while (mm->vma_cnt > 0)
+    remove_vm_area(mm, mm->vma_id[0]->vm_id);
+  free(mm->vma_addr);
+  free(mm->vma_id);
+
+  for (pgn = mm->fifo_pgn; pgn != NULL; pgn = pgn_next){
+    pgn_next = pgn->pg_next;
+    free(pgn);
+  }
+
+  free(mm->symrgtbl);
+  free(mm->pgd);
+  free(mm);
 
-  /* By default the owner comes with at least one vma */
-  vma0->vm_id = 0;
-  vma0->vm_start = 0;
-  vma0->vm_end = vma0->vm_start;
-  vma0->sbrk = vma0->vm_start;
-  vma0->vm_freerg_list = NULL;
-  struct vm_rg_struct *first_rg = init_vm_rg(vma0->vm_start, vma0->vm_end);
-  enlist_vm_rg_node(&vma0->vm_freerg_list, first_rg);
-
-  /* TODO update VMA0 next */
-  vma0->vm_next = NULL;
-  /* Point vma owner backward */
-  vma0->vm_mm = mm; 
-  /* TODO: update mmap */
-  mm->mmap = vma0;
   return 0;
 }
 
@@ -299,6 +329,9 @@ struct vm_rg_struct *init_vm_rg(int rg_start, int rg_end){
   rgnode->rg_start = rg_start;
   rgnode->rg_end = rg_end;
   rgnode->rg_next = NULL;
+  rgnode->rg_prev = NULL;
+  rgnode->bin_next = NULL;
+  rgnode->bin_prev = NULL;
 
   return rgnode;
 }
@@ -329,6 +362,27 @@ int enlist_pgn_node(struct pgn_t **plist, int pgn){
 
 
 
+int delist_pgn_node(struct pgn_t **plist, int pgn){
+  struct pgn_t **pit = plist;
+
+  while (*pit != NULL)
+  {
+    if ((*pit)->pgn == pgn)
+    {
+      struct pgn_t *pnode = *pit;
+      *pit = pnode->pg_next;
+      free(pnode);
+      return 0;
+    }
+    pit = &(*pit)->pg_next;
+  }
+
+  return -1;
+}
+
+
+
+
 int print_list_fp(struct framephy_struct *ifp){
   struct framephy_struct *fp = ifp;
 
@@ -393,7 +447,11 @@ int print_list_pgn(struct pgn_t *ip)
 int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
 {
   int pgn_start, pgn_end;
-  int pgit;
+
+  if (!trace_on(TRACE_PGTBL))
+    return 0;
+  if (caller == NULL)
+    return -1;
 
   if (end == -1)
   {
@@ -404,14 +462,10 @@ int print_pgtbl(struct pcb_t *caller, uint32_t start, uint32_t end)
   pgn_start = PAGING_PGN(start);
   pgn_end = PAGING_PGN(end);
 
-  printf("print_pgtbl: %d - %d", start, end);
-  if (caller == NULL) { printf("NULL caller\n"); return -1;}
-  printf("\n");
-
-  for (pgit = pgn_start; pgit < pgn_end; pgit++)
-  {
-    printf("%08ld: %08x\n", pgit * sizeof(uint32_t), caller->mm->pgd[pgit]);
-  }
+  /* The PTEs go into the record as they are, formatting happens later */
+  int64_t args[TRACE_NARGS] = { start, end, pgn_start };
+  trace_emit(TR_PGTBL, TRACE_PGTBL, args, &caller->mm->pgd[pgn_start],
+             (pgn_end - pgn_start) * sizeof(uint32_t));
 
   return 0;
 }
@@ -125,3 +125,19 @@ struct pcb_t *dequeue(struct queue_t *q)
   return maxPriorPcb;
 }
 
+void purge(struct queue_t *q, struct pcb_t *proc)
+{
+  /* Drop every entry of [proc] from [q], keeping the order of the rest */
+  if (q == NULL || proc == NULL)
+    return;
+
+  int j = 0;
+  for (int i = 0; i < q->size; i++)
+  {
+    if (q->proc[i] != proc)
+      q->proc[j++] = q->proc[i];
+  }
+  for (int i = j; i < q->size; i++)
+    q->proc[i] = NULL;
+  q->size = j;
+}
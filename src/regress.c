@@ -0,0 +1,574 @@
+/*
+ * Regression runner for the input configurations
+ *
+ * Usage: regress-run [-u] [-t tolerance%] [-s slot] <os binary> <golden dir> <config ...>
+ *
+ * Every config is run REGRESS_REPEAT times. The output of the last run
+ * is compared with <golden dir>/<config>.output, the best wall time, the
+ * peak RSS and the simulated slots per second are checked against
+ * <golden dir>/baseline.csv.
+ * -u records new golden files and a new baseline instead.
+ * -s takes a snapshot of every config at the slot and restores it
+ * instead, the output of each process after the restore has to be the
+ * end of its golden stream. There are no perf checks then, configs
+ * that end before the slot show as SHORT.
+ *
+ * CPUs, the loader and the processes run in threads of their own, so
+ * their lines interleave differently from run to run and any CPU may
+ * pick a process up. The output is split into one stream per process,
+ * CPU numbers masked, and one for the lines of no process, and the
+ * streams are compared one by one, the latter sorted. Page tables stay
+ * with the memory operation they follow and only tell which pages are
+ * mapped. Time slot lines only count slots, numbers that depend on
+ * timing are masked and memory dumps, which show every process at once,
+ * are left out unless OS_TRACE_LEVEL asks for them. A config has to
+ * differ in REGRESS_REPEAT runs in a row to fail.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_STREAMS 256
+#define RSS_TOLERANCE 20 /* percent */
+#define TIME_SLACK_MS 5  /* differences below this are noise whatever the ratio */
+#define REGRESS_REPEAT 3 /* runs per config, the fastest one counts */
+#define REGRESS_TRACE_LEVEL "3" /* page tables but no memory dumps, OS_TRACE_LEVEL overrides */
+
+struct stream {
+  char key[32];
+  char **blk;
+  int nr, cap;
+};
+
+struct result {
+  double wall_ms;
+  long rss_kb;
+  long slots;
+};
+
+/* Lines whose numbers change with timing rather than with behaviour:
+ * CPU load, host time and counters the kernel daemons running beside
+ * the processes move
+ */
+static const char *volatile_lines[] = {
+  "busy slots",
+  "page faults:",
+  "rss:",
+  "tlb:",
+  "huge pages:",
+  "until slot",
+  "kcompactd:",
+  "COW:",
+  "KSM:",
+  "Zswap:",
+  "Reclaim:",
+  "Compaction:",
+  "MEMRAM:",
+  NULL
+};
+
+static char *read_file(const char *path){
+  FILE *fp = fopen(path, "rb");
+  char *buf;
+  long sz;
+
+  if (fp == NULL)
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  sz = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  buf = malloc(sz + 1);
+  if (buf != NULL && fread(buf, 1, sz, fp) == (size_t)sz)
+    buf[sz] = '\0';
+  fclose(fp);
+  return buf;
+}
+
+/*mask_line - hide the parts of a line that depend on interleaving
+ *@line: line, modified
+ *
+ */
+static void mask_line(char *line){
+  char *p, *q;
+  int i;
+
+  /* Any CPU may pick a process up */
+  for (p = strstr(line, "CPU "); p != NULL; p = strstr(p, "CPU "))
+    for (p += 4; isdigit((unsigned char)*p); p++)
+      *p = '#';
+
+  for (i = 0; volatile_lines[i] != NULL; i++)
+    if (strstr(line, volatile_lines[i]) != NULL)
+      break;
+  if (volatile_lines[i] == NULL)
+    return;
+  for (p = q = line; *p; p++){
+    if (isdigit((unsigned char)*p) && q > line && q[-1] == '#')
+      continue;
+    *q++ = isdigit((unsigned char)*p) ? '#' : *p;
+  }
+  *q = '\0';
+}
+
+/*mask_pte - keep whether a page table entry maps a page
+ *@line: "index: pte" line, modified
+ *
+ * Frames and swap slots come from pools every process shares, KSM and
+ * writes of forked processes set and clear COW, the reclaim daemons
+ * decide what is resident and split huge pages.
+ */
+static void mask_pte(char *line){
+  uint32_t pte = strtoul(line + 10, NULL, 16);
+
+  sprintf(line + 10, "%08x", pte & 0xc0000000u ? 0x80000000u : 0);
+}
+
+static int is_pte(const char *line){
+  return strlen(line) == 18 && line[8] == ':' && strspn(line, "0123456789") == 8;
+}
+
+/*line_key - stream a line starts, NULL if it continues a memory operation
+ *@line: masked line
+ *@key: buffer for the key
+ *
+ * Lines about a process go to its stream, whichever CPU printed them.
+ */
+static const char *line_key(const char *line, char *key){
+  const char *p;
+  int n;
+
+  if (strncmp(line, "print_pgtbl:", 12) == 0 || strncmp(line, "BYTE ", 5) == 0 ||
+      strstr(line, "PHYSICAL MEMORY DUMP") || strstr(line, "PHYSICAL MEMORY END-DUMP") ||
+      strstr(line, "PHYSICAL MEMORY DIFF") || strstr(line, "PHYSICAL MEMORY END-DIFF") ||
+      strcmp(line, "Empty physical memory") == 0 || strcmp(line, "No change in physical memory") == 0 ||
+      (line[0] == '=' && strspn(line, "=") == strlen(line)) || is_pte(line))
+    return NULL;
+
+  if ((p = strstr(line, "rocess")) != NULL && sscanf(p, "rocess %d", &n) == 1)
+    snprintf(key, 32, "pid %d", n);
+  else if ((p = strstr(line, "rocessed")) != NULL && sscanf(p, "rocessed %d", &n) == 1)
+    snprintf(key, 32, "pid %d", n);
+  else if ((p = strstr(line, "PID=")) != NULL && sscanf(p, "PID=%d", &n) == 1)
+    snprintf(key, 32, "pid %d", n);
+  else if ((p = strstr(line, "PID: ")) != NULL && sscanf(p, "PID: %d", &n) == 1)
+    snprintf(key, 32, "pid %d", n);
+  else if (strstr(line, "CPU ") != NULL)
+    snprintf(key, 32, "cpus");
+  else
+    snprintf(key, 32, "other");
+  return key;
+}
+
+static struct stream *stream_get(struct stream *st, int *nst, const char *key){
+  int i;
+
+  for (i = 0; i < *nst; i++)
+    if (strcmp(st[i].key, key) == 0)
+      return &st[i];
+  if (*nst == MAX_STREAMS)
+    return &st[MAX_STREAMS - 1];
+  memset(&st[*nst], 0, sizeof(struct stream));
+  snprintf(st[*nst].key, sizeof(st[*nst].key), "%s", key);
+  return &st[(*nst)++];
+}
+
+static void stream_add(struct stream *s, char *text){
+  if (s->nr == s->cap){
+    s->cap = s->cap ? s->cap * 2 : 16;
+    s->blk = realloc(s->blk, s->cap * sizeof(char *));
+  }
+  s->blk[s->nr++] = text;
+}
+
+static int cmp_blk(const void *a, const void *b){
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*split_streams - cut an output into blocks and sort them into streams
+ *@out: output text, modified
+ *@st: streams
+ *
+ * A "=====" banner belongs to the block of the line after it, page
+ * tables and dumps to the last memory operation. The contents of a
+ * dump are those of every process, only its place is kept. Lines of no
+ * process have no order of their own and are sorted.
+ */
+static int split_streams(char *out, struct stream *st){
+  int nst = 0, i;
+  struct stream *cur = NULL;
+  char *line, *save = NULL, *pending = NULL;
+  char key[32];
+
+  for (line = strtok_r(out, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)){
+    if (strncmp(line, "Time slot", 9) == 0)
+      continue;
+    mask_line(line);
+
+    if (strncmp(line, "=====", 5) == 0 && strstr(line, "AFTER") != NULL){
+      pending = line;
+      continue;
+    }
+    if (line_key(line, key) == NULL){
+      char *blk;
+      size_t len;
+
+      if (cur == NULL || strncmp(line, "BYTE ", 5) == 0 ||
+          strcmp(line, "Empty physical memory") == 0 || strcmp(line, "No change in physical memory") == 0)
+        continue;
+      if (is_pte(line))
+        mask_pte(line);
+      blk = cur->blk[cur->nr - 1];
+      len = strlen(blk);
+      blk = realloc(blk, len + strlen(line) + 2);
+      sprintf(blk + len, "\n%s", line);
+      cur->blk[cur->nr - 1] = blk;
+      continue;
+    }
+
+    if (pending != NULL){
+      char *blk = malloc(strlen(pending) + strlen(line) + 2);
+
+      sprintf(blk, "%s\n%s", pending, line);
+      stream_add(stream_get(st, &nst, key), blk);
+      pending = NULL;
+    } else {
+      stream_add(stream_get(st, &nst, key), strdup(line));
+    }
+    if (strstr(line, "PID=") != NULL)
+      cur = stream_get(st, &nst, key);
+  }
+
+  for (i = 0; i < nst; i++)
+    if (strncmp(st[i].key, "pid ", 4) != 0)
+      qsort(st[i].blk, st[i].nr, sizeof(char *), cmp_blk);
+  return nst;
+}
+
+static void free_streams(struct stream *st, int nst){
+  for (int i = 0; i < nst; i++){
+    for (int j = 0; j < st[i].nr; j++)
+      free(st[i].blk[j]);
+    free(st[i].blk);
+  }
+}
+
+/*report_diff - print the first line two blocks differ in
+ *@want: expected block
+ *@got: block of this run
+ *
+ */
+static void report_diff(const char *want, const char *got){
+  size_t i = 0, line = 0;
+
+  while (want[i] != '\0' && want[i] == got[i]){
+    if (want[i] == '\n')
+      line = i + 1;
+    i++;
+  }
+  if (line > 0)
+    printf("    in:       %.*s\n", (int)strcspn(want, "\n"), want);
+  printf("    expected: %.*s\n", (int)strcspn(want + line, "\n"), want + line);
+  printf("    got:      %.*s\n", (int)strcspn(got + line, "\n"), got + line);
+}
+
+/*compare_output - compare two outputs stream by stream
+ *@cfg: config name for the report
+ *@got: output of this run
+ *@want: golden output
+ *@quiet: do not print the differences
+ *@tail: got is a run restored from a snapshot, its process streams are
+ *       compared with the end of the golden ones and the others not
+ *
+ * Return the number of streams that differ, the first difference of
+ * each is printed.
+ */
+static int compare_output(const char *cfg, char *got, char *want, int quiet, int tail){
+  static struct stream sg[MAX_STREAMS], sw[MAX_STREAMS];
+  int ng = split_streams(got, sg);
+  int nw = split_streams(want, sw);
+  int i, j, bad = 0;
+
+  for (i = 0; i < nw; i++){
+    struct stream *w = &sw[i], *g = NULL;
+    int skip = 0;
+
+    for (j = 0; j < ng; j++)
+      if (strcmp(sg[j].key, w->key) == 0)
+        g = &sg[j];
+    if (tail && (g == NULL || strncmp(w->key, "pid ", 4) != 0))
+      continue;
+    if (tail && g->nr <= w->nr)
+      skip = w->nr - g->nr;
+    for (j = 0; g != NULL && j + skip < w->nr && j < g->nr; j++)
+      if (strcmp(w->blk[j + skip], g->blk[j]) != 0)
+        break;
+    if (g != NULL && j + skip == w->nr && j == g->nr)
+      continue;
+
+    bad++;
+    if (quiet)
+      continue;
+    printf("  %s: %s differs at block %d\n", cfg, w->key, j + 1);
+    report_diff(j + skip < w->nr ? w->blk[j + skip] : "(end of stream)", g != NULL && j < g->nr ? g->blk[j] : "(end of stream)");
+  }
+  for (i = 0; i < ng; i++){
+    for (j = 0; j < nw; j++)
+      if (strcmp(sg[i].key, sw[j].key) == 0)
+        break;
+    if (j == nw && !quiet)
+      printf("  %s: unexpected stream %s: %s\n", cfg, sg[i].key, sg[i].blk[0]);
+    if (j == nw)
+      bad++;
+  }
+
+  free_streams(sg, ng);
+  free_streams(sw, nw);
+  return bad;
+}
+
+/*run_config - run the simulator on a config
+ *@os: simulator binary
+ *@cfg: config name
+ *@outpath: file taking the output
+ *@res: wall time, peak RSS and slots
+ *
+ */
+static int run_config(const char *os, const char *cfg, const char *outpath, struct result *res){
+  struct timespec t0, t1;
+  struct rusage ru;
+  int status;
+  pid_t pid;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  pid = fork();
+  if (pid == 0){
+    int fd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    setenv("OS_TRACE_LEVEL", REGRESS_TRACE_LEVEL, 0);
+    execl(os, os, cfg, (char *)NULL);
+    _exit(127);
+  }
+  if (pid < 0 || wait4(pid, &status, 0, &ru) < 0)
+    return -1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  res->wall_ms = (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+  res->rss_kb = ru.ru_maxrss;
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+/*run_restored - run a config restored from a snapshot of itself
+ *@os: simulator binary
+ *@cfg: config name
+ *@dir: directory for the snapshot file
+ *@slot: slot of the snapshot
+ *@outpath: file taking the output of the restored run
+ *@res: wall time, peak RSS and slots of the restored run
+ *
+ * Return 1 when the run ends before the slot and there is nothing to
+ * restore.
+ */
+static int run_restored(const char *os, const char *cfg, const char *dir, const char *slot,
+                        const char *outpath, struct result *res){
+  char snap[512];
+  int ret;
+
+  snprintf(snap, sizeof(snap), "%s/%s.snap", dir, cfg);
+  unlink(snap);
+  setenv("OS_SNAPSHOT", snap, 1);
+  setenv("OS_SNAPSHOT_AT", slot, 1);
+  ret = run_config(os, cfg, outpath, res);
+  unsetenv("OS_SNAPSHOT");
+  unsetenv("OS_SNAPSHOT_AT");
+  if (ret == 0 && access(snap, R_OK) < 0)
+    return 1;
+  if (ret == 0){
+    setenv("OS_RESTORE", snap, 1);
+    ret = run_config(os, cfg, outpath, res);
+    unsetenv("OS_RESTORE");
+  }
+  unlink(snap);
+  return ret;
+}
+
+static int load_baseline(const char *path, const char *cfg, struct result *res){
+  FILE *fp = fopen(path, "r");
+  char line[256], name[128];
+  int found = 0;
+
+  if (fp == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), fp) != NULL){
+    if (sscanf(line, "%127[^,],%lf,%ld,%ld", name, &res->wall_ms, &res->rss_kb, &res->slots) == 4 &&
+        strcmp(name, cfg) == 0){
+      found = 1;
+      break;
+    }
+  }
+  fclose(fp);
+  return found ? 0 : -1;
+}
+
+int main(int argc, char *argv[]){
+  const char *os, *dir, *snap_at = NULL;
+  char golden[512], outpath[512], basepath[512];
+  int update = 0, tolerance = 25, failed = 0, slow = 0, nr, i, r;
+  struct result *res;
+  int *crashed;
+  FILE *base = NULL;
+
+  while (argc > 1 && argv[1][0] == '-'){
+    if (strcmp(argv[1], "-u") == 0){
+      update = 1;
+    } else if (strcmp(argv[1], "-t") == 0 && argc > 2){
+      tolerance = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else if (strcmp(argv[1], "-s") == 0 && argc > 2){
+      snap_at = argv[2];
+      argc--;
+      argv++;
+    } else {
+      break;
+    }
+    argc--;
+    argv++;
+  }
+  if (argc < 4 || (update && snap_at != NULL)){
+    printf("Usage: regress-run [-u] [-t tolerance%%] [-s slot] <os binary> <golden dir> <config ...>\n");
+    return 2;
+  }
+  os = argv[1];
+  dir = argv[2];
+  argv += 3;
+  nr = argc - 3;
+
+  /* Run everything before reading any output: the child inherits the
+   * peak RSS of this process across fork and exec, keep it small.
+   */
+  res = calloc(nr, sizeof(struct result));
+  crashed = calloc(nr, sizeof(int));
+  for (i = 0; i < nr; i++){
+    snprintf(outpath, sizeof(outpath), "%s/%s.run", dir, argv[i]);
+    if (snap_at != NULL){
+      /* 2: the config ended before the snapshot slot */
+      r = run_restored(os, argv[i], dir, snap_at, outpath, &res[i]);
+      crashed[i] = r < 0 ? 1 : 2 * r;
+      continue;
+    }
+    for (r = 0; r < REGRESS_REPEAT && !crashed[i]; r++){
+      struct result one;
+
+      if (run_config(os, argv[i], outpath, &one) < 0)
+        crashed[i] = 1;
+      else if (r == 0 || one.wall_ms < res[i].wall_ms)
+        res[i] = one;
+    }
+  }
+
+  snprintf(basepath, sizeof(basepath), "%s/baseline.csv", dir);
+  if (update){
+    base = fopen(basepath, "w");
+    if (base == NULL){
+      printf("Cannot write %s\n", basepath);
+      return 2;
+    }
+    fprintf(base, "config,wall_ms,peak_rss_kb,slots\n");
+  }
+
+  printf("%-28s %6s %10s %10s %8s %12s\n", "config", "result", "wall ms", "rss KB", "slots", "slots/s");
+  for (i = 0; i < nr; i++){
+    const char *cfg = argv[i];
+    struct result ref, again;
+    char *got, *want;
+    const char *verdict = "ok";
+    int diff;
+
+    snprintf(golden, sizeof(golden), "%s/%s.output", dir, cfg);
+    snprintf(outpath, sizeof(outpath), "%s/%s.run", dir, cfg);
+
+    if (crashed[i] == 2){
+      printf("%-28s %6s\n", cfg, "SHORT");
+      unlink(outpath);
+      continue;
+    }
+    if (crashed[i]){
+      printf("%-28s %6s\n", cfg, "CRASH");
+      failed++;
+      continue;
+    }
+    got = read_file(outpath);
+    res[i].slots = 0;
+    for (char *p = got; p != NULL && (p = strstr(p, "Time slot")) != NULL; p++)
+      res[i].slots++;
+
+    if (update){
+      rename(outpath, golden);
+      fprintf(base, "%s,%.1f,%ld,%ld\n", cfg, res[i].wall_ms, res[i].rss_kb, res[i].slots);
+      verdict = "saved";
+    } else if ((want = read_file(golden)) == NULL){
+      verdict = "NOGOLD";
+      failed++;
+    } else {
+      /* A difference has to show up in every run before it counts, the
+       * daemons still race with the processes now and then
+       */
+      for (r = 0; ; r++){
+        diff = compare_output(cfg, got, want, r < REGRESS_REPEAT - 1, snap_at != NULL);
+        free(want);
+        free(got);
+        got = NULL;
+        if (diff == 0 || r == REGRESS_REPEAT - 1)
+          break;
+        if ((snap_at != NULL ? run_restored(os, cfg, dir, snap_at, outpath, &again)
+                             : run_config(os, cfg, outpath, &again)) < 0)
+          break;
+        got = read_file(outpath);
+        want = read_file(golden);
+      }
+      if (diff > 0){
+        verdict = "DIFF";
+        failed++;
+      } else {
+        unlink(outpath);
+      }
+
+      if (snap_at == NULL && load_baseline(basepath, cfg, &ref) == 0){
+        if (res[i].wall_ms > ref.wall_ms * (100 + tolerance) / 100 && res[i].wall_ms - ref.wall_ms > TIME_SLACK_MS){
+          printf("  %s: wall time %.1f ms against %.1f ms in the baseline\n", cfg, res[i].wall_ms, ref.wall_ms);
+          slow++;
+          if (diff == 0)
+            verdict = "SLOW";
+        }
+        if (res[i].rss_kb > ref.rss_kb * (100 + RSS_TOLERANCE) / 100){
+          printf("  %s: peak RSS %ld KB against %ld KB in the baseline\n", cfg, res[i].rss_kb, ref.rss_kb);
+          slow++;
+          if (diff == 0)
+            verdict = "SLOW";
+        }
+      }
+    }
+    free(got);
+
+    printf("%-28s %6s %10.1f %10ld %8ld %12.0f\n", cfg, verdict, res[i].wall_ms, res[i].rss_kb, res[i].slots,
+           res[i].wall_ms > 0 ? res[i].slots * 1000.0 / res[i].wall_ms : 0.0);
+  }
+
+  if (base != NULL)
+    fclose(base);
+  if (!update)
+    printf("%d of %d configs differ, %d perf regressions\n", failed, nr, slow);
+  free(res);
+  free(crashed);
+  return (failed || slow) ? 1 : 0;
+}
@@ -180,45 +180,93 @@
 // #endif
 #include "../include/queue.h" //fix the include from original file: "queue.h" and "sched.h"
 #include "../include/sched.h"
+#include "../include/timer.h"
+#include "../include/sim.h"
 #include <pthread.h>
 
 #include <stdlib.h>
 #include <stdio.h>
-static struct queue_t ready_queue; // static queue is initialized to 0 for variables and NULL for pointers
-static struct queue_t run_queue;
-static pthread_mutex_t queue_lock;
 
-static struct queue_t running_list;
 #ifdef MLQ_SCHED
-static struct queue_t mlq_ready_queue[MAX_PRIO];
-static int slot[MAX_PRIO];
+#define LIVE_IDX(prio) (prio)
+#else
+#define LIVE_IDX(prio) 0
 #endif
 
-int queue_empty(void)
+/* Live processes by slot, what killall walks; under queue_lock */
+static void proc_list_add(struct sim_ctx *ctx, struct pcb_t *proc)
+{
+	int i;
+
+	for (i = 0; i < MAX_PROC; i++) {
+		if (ctx->proc_list[i] == NULL) {
+			ctx->proc_list[i] = proc;
+			return;
+		}
+	}
+}
+
+static void proc_list_del(struct sim_ctx *ctx, struct pcb_t *proc)
+{
+	int i;
+
+	for (i = 0; i < MAX_PROC; i++) {
+		if (ctx->proc_list[i] == proc) {
+			ctx->proc_list[i] = NULL;
+			return;
+		}
+	}
+}
+
+/* Move every blocked process whose slot has come back to the run queue */
+static void wake_blocked(struct sim_ctx *ctx)
+{
+	pthread_mutex_lock(&ctx->blocked_lock);
+	for (int i = 0; i < ctx->nr_blocked; i++)
+	{
+		struct pcb_t *proc = ctx->blocked_list[i];
+		if (current_time(ctx) < proc->wake_time)
+			continue;
+		ctx->blocked_list[i--] = ctx->blocked_list[--ctx->nr_blocked];
+		put_proc(proc);
+	}
+	pthread_mutex_unlock(&ctx->blocked_lock);
+}
+
+int queue_empty(struct sim_ctx *ctx)
 {
 #ifdef MLQ_SCHED
 	unsigned long prio;
 	for (prio = 0; prio < MAX_PRIO; prio++)
-		if (!empty(&mlq_ready_queue[prio]))
+		if (!empty(&ctx->mlq_ready_queue[prio]))
 			return -1;
 #endif
-	return (empty(&ready_queue) && empty(&run_queue));
+	return (empty(&ctx->ready_queue) && empty(&ctx->run_queue));
 }
 
-void init_scheduler(void)
+void init_scheduler(struct sim_ctx *ctx)
 {
 #ifdef MLQ_SCHED
 	int i;
 
 	for (i = 0; i < MAX_PRIO; i++)
 	{
-		mlq_ready_queue[i].size = 0;
-		slot[i] = MAX_PRIO - i;
+		ctx->mlq_ready_queue[i].size = 0;
+		ctx->slot[i] = MAX_PRIO - i;
 	}
 #endif
-	ready_queue.size = 0;
-	run_queue.size = 0;
-	pthread_mutex_init(&queue_lock, NULL);
+	ctx->ready_queue.size = 0;
+	ctx->run_queue.size = 0;
+	pthread_mutex_init(&ctx->queue_lock, NULL);
+}
+
+void finish_scheduler(struct sim_ctx *ctx)
+{
+	free(ctx->blocked_list);
+	ctx->blocked_list = NULL;
+	ctx->nr_blocked = 0;
+	ctx->blocked_cap = 0;
+	pthread_mutex_destroy(&ctx->queue_lock);
 }
 
 #ifdef MLQ_SCHED
@@ -228,7 +276,7 @@ void init_scheduler(void)
  *  We implement stateful here using transition technique
  *  State representation   prio = 0 .. MAX_PRIO, curr_slot = 0..(MAX_PRIO - prio)
  */
-struct pcb_t *get_mlq_proc(void)
+struct pcb_t *get_mlq_proc(struct sim_ctx *ctx)
 {
 	//This implementation with slot makes the process with lower priority to have a chance to run first.
 	// it should not be that case, so we need to change the implementation
@@ -236,25 +284,30 @@ struct pcb_t *get_mlq_proc(void)
 	/*TODO: get a process from PRIORITY [ready_queue].
 	 * Remember to use lock to protect the queue.
 	 * */
-	pthread_mutex_lock(&queue_lock);
-	for (int i = 0; i < MAX_PRIO; i++)
+	pthread_mutex_lock(&ctx->queue_lock);
+	/* A queue that used up its slots is refilled and skipped once, the
+	 * second pass picks it again when no lower queue has work */
+	for (int pass = 0; pass < 2 && proc == NULL; pass++)
 	{
-		if (!empty(&mlq_ready_queue[i]))
+		for (int i = 0; i < MAX_PRIO; i++)
 		{
-			if(slot[i] <= 0)
+			if (!empty(&ctx->mlq_ready_queue[i]))
 			{
-				slot[i] = MAX_PRIO - i;
-        continue;
+				if(ctx->slot[i] <= 0)
+				{
+					ctx->slot[i] = MAX_PRIO - i;
+					continue;
+				}
+				proc = dequeue(&ctx->mlq_ready_queue[i]);
+				ctx->slot[i]--;
+				break;
 			}
-			proc = dequeue(&mlq_ready_queue[i]);
-			slot[i]--;
-			break;
 		}
 	}
-	pthread_mutex_unlock(&queue_lock);
+	pthread_mutex_unlock(&ctx->queue_lock);
 	return proc;
 	// struct pcb_t *proc = NULL;
-    // pthread_mutex_lock(&queue_lock);
+    // pthread_mutex_lock(&ctx->queue_lock);
     // for (int i = 0; i < MAX_PRIO; i++) // Start from highest priority
     // {
     //     if (!empty(&mlq_ready_queue[i]))
@@ -263,100 +316,165 @@ struct pcb_t *get_mlq_proc(void)
     //         break; // Dispatch the first process found at the highest priority
     //     }
     // }
-    // pthread_mutex_unlock(&queue_lock);
+    // pthread_mutex_unlock(&ctx->queue_lock);
     // return proc;
 }
 
 void put_mlq_proc(struct pcb_t *proc)
 {
-	pthread_mutex_lock(&queue_lock);
+	struct sim_ctx *ctx = proc->ctx;
+
+	pthread_mutex_lock(&ctx->queue_lock);
 	uint32_t prio = proc->prio;
-	enqueue(&mlq_ready_queue[prio], proc);
-	pthread_mutex_unlock(&queue_lock);
+	enqueue(&ctx->mlq_ready_queue[prio], proc);
+	pthread_mutex_unlock(&ctx->queue_lock);
 }
 
 void add_mlq_proc(struct pcb_t *proc)
 {
-	pthread_mutex_lock(&queue_lock);
+	struct sim_ctx *ctx = proc->ctx;
+
+	pthread_mutex_lock(&ctx->queue_lock);
 	uint32_t prio = proc->prio;
-	enqueue(&mlq_ready_queue[prio], proc);
-	pthread_mutex_unlock(&queue_lock);
+	enqueue(&ctx->mlq_ready_queue[prio], proc);
+	pthread_mutex_unlock(&ctx->queue_lock);
 }
 
-struct pcb_t *get_proc(void)
+struct pcb_t *get_proc(struct sim_ctx *ctx)
 {
-	return get_mlq_proc();
+	wake_blocked(ctx);
+	return get_mlq_proc(ctx);
 }
 
 void put_proc(struct pcb_t *proc)
 {
-	proc->ready_queue = &ready_queue;
-	proc->mlq_ready_queue = mlq_ready_queue;
-	proc->running_list = &running_list;
+	struct sim_ctx *ctx = proc->ctx;
+
+	proc->ready_queue = &ctx->ready_queue;
+	proc->mlq_ready_queue = ctx->mlq_ready_queue;
+	proc->running_list = &ctx->running_list;
 
 	/* TODO: put running proc to running_list */
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&running_list, proc);
-	pthread_mutex_unlock(&queue_lock);
+	pthread_mutex_lock(&ctx->queue_lock);
+	enqueue(&ctx->running_list, proc);
+	pthread_mutex_unlock(&ctx->queue_lock);
 
 	return put_mlq_proc(proc);
 }
 
 void add_proc(struct pcb_t *proc)
 {
-	proc->ready_queue = &ready_queue;
-	proc->mlq_ready_queue = mlq_ready_queue;
-	proc->running_list = &running_list;
+	struct sim_ctx *ctx = proc->ctx;
+
+	proc->ready_queue = &ctx->ready_queue;
+	proc->mlq_ready_queue = ctx->mlq_ready_queue;
+	proc->running_list = &ctx->running_list;
 
 	/* TODO: put running proc to running_list */
 
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&running_list, proc);
-	pthread_mutex_unlock(&queue_lock);
+	pthread_mutex_lock(&ctx->queue_lock);
+	enqueue(&ctx->running_list, proc);
+	ctx->nr_live[LIVE_IDX(proc->prio)]++;
+	proc_list_add(ctx, proc);
+	pthread_mutex_unlock(&ctx->queue_lock);
 
 	return add_mlq_proc(proc);
 }
 #else
-struct pcb_t *get_proc(void)
+struct pcb_t *get_proc(struct sim_ctx *ctx)
 {
 	struct pcb_t *proc = NULL;
 	/*TODO: get a process from [ready_queue].
 	 * Remember to use lock to protect the queue.
 	 * */
 	// implement using round-robin without priority (will check later)
-	pthread_mutex_lock(&queue_lock);
-	if (!empty(&ready_queue))
+	wake_blocked(ctx);
+	pthread_mutex_lock(&ctx->queue_lock);
+	if (!empty(&ctx->ready_queue))
 	{
-		proc = dequeue(&ready_queue);
+		proc = dequeue(&ctx->ready_queue);
 	}
-	pthread_mutex_unlock(&queue_lock);
+	pthread_mutex_unlock(&ctx->queue_lock);
 	return proc;
 }
 
 void put_proc(struct pcb_t *proc)
 {
-	proc->ready_queue = &ready_queue;
-	proc->running_list = &running_list;
+	struct sim_ctx *ctx = proc->ctx;
+
+	proc->ready_queue = &ctx->ready_queue;
+	proc->running_list = &ctx->running_list;
 
 	/* TODO: put running proc to running_list */
 
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&running_list, proc); // Add the process to the running list
-	enqueue(&run_queue, proc);
-	pthread_mutex_unlock(&queue_lock);
+	pthread_mutex_lock(&ctx->queue_lock);
+	enqueue(&ctx->running_list, proc); // Add the process to the running list
+	enqueue(&ctx->run_queue, proc);
+	pthread_mutex_unlock(&ctx->queue_lock);
 }
 
 void add_proc(struct pcb_t *proc)
 {
-	proc->ready_queue = &ready_queue;
-	proc->running_list = &running_list;
+	struct sim_ctx *ctx = proc->ctx;
+
+	proc->ready_queue = &ctx->ready_queue;
+	proc->running_list = &ctx->running_list;
 
 	/* TODO: put running proc to running_list */
 
-	pthread_mutex_lock(&queue_lock);
-	enqueue(&running_list, proc); // Add the process to the running list
-	enqueue(&run_queue, proc);
-	pthread_mutex_unlock(&queue_lock);
+	pthread_mutex_lock(&ctx->queue_lock);
+	enqueue(&ctx->running_list, proc); // Add the process to the running list
+	enqueue(&ctx->run_queue, proc);
+	ctx->nr_live[LIVE_IDX(proc->prio)]++;
+	proc_list_add(ctx, proc);
+	pthread_mutex_unlock(&ctx->queue_lock);
 }
 #endif
 
+
+void finish_proc(struct pcb_t *proc)
+{
+	struct sim_ctx *ctx = proc->ctx;
+
+	/* running_list still points to the process, drop it before free */
+	pthread_mutex_lock(&ctx->queue_lock);
+	purge(&ctx->running_list, proc);
+	ctx->nr_live[LIVE_IDX(proc->prio)]--;
+	proc_list_del(ctx, proc);
+	pthread_mutex_unlock(&ctx->queue_lock);
+}
+
+int sched_full(struct sim_ctx *ctx, uint32_t prio)
+{
+	int full;
+
+	pthread_mutex_lock(&ctx->queue_lock);
+	full = (ctx->nr_live[LIVE_IDX(prio)] >= MAX_QUEUE_SIZE);
+	pthread_mutex_unlock(&ctx->queue_lock);
+	return full;
+}
+
+void block_proc(struct pcb_t *proc, uint64_t wake_time)
+{
+	struct sim_ctx *ctx = proc->ctx;
+
+	pthread_mutex_lock(&ctx->blocked_lock);
+	if (ctx->nr_blocked == ctx->blocked_cap)
+	{
+		ctx->blocked_cap = (ctx->blocked_cap > 0) ? ctx->blocked_cap * 2 : 8;
+		ctx->blocked_list = realloc(ctx->blocked_list, ctx->blocked_cap * sizeof(*ctx->blocked_list));
+	}
+	proc->wake_time = wake_time;
+	ctx->blocked_list[ctx->nr_blocked++] = proc;
+	pthread_mutex_unlock(&ctx->blocked_lock);
+}
+
+int blocked_procs(struct sim_ctx *ctx)
+{
+	int nr;
+
+	pthread_mutex_lock(&ctx->blocked_lock);
+	nr = ctx->nr_blocked;
+	pthread_mutex_unlock(&ctx->blocked_lock);
+	return nr;
+}
@@ -0,0 +1,624 @@
+#include "sim.h"
+#include "cpu.h"
+#include "timer.h"
+#include "sched.h"
+#include "loader.h"
+#include "mm.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef MM_PAGING
+struct mmpaging_ld_args {
+	/* A dispatched argument struct to compact many-fields passing to loader */
+	int vmemsz;
+	struct memphy_struct *mram;
+	struct memphy_struct **mswp;
+	struct memphy_struct *active_mswp;
+	int active_mswp_id;
+	struct timer_id_t  *timer_id;
+	struct sim_ctx *ctx;
+};
+#endif
+
+struct cpu_args {
+	struct timer_id_t * timer_id;
+	int id;
+	struct sim_ctx * ctx;
+};
+
+#if defined(MM_PAGING) && (defined(KSWAPD) || defined(KSM))
+struct mmd_args {
+	struct timer_id_t * timer_id;
+	struct memphy_struct * mram;
+	struct sim_ctx * ctx;
+};
+
+static int mmd_should_stop(struct sim_ctx * ctx) {
+	int stop;
+
+	pthread_mutex_lock(&ctx->mmd_lock);
+	stop = (ctx->mmd_cpus == 0);
+	pthread_mutex_unlock(&ctx->mmd_lock);
+	return stop;
+}
+#endif
+
+#if defined(MM_PAGING) && defined(KSWAPD)
+static void * kswapd_routine(void * args) {
+	struct timer_id_t * timer_id = ((struct mmd_args *)args)->timer_id;
+	struct memphy_struct * mram = ((struct mmd_args *)args)->mram;
+	struct sim_ctx * ctx = ((struct mmd_args *)args)->ctx;
+
+	while (!mmd_should_stop(ctx)) {
+		/* Keep MEMRAM between the watermarks, faults then find a
+		 * free frame without swapping out inline */
+		kswapd_balance(ctx, mram);
+#ifdef COMPACT_PROACTIVE
+		compact_proactive(ctx, mram);
+#endif
+		next_slot(timer_id);
+	}
+	detach_event(timer_id);
+	pthread_exit(NULL);
+}
+#endif
+
+#if defined(MM_PAGING) && defined(KSM)
+static void * ksmd_routine(void * args) {
+	struct timer_id_t * timer_id = ((struct mmd_args *)args)->timer_id;
+	struct memphy_struct * mram = ((struct mmd_args *)args)->mram;
+	struct sim_ctx * ctx = ((struct mmd_args *)args)->ctx;
+
+	while (!mmd_should_stop(ctx)) {
+		/* Merge a slice of the resident pages every slot */
+		ksm_scan(ctx, mram, KSM_PAGES_TO_SCAN);
+		next_slot(timer_id);
+	}
+	detach_event(timer_id);
+	pthread_exit(NULL);
+}
+#endif
+
+
+
+
+static void * cpu_routine(void * args) {
+	struct timer_id_t * timer_id = ((struct cpu_args*)args)->timer_id;
+	int id = ((struct cpu_args*)args)->id;
+	struct sim_ctx * ctx = ((struct cpu_args*)args)->ctx;
+	/* Kept in the context between slots, a snapshot sees it there */
+	struct sim_cpu * cpu = &ctx->cpu[id];
+	struct pcb_t * proc;
+	while (1) {
+		/* Check for new process in ready queue */
+		proc = cpu->proc;
+		/* Check the status of current process */
+		if (proc == NULL) {
+			/* No process is running, the we load new process from
+		 	* ready queue */
+			proc = get_proc(ctx);
+			/* First load failed, the recheck below skips the slot
+			 * or stops the CPU once the loader is done */
+		}else if (proc->pc >= proc->code->size) {
+			/* The porcess has finish it job, or killall moved its pc
+			 * to the end, past it if the process ran meanwhile */
+			trace_ev(TR_FINISH, TRACE_INFO, id, proc->pid);
+			cpu->finished++;
+#ifdef MM_PAGING
+			cpu->minflt += proc->mm->minflt;
+			cpu->majflt += proc->mm->majflt;
+#endif
+#if defined(MM_PAGING) && defined(MMSTAT)
+			trace_msg(TRACE_INFO, "\tCPU %d: Process %2d page faults: minor %u, major %u, cow %u\n",
+				id, proc->pid, proc->mm->minflt, proc->mm->majflt, proc->mm->cowflt);
+			struct vm_freerg_stat frstat;
+			vm_freerg_stat(get_vma_by_num(proc->mm, 0), &frstat);
+			trace_msg(TRACE_INFO, "\tCPU %d: Process %2d heap: %d free regions, %lu free bytes, largest %lu, fragmentation %d%%\n",
+				id, proc->pid, frstat.nr_regions, frstat.total, frstat.largest, frstat.frag_pct);
+			int rss_private, rss_shared;
+			vm_rss_stat(proc->mm, &rss_private, &rss_shared);
+			trace_msg(TRACE_INFO, "\tCPU %d: Process %2d rss: private %d pages, shared %d pages\n",
+				id, proc->pid, rss_private, rss_shared);
+#ifdef HUGEPAGE_ORDER
+			trace_msg(TRACE_INFO, "\tCPU %d: Process %2d huge pages: %u faulted, %u split\n",
+				id, proc->pid, proc->mm->thpflt, proc->mm->thpsplit);
+#endif
+#ifdef TLB_ENTRIES
+			trace_msg(TRACE_INFO, "\tCPU %d: Process %2d tlb: %u hits, %u misses\n",
+				id, proc->pid, proc->mm->tlb_hit, proc->mm->tlb_miss);
+#endif
+#endif
+#ifdef MM_PAGING
+			free_pcb_memph(proc);
+			free_mm(proc->mm);
+#endif
+/////////////////////START//////////////////////
+			finish_proc(proc);
+			free(proc->page_table);
+			free_code(ctx, proc->code);
+//////////////////////END///////////////////////
+			free(proc);
+			proc = get_proc(ctx);
+			cpu->time_left = 0;
+		}else if (cpu->time_left == 0) {
+			/* The process has done its job in current time slot */
+			trace_ev(TR_PUT, TRACE_INFO, id, proc->pid);
+			put_proc(proc);
+			proc = get_proc(ctx);
+		}
+
+		/* Recheck process status after loading new process */
+		if (proc == NULL && ctx->done && blocked_procs(ctx) == 0) {
+			/* No process to run, exit */
+#ifdef MMSTAT
+			trace_msg(TRACE_INFO, "\tCPU %d: %lu busy slots, %lu idle slots, %lu stalled on page faults\n",
+				id, cpu->busy, cpu->idle, cpu->stalled);
+#endif
+			trace_ev(TR_STOP, TRACE_INFO, id);
+			pthread_mutex_lock(&ctx->stat_lock);
+			ctx->stat.busy += cpu->busy;
+			ctx->stat.idle += cpu->idle;
+			ctx->stat.stalled += cpu->stalled;
+			ctx->stat.finished += cpu->finished;
+			ctx->stat.minflt += cpu->minflt;
+			ctx->stat.majflt += cpu->majflt;
+			pthread_mutex_unlock(&ctx->stat_lock);
+			cpu->proc = NULL;
+			cpu->stopped = 1;
+#if defined(MM_PAGING) && (defined(KSWAPD) || defined(KSM))
+			pthread_mutex_lock(&ctx->mmd_lock);
+			ctx->mmd_cpus--;
+			pthread_mutex_unlock(&ctx->mmd_lock);
+#endif
+			break;
+		}else if (proc == NULL) {
+			/* There may be new processes to run in
+			 * next time slots, just skip current slot */
+			cpu->proc = NULL;
+			cpu->idle++;
+			next_slot(timer_id);
+			continue;
+		}else if (cpu->time_left == 0) {
+			trace_ev(TR_DISPATCH, TRACE_INFO, id, proc->pid);
+			cpu->time_left = ctx->time_slot;
+		}
+		cpu->proc = proc;
+
+		/* Run current process */
+#if defined(MM_PAGING) && defined(MEMSWP_LATENCY)
+		if (run(proc) == PAGING_FAULT_WAIT) {
+			/* The faulting instruction runs again after the swap-in,
+			 * meanwhile the CPU is free for another process */
+			proc->pc--;
+			trace_ev(TR_BLOCK, TRACE_INFO, id, proc->pid, proc->mm->pf_ready);
+			block_proc(proc, proc->mm->pf_ready);
+			cpu->stalled++;
+			cpu->proc = NULL;
+			cpu->time_left = 0;
+			next_slot(timer_id);
+			continue;
+		}
+#else
+		run(proc);
+#endif
+		cpu->busy++;
+		cpu->time_left--;
+		next_slot(timer_id);
+	}
+	detach_event(timer_id);
+	pthread_exit(NULL);
+}
+
+
+
+
+/* Next process to admit, those of the config first, then the records
+ * "start_time path prio" of the submission stream until its EOF. With
+ * no record at hand the loader blocks on the stream and holds the
+ * timer, so a run depends on the records and not on when they come.
+ * Return 0 when there is none left.
+ */
+static int next_submission(struct sim_ctx * ctx, int i, unsigned long * start_time, char * path, size_t len, unsigned long * prio) {
+	char line[256], name[100];
+
+	if (i < ctx->num_processes) {
+		*start_time = ctx->ld_processes.start_time[i];
+		snprintf(path, len, "%s", ctx->ld_processes.path[i]);
+		free(ctx->ld_processes.path[i]);
+#ifdef MLQ_SCHED
+		*prio = ctx->ld_processes.prio[i];
+#endif
+		return 1;
+	}
+	while (ctx->submit_fp != NULL && fgets(line, sizeof(line), ctx->submit_fp) != NULL) {
+		if (strspn(line, " \t\r\n") == strlen(line)) {
+			continue;
+		}
+		if (sscanf(line, "%lu %99s %lu", start_time, name, prio) != 3 || *prio >= MAX_PRIO) {
+			trace_msg(TRACE_INFO, "\tBad submission skipped: %s", line);
+			continue;
+		}
+		if (snprintf(path, len, "input/proc/%s", name) >= (int)len) {
+			trace_msg(TRACE_INFO, "\tProcess name too long, skipped: %s", line);
+			continue;
+		}
+		if (access(path, R_OK) != 0) {
+			trace_msg(TRACE_INFO, "\tCannot find process description at '%s', skipped\n", path);
+			continue;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+static void * ld_routine(void * args){
+#ifdef MM_PAGING
+	struct memphy_struct* mram = ((struct mmpaging_ld_args *)args)->mram;
+	struct memphy_struct** mswp = ((struct mmpaging_ld_args *)args)->mswp;
+	struct memphy_struct* active_mswp = ((struct mmpaging_ld_args *)args)->active_mswp;
+	struct timer_id_t * timer_id = ((struct mmpaging_ld_args *)args)->timer_id;
+	struct sim_ctx * ctx = ((struct mmpaging_ld_args *)args)->ctx;
+#else
+	struct timer_id_t * timer_id = ((struct cpu_args *)args)->timer_id;
+	struct sim_ctx * ctx = ((struct cpu_args *)args)->ctx;
+#endif
+	struct pcb_t * proc;
+	trace_msg(TRACE_INFO, "ld_routine\n");
+
+	/* Every wait ends the iteration, between slots the loader state
+	 * is all in the context */
+	while (1) {
+		if (ctx->ld_proc == NULL) {
+			ctx->ld_prio = 0;
+			if (!next_submission(ctx, ctx->ld_next, &ctx->ld_start, ctx->ld_path, sizeof(ctx->ld_path), &ctx->ld_prio)) {
+				break;
+			}
+			ctx->ld_proc = load(ctx, ctx->ld_path);
+			if (ctx->ld_proc == NULL) {
+				/* Skipped as a submission that cannot be found */
+				ctx->ld_next++;
+				continue;
+			}
+#ifdef MLQ_SCHED
+			ctx->ld_proc->prio = ctx->ld_prio;
+#endif
+			ctx->ld_held = 0;
+		}
+		proc = ctx->ld_proc;
+		if (current_time(ctx) < ctx->ld_start) {
+			next_slot(timer_id);
+			continue;
+		}
+		/* Backpressure: wait for a process of the same priority to
+		 * finish, the stream is not read meanwhile and its writer
+		 * blocks once the pipe is full */
+		if (sched_full(ctx, ctx->ld_prio)) {
+			if (!ctx->ld_held) {
+				trace_msg(TRACE_DEBUG, "\tAdmission of %s held back, priority %lu full\n", ctx->ld_path, ctx->ld_prio);
+			}
+			ctx->ld_held = 1;
+			next_slot(timer_id);
+			continue;
+		}
+#ifdef MM_PAGING
+		proc->mm = malloc(sizeof(struct mm_struct));
+		init_mm(proc->mm, proc);
+		proc->mram = mram;
+		proc->mswp = mswp;
+		proc->active_mswp = active_mswp;
+		enlist_mm_proc(proc);
+#endif
+		if (trace_on(TRACE_INFO)) {
+			int64_t targs[TRACE_NARGS] = { proc->pid, ctx->ld_prio };
+			trace_emit(TR_LOAD, TRACE_INFO, targs, ctx->ld_path, strlen(ctx->ld_path));
+		}
+		add_proc(proc);
+		ctx->ld_proc = NULL;
+		ctx->ld_next++;
+		next_slot(timer_id);
+	}
+	// clean up
+	free(ctx->ld_processes.path);
+	free(ctx->ld_processes.start_time);
+#ifdef MLQ_SCHED
+	free(ctx->ld_processes.prio);
+#endif
+	memset(&ctx->ld_processes, 0, sizeof(ctx->ld_processes));
+	if (ctx->submit_fp != NULL && ctx->submit_fp != stdin) {
+		fclose(ctx->submit_fp);
+	}
+	ctx->submit_fp = NULL;
+	ctx->done = 1;
+	detach_event(timer_id);
+	pthread_exit(NULL);
+}
+
+
+
+
+struct sim_ctx * sim_create(void) {
+	struct sim_ctx * ctx = calloc(1, sizeof(struct sim_ctx));
+
+	if (ctx == NULL) {
+		return NULL;
+	}
+	ctx->avail_pid = 1;
+	pthread_mutex_init(&ctx->pid_lock, NULL);
+	pthread_mutex_init(&ctx->blocked_lock, NULL);
+	pthread_mutex_init(&ctx->mmd_lock, NULL);
+	pthread_mutex_init(&ctx->stat_lock, NULL);
+#ifdef MM_PAGING
+	/* Devices not set up yet free as empty ones */
+	ctx->mram.fd = -1;
+	for (int i = 0; i < PAGING_MAX_MMSWP; i++) {
+		ctx->mswp[i].fd = -1;
+	}
+	pthread_mutex_init(&ctx->mmvm_lock, NULL);
+	ctx->compact_floor = -1;
+#ifdef ZSWAP
+	ctx->zswap_freeid = ctx->zswap_head = ctx->zswap_tail = -1;
+#endif
+#endif
+	return ctx;
+}
+
+int sim_config(struct sim_ctx * ctx, const char * path) {
+	FILE * file;
+	if ((file = fopen(path, "r")) == NULL) {
+		printf("Cannot find configure file at %s\n", path);
+		return -1;
+	}
+	fscanf(file, "%d %d %d\n", &ctx->time_slot, &ctx->num_cpus, &ctx->num_processes);
+	// printf("Time slot: %d, Number of CPUs: %d, Number of Processes: %d\n", time_slot, num_cpus, num_processes);
+	// /* Allocate memory for process list */
+	ctx->ld_processes.path = (char**)malloc(sizeof(char*) * ctx->num_processes);
+	ctx->ld_processes.start_time = (unsigned long*)malloc(sizeof(unsigned long) * ctx->num_processes);
+#ifdef MM_PAGING
+	int sit;
+#ifdef MM_FIXED_MEMSZ
+// We provide here a back compatible with legacy OS simulatiom config file. In which, it have no addition config line for Mema, keep only one line for legacy info
+// [time slice] [N = Number of CPU] [M = Number of Processes to be run]
+
+        ctx->memramsz = 0x100000;
+        ctx->memswpsz[0] = 0x1000000;
+	for(sit = 1; sit < PAGING_MAX_MMSWP; sit++) ctx->memswpsz[sit] = 0;
+#else
+/////////////////////START//////////////////////
+#ifdef SCHED_TEST
+	long int savePos = ftell(file);
+#endif
+//////////////////////END///////////////////////
+
+	/* Read input config of memory size: MEMRAM and upto 4 MEMSWP (mem swap)
+	 * Format: (size=0 result non-used memswap, must have RAM and at least 1 SWAP)
+	 *        MEM_RAM_SZ MEM_SWP0_SZ MEM_SWP1_SZ MEM_SWP2_SZ MEM_SWP3_SZ
+	*/
+	fscanf(file, "%d\n", &ctx->memramsz);
+	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++) fscanf(file, "%d", &(ctx->memswpsz[sit]));
+	fscanf(file, "\n"); /* Final character */
+#endif
+#endif
+/////////////////////START//////////////////////
+#ifdef SCHED_TEST
+	fseek(file, savePos, SEEK_SET);
+#endif
+//////////////////////END///////////////////////
+#ifdef MLQ_SCHED
+	ctx->ld_processes.prio = (unsigned long*)malloc(sizeof(unsigned long) * ctx->num_processes);
+#endif
+	int i;
+	for (i = 0; i < ctx->num_processes; i++) {
+		ctx->ld_processes.path[i] = (char*)malloc(sizeof(char) * 100);
+		ctx->ld_processes.path[i][0] = '\0';
+		strcat(ctx->ld_processes.path[i], "input/proc/");
+		char proc[100];
+#ifdef MLQ_SCHED
+		fscanf(file, "%lu %s %lu\n", &ctx->ld_processes.start_time[i], proc, &ctx->ld_processes.prio[i]);
+		// printf("%lu %s %lu\n", ld_processes.start_time[i], proc, ld_processes.prio[i]);
+#else
+		fscanf(file, "%lu %s\n", &ctx->ld_processes.start_time[i], proc);
+#endif
+		strcat(ctx->ld_processes.path[i], proc);
+/////////////////////START//////////////////////
+		if (!ctx->quiet) {
+			printf("Process %d: %s\n", i, ctx->ld_processes.path[i]);
+		}
+//////////////////////END///////////////////////
+	}
+	fclose(file);
+	return 0;
+}
+
+int sim_init_devices(struct sim_ctx * ctx) {
+#ifdef MM_PAGING
+	/* Init all MEMPHY include 1 MEMRAM and n of MEMSWP */
+	int rdmflag = 1; /* By default memphy is RANDOM ACCESS MEMORY */
+
+	/* Create MEM RAM */
+	if (init_memphy(&ctx->mram, ctx->memramsz, rdmflag) < 0) {
+		return -1;
+	}
+
+	/* Create all MEM SWAP */
+	int sit;
+#ifdef MEMPHY_SWPFILE
+	char swpfile[100];
+	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++){
+		snprintf(swpfile, sizeof(swpfile), "%s.%d", MEMPHY_SWPFILE, sit);
+		if (init_memphy_file(&ctx->mswp[sit], ctx->memswpsz[sit], rdmflag, swpfile) < 0) {
+			return -1;
+		}
+	}
+#else
+	for(sit = 0; sit < PAGING_MAX_MMSWP; sit++) {
+		if (init_memphy(&ctx->mswp[sit], ctx->memswpsz[sit], rdmflag) < 0) {
+			return -1;
+		}
+	}
+#endif
+#endif
+	return 0;
+}
+
+int sim_run(struct sim_ctx * ctx) {
+	int num_cpus = ctx->num_cpus;
+	pthread_t * cpu = (pthread_t*)malloc(num_cpus * sizeof(pthread_t));
+	struct cpu_args * args = (struct cpu_args*)malloc(sizeof(struct cpu_args) * num_cpus);
+	pthread_t ld;
+	/* A restored run leaves out the CPUs and the loader that had
+	 * already stopped */
+	int loader = !ctx->done;
+
+#ifdef MM_PAGING
+	/* Before any thread starts, nothing to unwind */
+	if (!ctx->restored && sim_init_devices(ctx) < 0) {
+		printf("Cannot set up the memory devices\n");
+		free(cpu);
+		free(args);
+		return -1;
+	}
+#endif
+	if (ctx->cpu == NULL) {
+		ctx->cpu = calloc(num_cpus, sizeof(struct sim_cpu));
+	}
+
+	/* Init timer */
+	int i;
+	for (i = 0; i < num_cpus; i++) {
+		args[i].timer_id = ctx->cpu[i].stopped ? NULL : attach_event(ctx);
+		args[i].id = i;
+		args[i].ctx = ctx;
+	}
+	struct timer_id_t * ld_event = loader ? attach_event(ctx) : NULL;
+#if defined(MM_PAGING) && defined(KSWAPD)
+	pthread_t kswapd;
+	struct mmd_args kswapd_args;
+	kswapd_args.timer_id = attach_event(ctx);
+	kswapd_args.ctx = ctx;
+#endif
+#if defined(MM_PAGING) && defined(KSM)
+	pthread_t ksmd;
+	struct mmd_args ksmd_args;
+	ksmd_args.timer_id = attach_event(ctx);
+	ksmd_args.ctx = ctx;
+#endif
+	start_timer(ctx);
+
+#ifdef MM_PAGING
+	/* In Paging mode, it needs passing the system mem to each PCB through loader*/
+	struct mmpaging_ld_args *mm_ld_args = malloc(sizeof(struct mmpaging_ld_args));
+
+	mm_ld_args->timer_id = ld_event;
+	mm_ld_args->mram = (struct memphy_struct *) &ctx->mram;
+	mm_ld_args->mswp = (struct memphy_struct**) &ctx->mswp;
+	mm_ld_args->active_mswp = (struct memphy_struct *) &ctx->mswp[0];
+	mm_ld_args->active_mswp_id = 0;
+	mm_ld_args->ctx = ctx;
+#else
+	struct cpu_args ld_args = { ld_event, -1, ctx };
+#endif
+	/* Init scheduler, a restored one comes with its queues */
+	if (!ctx->restored) {
+		init_scheduler(ctx);
+	}
+
+	/* Run CPU and loader */
+	if (loader) {
+#ifdef MM_PAGING
+		pthread_create(&ld, NULL, ld_routine, (void*)mm_ld_args);
+#else
+		pthread_create(&ld, NULL, ld_routine, (void*)&ld_args);
+#endif
+	}
+#if defined(MM_PAGING) && (defined(KSWAPD) || defined(KSM))
+	ctx->mmd_cpus = 0;
+	for (i = 0; i < num_cpus; i++) {
+		ctx->mmd_cpus += (args[i].timer_id != NULL);
+	}
+#endif
+	for (i = 0; i < num_cpus; i++) {
+		if (args[i].timer_id != NULL) {
+			pthread_create(&cpu[i], NULL, cpu_routine, (void*)&args[i]);
+		}
+	}
+#if defined(MM_PAGING) && defined(KSWAPD)
+	kswapd_args.mram = &ctx->mram;
+	pthread_create(&kswapd, NULL, kswapd_routine, (void*)&kswapd_args);
+#endif
+#if defined(MM_PAGING) && defined(KSM)
+	ksmd_args.mram = &ctx->mram;
+	pthread_create(&ksmd, NULL, ksmd_routine, (void*)&ksmd_args);
+#endif
+
+	/* Wait for CPU and loader finishing */
+	for (i = 0; i < num_cpus; i++) {
+		if (args[i].timer_id != NULL) {
+			pthread_join(cpu[i], NULL);
+		}
+	}
+	if (loader) {
+		pthread_join(ld, NULL);
+	}
+#if defined(MM_PAGING) && defined(KSWAPD)
+	pthread_join(kswapd, NULL);
+#endif
+#if defined(MM_PAGING) && defined(KSM)
+	pthread_join(ksmd, NULL);
+#endif
+
+	stop_timer(ctx);
+	finish_scheduler(ctx);
+	ctx->stat.slots = current_time(ctx);
+
+	free(cpu);
+	free(args);
+#ifdef MM_PAGING
+	free(mm_ld_args);
+#endif
+	return 0;
+}
+
+void sim_destroy(struct sim_ctx * ctx) {
+	int i;
+
+	if (ctx->ld_processes.path != NULL) {
+		/* Configured but never run */
+		for (i = 0; i < ctx->num_processes; i++) {
+			free(ctx->ld_processes.path[i]);
+		}
+		free(ctx->ld_processes.path);
+		free(ctx->ld_processes.start_time);
+#ifdef MLQ_SCHED
+		free(ctx->ld_processes.prio);
+#endif
+	}
+	if (ctx->submit_fp != NULL && ctx->submit_fp != stdin) {
+		fclose(ctx->submit_fp);
+	}
+#ifdef MM_PAGING
+	shm_cleanup(ctx);
+#ifdef ZSWAP
+	zswap_cleanup(ctx);
+#endif
+#ifdef KSM
+	ksm_cleanup(ctx);
+#endif
+	free_memphy(&ctx->mram);
+	for (i = 0; i < PAGING_MAX_MMSWP; i++) {
+		free_memphy(&ctx->mswp[i]);
+	}
+	free(ctx->mm_procs);
+	pthread_mutex_destroy(&ctx->mmvm_lock);
+#endif
+	pthread_mutex_destroy(&ctx->pid_lock);
+	pthread_mutex_destroy(&ctx->blocked_lock);
+	pthread_mutex_destroy(&ctx->mmd_lock);
+	pthread_mutex_destroy(&ctx->stat_lock);
+	free(ctx->cpu);
+	free(ctx);
+}
@@ -0,0 +1,964 @@
+/*
+ * Checkpoint and restore of a simulation
+ *
+ * OS_SNAPSHOT=warm.snap OS_SNAPSHOT_AT=N ./os <config> writes the state
+ * of the run when the timer reaches slot N, before any device runs it,
+ * and the run goes on. OS_RESTORE=warm.snap ./os <config> resumes from
+ * there with the time slot and the CPUs of <config>, the processes and
+ * the memory sizes are those of the snapshot.
+ *
+ * The file holds the clock, the scheduler queues, the CPUs and the
+ * loader, every PCB with its page table, vm areas and symbol table, the
+ * memory devices with their populated frames only, the shared memory
+ * segments and the compressed swap cache. Queues and CPUs name the
+ * processes by their index in the file, code shared after a fork is
+ * written once. The layout is that of the build, a snapshot is only
+ * read back by the same build.
+ *
+ * Not kept: the frames the current same-page merging pass has seen,
+ * the pass goes on without them as it does when a process exits, the
+ * shadow of the diff dumps, and the position in a submission stream.
+ * The records not read yet go to the restored run on its own stream.
+ */
+
+#include "sim.h"
+#include "snapshot.h"
+#include "mm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char snap_magic[8] = "OSSNAP1";
+
+/* Build options the layout depends on */
+static const uint32_t snap_build[] = {
+	sizeof(long), sizeof(struct inst_t), MAX_PRIO, MAX_QUEUE_SIZE,
+#ifdef MLQ_SCHED
+	1,
+#else
+	0,
+#endif
+#ifdef MM_PAGING
+	PAGING_PAGESZ, PAGING_MAX_PGN, PAGING_MAX_MMSWP,
+#ifdef TLB_ENTRIES
+	TLB_ENTRIES,
+#else
+	0,
+#endif
+#ifdef ZSWAP
+	1,
+#else
+	0,
+#endif
+#ifdef KSM
+	1,
+#else
+	0,
+#endif
+#endif
+};
+
+#define SNAP_NBUILD (sizeof(snap_build) / sizeof(snap_build[0]))
+
+/* Processes and code segments of a snapshot in file order */
+struct snap_tbl {
+	struct pcb_t ** proc;
+	int nr_proc, cap_proc;
+	struct code_seg_t ** code;
+	int nr_code, cap_code;
+#ifdef MM_PAGING
+	struct shm_segment ** seg;
+	int nr_seg;
+#endif
+};
+
+void snap_io(struct snap * s, void * buf, size_t len) {
+	size_t n;
+
+	if (s->err || len == 0) {
+		return;
+	}
+	n = s->load ? fread(buf, 1, len, s->fp) : fwrite(buf, 1, len, s->fp);
+	if (n != len) {
+		s->err = 1;
+	}
+}
+
+static int snap_push(void *** arr, int * nr, int * cap, void * p) {
+	int i;
+
+	for (i = 0; i < *nr; i++) {
+		if ((*arr)[i] == p) {
+			return i;
+		}
+	}
+	if (*nr == *cap) {
+		int newcap = (*cap > 0) ? *cap * 2 : 16;
+		void ** tmp = realloc(*arr, newcap * sizeof(void *));
+		if (tmp == NULL) {
+			return -1;
+		}
+		*arr = tmp;
+		*cap = newcap;
+	}
+	(*arr)[(*nr)++] = p;
+	return *nr - 1;
+}
+
+static void snap_add_proc(struct snap_tbl * t, struct pcb_t * proc) {
+	if (proc != NULL) {
+		snap_push((void ***)&t->proc, &t->nr_proc, &t->cap_proc, proc);
+	}
+}
+
+/*snap_proc - write or read a reference to a process
+ *@s: snapshot
+ *@t: processes of the snapshot
+ *@proc: process, NULL for none
+ *
+ */
+static void snap_proc(struct snap * s, struct snap_tbl * t, struct pcb_t ** proc) {
+	int idx = -1, i;
+
+	for (i = 0; !s->load && *proc != NULL && i < t->nr_proc; i++) {
+		if (t->proc[i] == *proc) {
+			idx = i;
+		}
+	}
+	SNAP_VAL(s, idx);
+	if (s->load) {
+		if (idx < -1 || idx >= t->nr_proc) {
+			s->err = 1;
+			idx = -1;
+		}
+		*proc = (idx >= 0) ? t->proc[idx] : NULL;
+	}
+}
+
+static void snap_queue(struct snap * s, struct snap_tbl * t, struct queue_t * q) {
+	int i;
+
+	SNAP_VAL(s, q->size);
+	if (s->load && (q->size < 0 || q->size > MAX_QUEUE_SIZE)) {
+		q->size = 0;
+		s->err = 1;
+	}
+	for (i = 0; i < q->size; i++) {
+		snap_proc(s, t, &q->proc[i]);
+	}
+}
+
+#ifdef MM_PAGING
+/*snap_memphy - write or read the frames of a memory device
+ *@s: snapshot
+ *@mp: device, formatted to its size on load
+ *
+ * Only frames holding a non-zero byte are written, the others read back
+ * as zero from the fresh device.
+ */
+static void snap_memphy(struct snap * s, struct memphy_struct * mp) {
+	int nrfp = mp->maxsz / PAGING_PAGESZ;
+	int nr_free = 0, nr_used = 0, fpn, i;
+	BYTE page[PAGING_PAGESZ];
+	struct framephy_struct * fp, ** tail;
+
+	SNAP_VAL(s, mp->fp_hiwm);
+	SNAP_VAL(s, mp->free_fp_cnt);
+	if (s->load && (mp->fp_hiwm < 0 || mp->fp_hiwm > nrfp || (mp->fp_hiwm > 0 && mp->fp_refcnt == NULL))) {
+		mp->fp_hiwm = 0;
+		s->err = 1;
+		return;
+	}
+	snap_io(s, mp->fp_refcnt, mp->fp_hiwm * sizeof(*mp->fp_refcnt));
+
+	/* Free list in its order, the next frame handed out stays the same */
+	for (fp = mp->free_fp_list; !s->load && fp != NULL; fp = fp->fp_next) {
+		nr_free++;
+	}
+	SNAP_VAL(s, nr_free);
+	tail = &mp->free_fp_list;
+	fp = mp->free_fp_list;
+	for (i = 0; i < nr_free && !s->err; i++) {
+		if (s->load) {
+			fp = calloc(1, sizeof(struct framephy_struct));
+			if (fp == NULL) {
+				s->err = 1;
+				break;
+			}
+			*tail = fp;
+			tail = &fp->fp_next;
+		}
+		SNAP_VAL(s, fp->fpn);
+		fp = fp->fp_next;
+	}
+
+	for (fpn = 0; !s->load && fpn < mp->fp_hiwm; fpn++) {
+		nr_used += (mp->fp_nzcnt == NULL || mp->fp_nzcnt[fpn] != 0);
+	}
+	SNAP_VAL(s, nr_used);
+	for (fpn = 0, i = 0; i < nr_used && !s->err; fpn++) {
+		if (!s->load) {
+			if (mp->fp_nzcnt != NULL && mp->fp_nzcnt[fpn] == 0) {
+				continue;
+			}
+			memcpy(page, mp->storage + fpn * PAGING_PAGESZ, PAGING_PAGESZ);
+		}
+		SNAP_VAL(s, fpn);
+		SNAP_VAL(s, page);
+		if (s->load) {
+			if (fpn < 0 || fpn >= mp->fp_hiwm) {
+				s->err = 1;
+				break;
+			}
+			MEMPHY_write_range(mp, fpn * PAGING_PAGESZ, page, PAGING_PAGESZ);
+		}
+		i++;
+	}
+
+	/* After the writes, which move the head of a serial device */
+	SNAP_VAL(s, mp->cursor);
+	SNAP_VAL(s, mp->seekdist);
+	SNAP_VAL(s, mp->seekcnt);
+}
+
+/*snap_mm - write or read a memory region
+ *@s: snapshot
+ *@t: shared memory segments of the snapshot
+ *@mm: memory region, NULL on load
+ *
+ * Return the region read back on load.
+ */
+static struct mm_struct * snap_mm(struct snap * s, struct snap_tbl * t, struct mm_struct * mm) {
+	int nr_pte = 0, nr_vma, nr_pgn = 0, pgn, i, j;
+	unsigned long next_id;
+	struct pgn_t * pg, ** tail;
+
+	if (s->load) {
+		mm = calloc(1, sizeof(struct mm_struct));
+		if (mm == NULL || (mm->pgd = calloc(PAGING_MAX_PGN, sizeof(uint32_t))) == NULL) {
+			free(mm);
+			s->err = 1;
+			return NULL;
+		}
+	}
+
+	/* Page table, only the entries in use */
+	for (pgn = 0; !s->load && pgn < PAGING_MAX_PGN; pgn++) {
+		nr_pte += (mm->pgd[pgn] != 0);
+	}
+	SNAP_VAL(s, nr_pte);
+	for (pgn = 0, i = 0; i < nr_pte && !s->err; pgn++) {
+		if (!s->load && mm->pgd[pgn] == 0) {
+			continue;
+		}
+		SNAP_VAL(s, pgn);
+		if (s->load && (pgn < 0 || pgn >= PAGING_MAX_PGN)) {
+			s->err = 1;
+			break;
+		}
+		SNAP_VAL(s, mm->pgd[pgn]);
+		i++;
+	}
+
+	SNAP_VAL(s, mm->minflt);
+	SNAP_VAL(s, mm->majflt);
+	SNAP_VAL(s, mm->cowflt);
+	SNAP_VAL(s, mm->pf_pgn);
+	SNAP_VAL(s, mm->pf_ready);
+	SNAP_VAL(s, mm->thpflt);
+	SNAP_VAL(s, mm->thpsplit);
+#ifdef TLB_ENTRIES
+	SNAP_VAL(s, mm->tlb);
+	SNAP_VAL(s, mm->tlb_hit);
+	SNAP_VAL(s, mm->tlb_miss);
+#endif
+
+	/* Vm areas by ID, each with its free regions in address order */
+	nr_vma = mm->vma_cnt;
+	next_id = mm->vma_next_id;
+	SNAP_VAL(s, nr_vma);
+	SNAP_VAL(s, next_id);
+	for (i = 0; i < nr_vma && !s->err; i++) {
+		struct vm_area_struct * vma = s->load ? NULL : mm->vma_id[i];
+		unsigned long id = 0, start = 0, end = 0, flags = 0, sbrk = 0;
+		int seg = -1, nr_rg = 0;
+		struct vm_rg_struct * rg;
+
+		if (vma != NULL) {
+			id = vma->vm_id;
+			start = vma->vm_start;
+			end = vma->vm_end;
+			flags = vma->vm_flags;
+			sbrk = vma->sbrk;
+			for (j = 0; j < t->nr_seg; j++) {
+				if (t->seg[j] == vma->vm_shm) {
+					seg = j;
+				}
+			}
+			for (rg = vma->vm_freerg_list; rg != NULL; rg = rg->rg_next) {
+				nr_rg++;
+			}
+		}
+		SNAP_VAL(s, id);
+		SNAP_VAL(s, start);
+		SNAP_VAL(s, end);
+		SNAP_VAL(s, flags);
+		SNAP_VAL(s, sbrk);
+		SNAP_VAL(s, seg);
+		SNAP_VAL(s, nr_rg);
+		if (s->load) {
+			if (s->err || seg < -1 || seg >= t->nr_seg) {
+				s->err = 1;
+				break;
+			}
+			mm->vma_next_id = id;
+			vma = create_vm_area(mm, start, end, flags);
+			if (vma == NULL) {
+				s->err = 1;
+				break;
+			}
+			vma->sbrk = sbrk;
+			vma->vm_shm = (seg >= 0) ? t->seg[seg] : NULL;
+		}
+		rg = vma->vm_freerg_list;
+		for (j = 0; j < nr_rg && !s->err; j++) {
+			unsigned long rg_start = 0, rg_end = 0;
+
+			if (!s->load) {
+				rg_start = rg->rg_start;
+				rg_end = rg->rg_end;
+				rg = rg->rg_next;
+			}
+			SNAP_VAL(s, rg_start);
+			SNAP_VAL(s, rg_end);
+			if (s->load && vm_freerg_insert(vma, init_vm_rg(rg_start, rg_end)) == NULL) {
+				s->err = 1;
+			}
+		}
+	}
+	mm->vma_next_id = next_id;
+
+	/* Symbol table */
+	SNAP_VAL(s, mm->symrgtbl_sz);
+	if (s->load && !s->err && mm->symrgtbl_sz > 0) {
+		if (mm->symrgtbl_sz > PAGING_MAX_SYMTBL_SZ ||
+		    (mm->symrgtbl = calloc(mm->symrgtbl_sz, sizeof(struct vm_rg_struct))) == NULL) {
+			mm->symrgtbl_sz = 0;
+			s->err = 1;
+		}
+	}
+	for (i = 0; i < mm->symrgtbl_sz && !s->err; i++) {
+		SNAP_VAL(s, mm->symrgtbl[i].rg_start);
+		SNAP_VAL(s, mm->symrgtbl[i].rg_end);
+	}
+
+	/* Resident pages in swap out order */
+	for (pg = mm->fifo_pgn; !s->load && pg != NULL; pg = pg->pg_next) {
+		nr_pgn++;
+	}
+	SNAP_VAL(s, nr_pgn);
+	tail = &mm->fifo_pgn;
+	pg = mm->fifo_pgn;
+	for (i = 0; i < nr_pgn && !s->err; i++) {
+		if (s->load) {
+			pg = calloc(1, sizeof(struct pgn_t));
+			if (pg == NULL) {
+				s->err = 1;
+				break;
+			}
+			*tail = pg;
+			tail = &pg->pg_next;
+		}
+		SNAP_VAL(s, pg->pgn);
+		pg = pg->pg_next;
+	}
+
+	if (s->load && s->err) {
+		free_mm(mm);
+		return NULL;
+	}
+	return mm;
+}
+
+/*snap_shm - write or read the shared memory segments
+ *@s: snapshot
+ *@t: return the segments in file order
+ *@ctx: simulation
+ *
+ */
+static void snap_shm(struct snap * s, struct snap_tbl * t, struct sim_ctx * ctx) {
+	struct shm_segment * seg, ** tail = &ctx->shm_list;
+	int i;
+
+	t->nr_seg = 0;
+	for (seg = ctx->shm_list; !s->load && seg != NULL; seg = seg->next) {
+		t->nr_seg++;
+	}
+	SNAP_VAL(s, t->nr_seg);
+	if (s->err || t->nr_seg < 0 || (t->seg = calloc(t->nr_seg + 1, sizeof(*t->seg))) == NULL) {
+		t->nr_seg = 0;
+		s->err = 1;
+		return;
+	}
+	seg = ctx->shm_list;
+	for (i = 0; i < t->nr_seg && !s->err; i++) {
+		int attached = 0;
+
+		if (s->load) {
+			seg = calloc(1, sizeof(struct shm_segment));
+			if (seg == NULL) {
+				s->err = 1;
+				break;
+			}
+			*tail = seg;
+			tail = &seg->next;
+		}
+		t->seg[i] = seg;
+		attached = (seg->mram != NULL);
+		SNAP_VAL(s, seg->key);
+		SNAP_VAL(s, seg->size);
+		SNAP_VAL(s, seg->npages);
+		SNAP_VAL(s, seg->nattch);
+		SNAP_VAL(s, attached);
+		if (s->load) {
+			seg->mram = attached ? &ctx->mram : NULL;
+			if (s->err || seg->npages < 0 || (seg->fpn = calloc(seg->npages + 1, sizeof(int))) == NULL) {
+				seg->npages = 0;
+				s->err = 1;
+				break;
+			}
+		}
+		snap_io(s, seg->fpn, seg->npages * sizeof(int));
+		seg = seg->next;
+	}
+	/* A short list on error, what was read goes with shm_cleanup */
+	t->nr_seg = i;
+}
+#endif
+
+static void snap_code(struct snap * s, struct code_seg_t * code) {
+	SNAP_VAL(s, code->size);
+	if (s->load) {
+		code->refcnt = 0;
+		if (s->err || (code->text = calloc(code->size + 1, sizeof(struct inst_t))) == NULL) {
+			code->size = 0;
+			s->err = 1;
+			return;
+		}
+	}
+	snap_io(s, code->text, code->size * sizeof(struct inst_t));
+}
+
+/*snap_pcb - write or read a process
+ *@s: snapshot
+ *@t: code segments and shared memory segments of the snapshot
+ *@ctx: simulation
+ *@proc: process, allocated on load
+ *
+ */
+static void snap_pcb(struct snap * s, struct snap_tbl * t, struct sim_ctx * ctx, struct pcb_t * proc) {
+	int code = -1, has_mm, swp = 0, i;
+
+	for (i = 0; !s->load && i < t->nr_code; i++) {
+		if (t->code[i] == proc->code) {
+			code = i;
+		}
+	}
+	SNAP_VAL(s, proc->pid);
+	SNAP_VAL(s, proc->priority);
+	SNAP_VAL(s, proc->path);
+	SNAP_VAL(s, code);
+	SNAP_VAL(s, proc->regs);
+	SNAP_VAL(s, proc->pc);
+#ifdef MLQ_SCHED
+	SNAP_VAL(s, proc->prio);
+#endif
+	SNAP_VAL(s, proc->bp);
+	SNAP_VAL(s, proc->wake_time);
+#ifdef MM_PAGING
+	/* active_mswp_id is not kept up to date, the pointer is */
+	if (!s->load && proc->mm != NULL) {
+		swp = proc->active_mswp - ctx->mswp;
+	}
+	SNAP_VAL(s, swp);
+	has_mm = (proc->mm != NULL);
+#else
+	has_mm = 0;
+#endif
+	SNAP_VAL(s, has_mm);
+
+	if (s->load) {
+		proc->ctx = ctx;
+		if (code < 0 || code >= t->nr_code || proc->pc > t->code[code]->size ||
+#ifdef MLQ_SCHED
+		    proc->prio >= MAX_PRIO ||
+#endif
+#ifdef MM_PAGING
+		    swp < 0 || swp >= PAGING_MAX_MMSWP ||
+#endif
+		    s->err) {
+			s->err = 1;
+			return;
+		}
+		proc->path[sizeof(proc->path) - 1] = '\0';
+		proc->code = t->code[code];
+		proc->code->refcnt++;
+		proc->page_table = malloc(sizeof(struct page_table_t));
+		proc->ready_queue = &ctx->ready_queue;
+		proc->running_list = &ctx->running_list;
+#ifdef MLQ_SCHED
+		proc->mlq_ready_queue = ctx->mlq_ready_queue;
+#endif
+#ifdef MM_PAGING
+		proc->mram = &ctx->mram;
+		proc->mswp = (struct memphy_struct **)&ctx->mswp;
+		proc->active_mswp = &ctx->mswp[swp];
+#endif
+	}
+#ifdef MM_PAGING
+	if (has_mm) {
+		struct mm_struct * mm = snap_mm(s, t, proc->mm);
+		if (s->load) {
+			proc->mm = mm;
+		}
+	}
+#endif
+}
+
+/*snap_config_tail - write or read the processes of the config the loader
+ *                   has not reached yet
+ *@s: snapshot
+ *@ctx: simulation, its config list is replaced on load
+ *
+ */
+static void snap_config_tail(struct snap * s, struct sim_ctx * ctx) {
+	/* The entry of a process the loader holds is taken already, a
+	 * restored list keeps an empty one in its place */
+	int held = (ctx->ld_proc != NULL), first, nr = 0, i;
+
+	first = ctx->ld_next + held;
+	if (!s->load && ctx->ld_processes.path != NULL && first < ctx->num_processes) {
+		nr = ctx->num_processes - first;
+	}
+	SNAP_VAL(s, nr);
+	if (s->load) {
+		/* Nothing of the config was consumed */
+		for (i = 0; i < ctx->num_processes && ctx->ld_processes.path != NULL; i++) {
+			free(ctx->ld_processes.path[i]);
+		}
+		free(ctx->ld_processes.path);
+		free(ctx->ld_processes.start_time);
+#ifdef MLQ_SCHED
+		free(ctx->ld_processes.prio);
+#endif
+		memset(&ctx->ld_processes, 0, sizeof(ctx->ld_processes));
+		ctx->num_processes = held;
+		ctx->ld_next = 0;
+		first = held;
+		if (s->err || nr < 0) {
+			s->err = 1;
+			return;
+		}
+		ctx->ld_processes.path = calloc(held + nr + 1, sizeof(char *));
+		ctx->ld_processes.start_time = calloc(held + nr + 1, sizeof(unsigned long));
+#ifdef MLQ_SCHED
+		ctx->ld_processes.prio = calloc(held + nr + 1, sizeof(unsigned long));
+#endif
+	}
+	for (i = 0; i < nr && !s->err; i++) {
+		int k = first + i;
+
+		if (s->load) {
+			ctx->ld_processes.path[k] = calloc(100, sizeof(char));
+			ctx->num_processes++;
+		}
+		snap_io(s, ctx->ld_processes.path[k], 100);
+		ctx->ld_processes.path[k][99] = '\0';
+		SNAP_VAL(s, ctx->ld_processes.start_time[k]);
+#ifdef MLQ_SCHED
+		SNAP_VAL(s, ctx->ld_processes.prio[k]);
+		if (ctx->ld_processes.prio[k] >= MAX_PRIO) {
+			s->err = 1;
+		}
+#endif
+	}
+}
+
+/*snap_state - write or read everything but the memory devices
+ *@s: snapshot
+ *@t: processes of the snapshot, collected from the context on write
+ *@ctx: simulation
+ *
+ */
+static void snap_state(struct snap * s, struct snap_tbl * t, struct sim_ctx * ctx) {
+	int i, nr_cpus;
+
+	SNAP_VAL(s, ctx->time);
+	SNAP_VAL(s, ctx->avail_pid);
+	SNAP_VAL(s, ctx->done);
+	SNAP_VAL(s, ctx->stat);
+#ifdef MLQ_SCHED
+	SNAP_VAL(s, ctx->slot);
+#endif
+	SNAP_VAL(s, ctx->nr_live);
+
+#ifdef MM_PAGING
+	SNAP_VAL(s, ctx->cow_shared);
+	SNAP_VAL(s, ctx->cow_copied);
+	SNAP_VAL(s, ctx->kswapd_next);
+	SNAP_VAL(s, ctx->steal_kswapd);
+	SNAP_VAL(s, ctx->steal_direct);
+	SNAP_VAL(s, ctx->compact_runs);
+	SNAP_VAL(s, ctx->compact_moved);
+	SNAP_VAL(s, ctx->compact_floor);
+#ifdef KSM
+	SNAP_VAL(s, ctx->ksm_next_proc);
+	SNAP_VAL(s, ctx->ksm_next_pgn);
+	SNAP_VAL(s, ctx->ksm_merged);
+	SNAP_VAL(s, ctx->ksm_freed);
+	SNAP_VAL(s, ctx->ksm_scanned);
+	SNAP_VAL(s, ctx->ksm_slots);
+	SNAP_VAL(s, ctx->ksm_ns);
+#endif
+#ifdef ZSWAP
+	zswap_snap(ctx, s);
+#endif
+	snap_shm(s, t, ctx);
+#endif
+
+	/* Code segments, then the processes */
+	SNAP_VAL(s, t->nr_code);
+	if (s->load && !s->err) {
+		if (t->nr_code < 0 || (t->code = calloc(t->nr_code + 1, sizeof(*t->code))) == NULL) {
+			t->nr_code = 0;
+			s->err = 1;
+		}
+		for (i = 0; i < t->nr_code && !s->err; i++) {
+			if ((t->code[i] = calloc(1, sizeof(struct code_seg_t))) == NULL) {
+				s->err = 1;
+			}
+		}
+	}
+	for (i = 0; i < t->nr_code && !s->err; i++) {
+		snap_code(s, t->code[i]);
+	}
+
+	SNAP_VAL(s, t->nr_proc);
+	if (s->load && !s->err) {
+		if (t->nr_proc < 0 || (t->proc = calloc(t->nr_proc + 1, sizeof(*t->proc))) == NULL) {
+			t->nr_proc = 0;
+			s->err = 1;
+		}
+		for (i = 0; i < t->nr_proc && !s->err; i++) {
+			if ((t->proc[i] = calloc(1, sizeof(struct pcb_t))) == NULL) {
+				s->err = 1;
+			}
+		}
+	}
+	for (i = 0; i < t->nr_proc && !s->err; i++) {
+		snap_pcb(s, t, ctx, t->proc[i]);
+	}
+	if (s->err) {
+		return;
+	}
+
+#ifdef MM_PAGING
+	/* Reclaim order */
+	SNAP_VAL(s, ctx->mm_nr_procs);
+	if (s->load) {
+		if (ctx->mm_nr_procs < 0 || ctx->mm_nr_procs > t->nr_proc) {
+			ctx->mm_nr_procs = 0;
+			s->err = 1;
+			return;
+		}
+		ctx->mm_procs_cap = ctx->mm_nr_procs;
+		ctx->mm_procs = calloc(ctx->mm_procs_cap + 1, sizeof(*ctx->mm_procs));
+	}
+	for (i = 0; i < ctx->mm_nr_procs; i++) {
+		snap_proc(s, t, &ctx->mm_procs[i]);
+		if (s->load && (ctx->mm_procs[i] == NULL || ctx->mm_procs[i]->mm == NULL)) {
+			s->err = 1;
+		}
+	}
+#endif
+
+	/* Queues */
+#ifdef MLQ_SCHED
+	SNAP_VAL(s, ctx->slot);
+	for (i = 0; i < MAX_PRIO; i++) {
+		snap_queue(s, t, &ctx->mlq_ready_queue[i]);
+	}
+#endif
+	snap_queue(s, t, &ctx->ready_queue);
+	snap_queue(s, t, &ctx->run_queue);
+	snap_queue(s, t, &ctx->running_list);
+
+	SNAP_VAL(s, ctx->nr_blocked);
+	if (s->load) {
+		int nr = ctx->nr_blocked;
+
+		ctx->nr_blocked = 0;
+		if (s->err || nr < 0 || nr > t->nr_proc) {
+			s->err = 1;
+			return;
+		}
+		for (i = 0; i < nr; i++) {
+			struct pcb_t * proc = NULL;
+
+			snap_proc(s, t, &proc);
+			if (proc == NULL) {
+				s->err = 1;
+				return;
+			}
+			block_proc(proc, proc->wake_time);
+		}
+	} else {
+		for (i = 0; i < ctx->nr_blocked; i++) {
+			snap_proc(s, t, &ctx->blocked_list[i]);
+		}
+	}
+
+	/* Loader */
+	snap_proc(s, t, &ctx->ld_proc);
+	SNAP_VAL(s, ctx->ld_path);
+	ctx->ld_path[sizeof(ctx->ld_path) - 1] = '\0';
+	SNAP_VAL(s, ctx->ld_start);
+	SNAP_VAL(s, ctx->ld_prio);
+	SNAP_VAL(s, ctx->ld_held);
+	snap_config_tail(s, ctx);
+
+	/* CPUs, the config of a restored run may have fewer or more */
+	nr_cpus = ctx->num_cpus;
+	SNAP_VAL(s, nr_cpus);
+	if (s->load && (s->err || nr_cpus < 0)) {
+		s->err = 1;
+		return;
+	}
+	for (i = 0; i < nr_cpus && !s->err; i++) {
+		struct sim_cpu cpu;
+
+		if (!s->load) {
+			cpu = ctx->cpu[i];
+		}
+		snap_proc(s, t, &cpu.proc);
+		SNAP_VAL(s, cpu.time_left);
+		SNAP_VAL(s, cpu.stopped);
+		SNAP_VAL(s, cpu.busy);
+		SNAP_VAL(s, cpu.idle);
+		SNAP_VAL(s, cpu.stalled);
+		SNAP_VAL(s, cpu.finished);
+		SNAP_VAL(s, cpu.minflt);
+		SNAP_VAL(s, cpu.majflt);
+		if (!s->load || s->err) {
+			continue;
+		}
+		if (i < ctx->num_cpus) {
+			ctx->cpu[i] = cpu;
+			continue;
+		}
+		/* No such CPU any more: its process goes back to the ready
+		 * queue and its slots count as if it had stopped */
+		if (cpu.proc != NULL) {
+			put_proc(cpu.proc);
+		}
+		if (!cpu.stopped) {
+			ctx->stat.busy += cpu.busy;
+			ctx->stat.idle += cpu.idle;
+			ctx->stat.stalled += cpu.stalled;
+			ctx->stat.finished += cpu.finished;
+			ctx->stat.minflt += cpu.minflt;
+			ctx->stat.majflt += cpu.majflt;
+		}
+	}
+}
+
+static int snap_header(struct snap * s) {
+	char magic[sizeof(snap_magic)];
+	uint32_t build[SNAP_NBUILD];
+	uint32_t nbuild = SNAP_NBUILD;
+
+	memcpy(magic, snap_magic, sizeof(magic));
+	memcpy(build, snap_build, sizeof(build));
+	SNAP_VAL(s, magic);
+	SNAP_VAL(s, nbuild);
+	if (s->load && (s->err || memcmp(magic, snap_magic, sizeof(magic)) != 0 || nbuild != SNAP_NBUILD)) {
+		return -1;
+	}
+	SNAP_VAL(s, build);
+	if (s->load && memcmp(build, snap_build, sizeof(build)) != 0) {
+		return -1;
+	}
+	return s->err ? -1 : 0;
+}
+
+/*sim_snapshot - write the state of a simulation
+ *@ctx: simulation, every device waits in next_slot
+ *@path: snapshot file
+ *
+ */
+int sim_snapshot(struct sim_ctx * ctx, const char * path) {
+	struct snap s = { NULL, 0, 0 };
+	struct snap_tbl t;
+	int i;
+
+	memset(&t, 0, sizeof(t));
+	s.fp = fopen(path, "wb");
+	if (s.fp == NULL) {
+		printf("Cannot write snapshot %s\n", path);
+		return -1;
+	}
+
+	/* Every live process and the code it runs */
+#ifdef MM_PAGING
+	for (i = 0; i < ctx->mm_nr_procs; i++) {
+		snap_add_proc(&t, ctx->mm_procs[i]);
+	}
+#endif
+	for (i = 0; i < ctx->num_cpus; i++) {
+		snap_add_proc(&t, ctx->cpu[i].proc);
+	}
+#ifdef MLQ_SCHED
+	for (int prio = 0; prio < MAX_PRIO; prio++) {
+		for (i = 0; i < ctx->mlq_ready_queue[prio].size; i++) {
+			snap_add_proc(&t, ctx->mlq_ready_queue[prio].proc[i]);
+		}
+	}
+#endif
+	for (i = 0; i < ctx->ready_queue.size; i++) {
+		snap_add_proc(&t, ctx->ready_queue.proc[i]);
+	}
+	for (i = 0; i < ctx->run_queue.size; i++) {
+		snap_add_proc(&t, ctx->run_queue.proc[i]);
+	}
+	for (i = 0; i < ctx->running_list.size; i++) {
+		snap_add_proc(&t, ctx->running_list.proc[i]);
+	}
+	for (i = 0; i < ctx->nr_blocked; i++) {
+		snap_add_proc(&t, ctx->blocked_list[i]);
+	}
+	snap_add_proc(&t, ctx->ld_proc);
+	for (i = 0; i < t.nr_proc; i++) {
+		snap_push((void ***)&t.code, &t.nr_code, &t.cap_code, t.proc[i]->code);
+	}
+
+	snap_header(&s);
+#ifdef MM_PAGING
+	SNAP_VAL(&s, ctx->memramsz);
+	SNAP_VAL(&s, ctx->memswpsz);
+	snap_memphy(&s, &ctx->mram);
+	for (i = 0; i < PAGING_MAX_MMSWP; i++) {
+		snap_memphy(&s, &ctx->mswp[i]);
+	}
+#endif
+	snap_state(&s, &t, ctx);
+	snap_io(&s, (void *)snap_magic, sizeof(snap_magic));
+
+	if (fclose(s.fp) != 0) {
+		s.err = 1;
+	}
+	free(t.proc);
+	free(t.code);
+#ifdef MM_PAGING
+	free(t.seg);
+#endif
+	if (s.err) {
+		printf("Cannot write snapshot %s\n", path);
+		return -1;
+	}
+	printf("Snapshot of slot %lu written to %s\n", (unsigned long)ctx->time, path);
+	return 0;
+}
+
+/*sim_restore - take the state of a snapshot
+ *@ctx: configured simulation, not run yet
+ *@path: snapshot file
+ *
+ */
+int sim_restore(struct sim_ctx * ctx, const char * path) {
+	struct snap s = { NULL, 1, 0 };
+	struct snap_tbl t;
+	char magic[sizeof(snap_magic)];
+	int i;
+
+	memset(&t, 0, sizeof(t));
+	s.fp = fopen(path, "rb");
+	if (s.fp == NULL) {
+		printf("Cannot find snapshot %s\n", path);
+		return -1;
+	}
+	if (snap_header(&s) < 0) {
+		printf("%s is not a snapshot of this build\n", path);
+		fclose(s.fp);
+		return -1;
+	}
+
+#ifdef MM_PAGING
+	SNAP_VAL(&s, ctx->memramsz);
+	SNAP_VAL(&s, ctx->memswpsz);
+	if (s.err || sim_init_devices(ctx) < 0) {
+		s.err = 1;
+	}
+	snap_memphy(&s, &ctx->mram);
+	for (i = 0; i < PAGING_MAX_MMSWP; i++) {
+		snap_memphy(&s, &ctx->mswp[i]);
+	}
+#endif
+	init_scheduler(ctx);
+	free(ctx->cpu);
+	ctx->cpu = calloc(ctx->num_cpus, sizeof(struct sim_cpu));
+	if (!s.err) {
+		snap_state(&s, &t, ctx);
+	}
+	SNAP_VAL(&s, magic);
+	if (memcmp(magic, snap_magic, sizeof(magic)) != 0) {
+		s.err = 1;
+	}
+	fclose(s.fp);
+
+	if (s.err) {
+		/* The devices go with the context, only the processes read so
+		 * far are freed here */
+		for (i = 0; i < t.nr_proc; i++) {
+			if (t.proc[i] == NULL) {
+				continue;
+			}
+#ifdef MM_PAGING
+			if (t.proc[i]->mm != NULL) {
+				free_mm(t.proc[i]->mm);
+			}
+#endif
+			free(t.proc[i]->page_table);
+			free(t.proc[i]);
+		}
+		for (i = 0; i < t.nr_code; i++) {
+			if (t.code[i] != NULL) {
+				free(t.code[i]->text);
+				free(t.code[i]);
+			}
+		}
+#ifdef MM_PAGING
+		free(ctx->mm_procs);
+		ctx->mm_procs = NULL;
+		ctx->mm_nr_procs = ctx->mm_procs_cap = 0;
+#endif
+		ctx->ld_proc = NULL;
+		ctx->nr_blocked = 0;
+		printf("Cannot restore snapshot %s\n", path);
+	} else {
+		/* Admitted processes are the live ones, the held one is not yet */
+		int n = 0;
+		for (i = 0; i < t.nr_proc && n < MAX_PROC; i++) {
+			if (t.proc[i] != ctx->ld_proc) {
+				ctx->proc_list[n++] = t.proc[i];
+			}
+		}
+		ctx->restored = 1;
+	}
+	free(t.proc);
+	free(t.code);
+#ifdef MM_PAGING
+	free(t.seg);
+#endif
+	return s.err ? -1 : 0;
+}
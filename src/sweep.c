@@ -0,0 +1,208 @@
+/*
+ * Parameter sweep over one configuration
+ *
+ * Usage: sweep [-j threads] [-o table.csv] <config> <time_slots> <cpus> [rams]
+ *   time_slots, cpus and rams are comma separated lists, e.g.
+ *   sweep -j 4 os_1_mlq_paging 1,2,4 1,2,4 4096,65536
+ *   rams defaults to the MEMRAM size of the config.
+ *
+ * Every combination time_slot x cpus x ram runs as its own simulation
+ * context, up to "threads" of them at once in this process (the number
+ * of online CPUs by default). The processes of the config, its MEMSWP
+ * sizes and its submission records are the same in every run. Tracing
+ * is off, the results table goes to stdout or the -o file as CSV:
+ *   time_slot,cpus,ram,slots,busy,idle,stalled,finished,minflt,majflt,
+ *   steal_kswapd,steal_direct,wall_ms
+ * one line per combination in the order of the lists.
+ */
+
+#include "common.h"
+#include "mm.h"
+#include "trace.h"
+#include "sim.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SWEEP_MAX_VALUES 64
+
+struct sweep_run {
+  int time_slot, num_cpus, ram;
+  struct sim_stat stat;
+  unsigned long steal_kswapd, steal_direct;
+  double wall_ms;
+  int err;
+};
+
+struct sweep {
+  const char *path;
+  struct sweep_run *runs;
+  int nr_runs;
+  int next;
+  pthread_mutex_t lock;
+};
+
+static int parse_list(char *spec, int *val){
+  char *tok, *save = NULL;
+  int n = 0;
+
+  for (tok = strtok_r(spec, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)){
+    if (n == SWEEP_MAX_VALUES || (val[n] = atoi(tok)) <= 0)
+      return -1;
+    n++;
+  }
+  return n;
+}
+
+static double now_ms(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/*sweep_one - run one combination in a context of its own
+ *@sw: sweep
+ *@run: combination, return its totals
+ *
+ */
+static void sweep_one(struct sweep *sw, struct sweep_run *run){
+  struct sim_ctx *ctx = sim_create();
+  double t0;
+
+  ctx->quiet = 1;
+  if (sim_config(ctx, sw->path) < 0){
+    run->err = -1;
+    sim_destroy(ctx);
+    return;
+  }
+  ctx->time_slot = run->time_slot;
+  ctx->num_cpus = run->num_cpus;
+#ifdef MM_PAGING
+  if (run->ram > 0)
+    ctx->memramsz = run->ram;
+  run->ram = ctx->memramsz;
+#endif
+
+  t0 = now_ms();
+  if (sim_run(ctx) < 0){
+    run->err = -1;
+    sim_destroy(ctx);
+    return;
+  }
+  run->wall_ms = now_ms() - t0;
+
+  run->stat = ctx->stat;
+#ifdef MM_PAGING
+  reclaim_stat(ctx, &run->steal_kswapd, &run->steal_direct);
+#endif
+  sim_destroy(ctx);
+}
+
+static void *sweep_worker(void *arg){
+  struct sweep *sw = arg;
+
+  while (1){
+    int i;
+
+    pthread_mutex_lock(&sw->lock);
+    i = sw->next++;
+    pthread_mutex_unlock(&sw->lock);
+    if (i >= sw->nr_runs)
+      break;
+    sweep_one(sw, &sw->runs[i]);
+  }
+  return NULL;
+}
+
+static void usage(void){
+  printf("Usage: sweep [-j threads] [-o table.csv] <config> <time_slots> <cpus> [rams]\n"
+         "       lists are comma separated, e.g. sweep os_1_mlq_paging 1,2,4 1,2,4 4096,65536\n");
+}
+
+int main(int argc, char *argv[]){
+  int slots[SWEEP_MAX_VALUES], cpus[SWEEP_MAX_VALUES], rams[SWEEP_MAX_VALUES] = { 0 };
+  int nslots, ncpus, nrams = 1, nthreads = 0, i, a, b, c;
+  const char *out = NULL;
+  char path[256];
+  struct sweep sw;
+  pthread_t *tid;
+  FILE *fp;
+
+  for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2){
+    switch (argv[i][1]){
+    case 'j': nthreads = atoi(argv[i + 1]); break;
+    case 'o': out = argv[i + 1]; break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+  if (argc - i < 3 || argc - i > 4 ||
+      (nslots = parse_list(argv[i + 1], slots)) < 0 ||
+      (ncpus = parse_list(argv[i + 2], cpus)) < 0 ||
+      (argc - i == 4 && (nrams = parse_list(argv[i + 3], rams)) < 0)){
+    usage();
+    return 1;
+  }
+  snprintf(path, sizeof(path), "input/%s", argv[i]);
+  if (access(path, R_OK) < 0){
+    printf("Cannot find configure file at %s\n", path);
+    return 1;
+  }
+  if (nthreads <= 0)
+    nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads <= 0)
+    nthreads = 1;
+
+  sw.path = path;
+  sw.nr_runs = nslots * ncpus * nrams;
+  sw.runs = calloc(sw.nr_runs, sizeof(struct sweep_run));
+  sw.next = 0;
+  pthread_mutex_init(&sw.lock, NULL);
+  i = 0;
+  for (a = 0; a < nslots; a++)
+    for (b = 0; b < ncpus; b++)
+      for (c = 0; c < nrams; c++){
+        sw.runs[i].time_slot = slots[a];
+        sw.runs[i].num_cpus = cpus[b];
+        sw.runs[i++].ram = rams[c];
+      }
+
+  trace_set_level(TRACE_NONE);
+  if (nthreads > sw.nr_runs)
+    nthreads = sw.nr_runs;
+  tid = malloc(sizeof(pthread_t) * nthreads);
+  for (i = 0; i < nthreads; i++)
+    pthread_create(&tid[i], NULL, sweep_worker, &sw);
+  for (i = 0; i < nthreads; i++)
+    pthread_join(tid[i], NULL);
+  free(tid);
+  pthread_mutex_destroy(&sw.lock);
+
+  fp = out != NULL ? fopen(out, "w") : stdout;
+  if (fp == NULL){
+    printf("sweep: cannot write %s\n", out);
+    free(sw.runs);
+    return 1;
+  }
+  fprintf(fp, "time_slot,cpus,ram,slots,busy,idle,stalled,finished,minflt,majflt,steal_kswapd,steal_direct,wall_ms\n");
+  for (i = 0; i < sw.nr_runs; i++){
+    struct sweep_run *r = &sw.runs[i];
+
+    if (r->err < 0)
+      continue;
+    fprintf(fp, "%d,%d,%d,%llu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.1f\n",
+            r->time_slot, r->num_cpus, r->ram, (unsigned long long)r->stat.slots,
+            r->stat.busy, r->stat.idle, r->stat.stalled, r->stat.finished,
+            r->stat.minflt, r->stat.majflt, r->steal_kswapd, r->steal_direct, r->wall_ms);
+  }
+  if (fp != stdout)
+    fclose(fp);
+  free(sw.runs);
+  return 0;
+}
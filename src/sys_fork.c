@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2025 pdnguyen of HCMC University of Technology VNU-HCM
+ */
+
+/* Sierra release
+ * Source Code License Grant: The authors hereby grant to Licensee
+ * personal permission to use and modify the Licensed Source Code
+ * for the sole purpose of studying while attending the course CO2018.
+ */
+
+#include "common.h"
+#include "syscall.h"
+#include "loader.h"
+#include "sched.h"
+#include "mm.h"
+#include "trace.h"
+#include <stdlib.h>
+
+int __sys_fork(struct pcb_t *caller, struct sc_regs* regs)
+{
+   struct pcb_t *child;
+
+   /* The child would not fit in the ready queue */
+   if (sched_full(caller->ctx, caller->prio))
+      return -1;
+
+   child = clone_pcb(caller);
+
+#ifdef MM_PAGING
+   /* Pages are shared copy-on-write, nothing is copied here */
+   child->mm = malloc(sizeof(struct mm_struct));
+   __dup_mm(caller, child->mm);
+   enlist_mm_proc(child);
+#endif
+
+   trace_msg(TRACE_INFO, "PID=%d forked child PID=%d\n", caller->pid, child->pid);
+   add_proc(child);
+
+   return 0;
+}
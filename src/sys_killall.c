@@ -12,14 +12,17 @@
 #include "syscall.h"
 #include "stdio.h"
 #include "libmem.h"
+#include "mm.h"
+#include "sim.h"
+#include "trace.h"
 #include "string.h"
 
-struct pcb_t* _proc_list[MAX_PROC]; // danh sách các process đang tồn tại
-
 int __sys_killall(struct pcb_t *caller, struct sc_regs* regs)
 {
     char proc_name[100];
-    uint32_t data;
+    struct vm_rg_struct *rg;
+    uint32_t rg_start = 0, len = 0, n;
+    int ret;
 
     //hardcode for demo only
     uint32_t memrg = regs->a1;
@@ -27,14 +30,25 @@ int __sys_killall(struct pcb_t *caller, struct sc_regs* regs)
     /* TODO: Get name of the target proc */
     //proc_name = libread..
     // Đọc chuỗi từ memory
-    int i = 0;
-    while (i < sizeof(proc_name) - 1) {
-        if (libread(caller, memrg, i, &data) != 0 || (char)data == '\0') break;
-        proc_name[i] = (char)data;
-        i++;
+    pthread_mutex_lock(&caller->ctx->mmvm_lock);
+    rg = get_symrg_byid(caller->mm, memrg);
+    if (rg != NULL) rg_start = rg->rg_start;
+    pthread_mutex_unlock(&caller->ctx->mmvm_lock);
+
+    /* A range read per page up to the first zero byte, the pages past
+     * the name are not faulted in */
+    while (len < sizeof(proc_name) - 1) {
+        n = PAGING_PAGESZ - (rg_start + len) % PAGING_PAGESZ;
+        if (n > sizeof(proc_name) - 1 - len) n = sizeof(proc_name) - 1 - len;
+        ret = libread_range(caller, memrg, len, (BYTE *)proc_name + len, &n);
+        /* Name page is on its way back from swap, redo the syscall later */
+        if (ret == PAGING_FAULT_WAIT) return ret;
+        if (ret != 0 || n == 0) break;
+        len += n;
+        if (memchr(proc_name + len - n, '\0', n) != NULL) break;
     }
-    proc_name[i] = '\0';
-    printf("The procname retrieved from memregionid %d is \"%s\"\n", memrg, proc_name);
+    proc_name[len] = '\0';
+    trace_msg(TRACE_INFO, "The procname retrieved from memregionid %d is \"%s\"\n", memrg, proc_name);
 
     /* TODO: Traverse proclist to terminate the proc
      *       stcmp to check the process match proc_name
@@ -48,19 +62,23 @@ int __sys_killall(struct pcb_t *caller, struct sc_regs* regs)
      */
 
     // Duyệt qua danh sách process để "kill"
+    struct pcb_t **_proc_list = caller->ctx->proc_list; // danh sách các process đang tồn tại
     int killed = 0;
+    /* Admission and exit change the list from the other CPUs */
+    pthread_mutex_lock(&caller->ctx->queue_lock);
     for (int i = 0; i < MAX_PROC; ++i) {
         if (_proc_list[i] != NULL && strcmp(_proc_list[i]->path, proc_name) == 0) {
-            printf("Killing process PID %d with name \"%s\"\n", _proc_list[i]->pid, _proc_list[i]->path);
-            _proc_list[i]->pc = -1;  // Đặt program counter để tiến trình kết thúc ở vòng lặp tiếp theo
+            trace_msg(TRACE_INFO, "Killing process PID %d with name \"%s\"\n", _proc_list[i]->pid, _proc_list[i]->path);
+            _proc_list[i]->pc = _proc_list[i]->code->size;  // Đặt program counter để tiến trình kết thúc ở vòng lặp tiếp theo
             killed++;
         }
     }
+    pthread_mutex_unlock(&caller->ctx->queue_lock);
 
     if (killed == 0) {
-        printf("No process matched the name \"%s\"\n", proc_name);
+        trace_msg(TRACE_INFO, "No process matched the name \"%s\"\n", proc_name);
     } else {
-        printf("Total %d processes killed.\n", killed);
+        trace_msg(TRACE_INFO, "Total %d processes killed.\n", killed);
     }
 
     return 0;
@@ -11,6 +11,7 @@
 #include "syscall.h"
 #include "libmem.h"
 #include "mm.h"
+#include "trace.h"
 
 //typedef char BYTE;
 
@@ -18,13 +19,35 @@ int __sys_memmap(struct pcb_t *caller, struct sc_regs* regs)
 {
    int memop = regs->a1;
    BYTE value;
+   int addr = 0;
+   int ret = 0;
+   int i;
+   struct frag_stat before, after;
 
    switch (memop) {
    case SYSMEM_MAP_OP:
-            /* Reserved process case*/
+            ret = __mmap(caller, regs->a2, regs->a3, &addr);
+            regs->a4 = addr;
+            break;
+   case SYSMEM_UNMAP_OP:
+   case SYSMEM_SHMDT_OP:
+            ret = __munmap(caller, regs->a2);
+            break;
+   case SYSMEM_SHMGET_OP:
+            ret = __shmget(caller, regs->a2, regs->a3);
+            break;
+   case SYSMEM_SHMAT_OP:
+            ret = __shmat(caller, regs->a2, regs->a3, &addr);
+            regs->a4 = addr;
+            break;
+   case SYSMEM_COMPACT_OP:
+            ret = compact_memory(caller->ctx, caller->mram, &before, &after);
+            trace_msg(TRACE_INFO, "PID=%d compacted MEMRAM: moved %d frames, unusable index %d%% -> %d%%, largest free run %d -> %d\n",
+                   caller->pid, ret, before.unusable_pct, after.unusable_pct, before.largest, after.largest);
+            ret = (ret < 0) ? ret : 0;
             break;
    case SYSMEM_INC_OP:
-            inc_vma_limit(caller, regs->a2, regs->a3);
+            ret = inc_vma_limit(caller, regs->a2, regs->a3);
             break;
    case SYSMEM_SWP_OP:
             __mm_swap_page(caller, regs->a2, regs->a3);
@@ -36,12 +59,24 @@ int __sys_memmap(struct pcb_t *caller, struct sc_regs* regs)
    case SYSMEM_IO_WRITE:
             MEMPHY_write(caller->mram, regs->a2, regs->a3);
             break;
+   case SYSMEM_IO_READV:
+   case SYSMEM_IO_WRITEV:
+            /* a2 segments of regs->iov, the whole transfer in one call */
+            for (i = 0; i < (int)regs->a2 && ret == 0; i++) {
+               struct memio_vec *v = &regs->iov[i];
+
+               if (memop == SYSMEM_IO_READV)
+                  ret = MEMPHY_read_range(caller->mram, v->addr, v->buf, v->len);
+               else
+                  ret = MEMPHY_write_range(caller->mram, v->addr, v->buf, v->len);
+            }
+            break;
    default:
             printf("Memop code: %d\n", memop);
             break;
    }
    
-   return 0;
+   return ret;
 }
 
 
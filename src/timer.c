@@ -1,32 +1,27 @@
 
 #include "timer.h"
+#include "sim.h"
+#include "trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 
-static pthread_t _timer;
-
 struct timer_id_container_t {
 	struct timer_id_t id;
 	struct timer_id_container_t * next;
 };
 
-static struct timer_id_container_t * dev_list = NULL;
-
-static uint64_t _time;
-
-static int timer_started = 0;
-static int timer_stop = 0;
-
 
 static void * timer_routine(void * args) {
-	while (!timer_stop) {
-		printf("Time slot %3lu\n", current_time());
+	struct sim_ctx * ctx = (struct sim_ctx *)args;
+
+	while (!ctx->timer_stop) {
+		trace_ev(TR_SLOT, TRACE_INFO, current_time(ctx));
 		int fsh = 0;
 		int event = 0;
 		/* Wait for all devices have done the job in current
 		 * time slot */
 		struct timer_id_container_t * temp;
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
+		for (temp = ctx->dev_list; temp != NULL; temp = temp->next) {
 			pthread_mutex_lock(&temp->id.event_lock);
 			while (!temp->id.done && !temp->id.fsh) {
 				pthread_cond_wait(
@@ -42,10 +37,16 @@ static void * timer_routine(void * args) {
 		}
 
 		/* Increase the time slot */
-		_time++;
-		
+		ctx->time++;
+
+		/* Every device waits in next_slot, nothing changes under the
+		 * snapshot */
+		if (ctx->snap_path != NULL && ctx->time == ctx->snap_at && fsh < event) {
+			sim_snapshot(ctx, ctx->snap_path);
+		}
+
 		/* Let devices continue their job */
-		for (temp = dev_list; temp != NULL; temp = temp->next) {
+		for (temp = ctx->dev_list; temp != NULL; temp = temp->next) {
 			pthread_mutex_lock(&temp->id.timer_lock);
 			temp->id.done = 0;
 			pthread_cond_signal(&temp->id.timer_cond);
@@ -76,13 +77,13 @@ void next_slot(struct timer_id_t * timer_id) {
 	pthread_mutex_unlock(&timer_id->timer_lock);
 }
 
-uint64_t current_time() {
-	return _time;
+uint64_t current_time(struct sim_ctx * ctx) {
+	return ctx->time;
 }
 
-void start_timer() {
-	timer_started = 1;
-	pthread_create(&_timer, NULL, timer_routine, NULL);
+void start_timer(struct sim_ctx * ctx) {
+	ctx->timer_started = 1;
+	pthread_create(&ctx->timer, NULL, timer_routine, ctx);
 }
 
 void detach_event(struct timer_id_t * event) {
@@ -92,8 +93,8 @@ void detach_event(struct timer_id_t * event) {
 	pthread_mutex_unlock(&event->event_lock);
 }
 
-struct timer_id_t * attach_event() {
-	if (timer_started) {
+struct timer_id_t * attach_event(struct sim_ctx * ctx) {
+	if (ctx->timer_started) {
 		return NULL;
 	}else{
 		struct timer_id_container_t * container =
@@ -106,23 +107,23 @@ struct timer_id_t * attach_event() {
 		pthread_mutex_init(&container->id.event_lock, NULL);
 		pthread_cond_init(&container->id.timer_cond, NULL);
 		pthread_mutex_init(&container->id.timer_lock, NULL);
-		if (dev_list == NULL) {
-			dev_list = container;
-			dev_list->next = NULL;
+		if (ctx->dev_list == NULL) {
+			ctx->dev_list = container;
+			ctx->dev_list->next = NULL;
 		}else{
-			container->next = dev_list;
-			dev_list = container;
+			container->next = ctx->dev_list;
+			ctx->dev_list = container;
 		}
 		return &(container->id);
 	}
 }
 
-void stop_timer() {
-	timer_stop = 1;
-	pthread_join(_timer, NULL);
-	while (dev_list != NULL) {
-		struct timer_id_container_t * temp = dev_list;
-		dev_list = dev_list->next;
+void stop_timer(struct sim_ctx * ctx) {
+	ctx->timer_stop = 1;
+	pthread_join(ctx->timer, NULL);
+	while (ctx->dev_list != NULL) {
+		struct timer_id_container_t * temp = ctx->dev_list;
+		ctx->dev_list = ctx->dev_list->next;
 		pthread_cond_destroy(&temp->id.event_cond);
 		pthread_mutex_destroy(&temp->id.event_lock);
 		pthread_cond_destroy(&temp->id.timer_cond);
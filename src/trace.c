@@ -0,0 +1,395 @@
+/*
+ * Event tracing
+ *
+ * Without OS_TRACE_FILE events are formatted to stdout as they happen.
+ * With it each thread appends binary records to a ring of its own, no
+ * lock is taken on the way, and a ring is written out to the file when
+ * it fills up and at trace_close. tracefmt puts the records back in
+ * order and prints the same text.
+ */
+
+#include "trace.h"
+#include "os-cfg.h"
+
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The levels are nested, IODUMP takes the page tables along */
+#ifndef TRACE_LEVEL
+#if defined(IODUMP)
+#define TRACE_LEVEL TRACE_MEMDUMP
+#elif defined(PAGETBL_DUMP)
+#define TRACE_LEVEL TRACE_PGTBL
+#else
+#define TRACE_LEVEL TRACE_INFO
+#endif
+#endif
+
+#define TRACE_RING_SZ (64 * 1024)
+
+/* Single producer ring, the owning thread advances head and whoever
+ * writes the ring out advances tail. Both count bytes from the start.
+ */
+struct trace_ring {
+  uint64_t head;
+  uint64_t tail;
+  struct trace_ring *next;
+  char buf[TRACE_RING_SZ];
+};
+
+int trace_level = TRACE_LEVEL;
+int trace_flags = 0;
+
+static FILE *trace_fp = NULL;
+static uint64_t trace_seq = 0;
+static struct trace_ring *trace_rings = NULL;
+static __thread struct trace_ring *trace_my_ring = NULL;
+
+static void trace_sig(int sig){
+  int level = __atomic_load_n(&trace_level, __ATOMIC_RELAXED);
+
+  if (sig == SIGUSR1 && level < TRACE_DEBUG)
+    level++;
+  else if (sig == SIGUSR2 && level > TRACE_NONE)
+    level--;
+  __atomic_store_n(&trace_level, level, __ATOMIC_RELAXED);
+}
+
+/*trace_init - set up the trace sink from the environment
+ *
+ * OS_TRACE_LEVEL overrides the TRACE_LEVEL default, OS_TRACE_FILE sends
+ * binary records to that file instead of text to stdout and OS_TRACE_DIFF
+ * turns memory dumps into diffs.
+ */
+int trace_init(void){
+  const char *level = getenv("OS_TRACE_LEVEL");
+  const char *path = getenv("OS_TRACE_FILE");
+  const char *diff = getenv("OS_TRACE_DIFF");
+
+  if (level != NULL && *level != '\0')
+    trace_set_level(atoi(level));
+  if (diff != NULL && atoi(diff) != 0)
+    trace_flags |= TRACE_F_MEMDIFF;
+
+  if (path != NULL && *path != '\0'){
+    trace_fp = fopen(path, "wb");
+    if (trace_fp == NULL){
+      printf("trace_init: cannot open trace file %s\n", path);
+      return -1;
+    }
+    fwrite(TRACE_MAGIC, 1, 8, trace_fp);
+  }
+
+  signal(SIGUSR1, trace_sig);
+  signal(SIGUSR2, trace_sig);
+  return 0;
+}
+
+/*trace_set_level - change the trace level
+ *@level: TRACE_NONE .. TRACE_DEBUG
+ *
+ */
+int trace_set_level(int level){
+  if (level < TRACE_NONE)
+    level = TRACE_NONE;
+  if (level > TRACE_DEBUG)
+    level = TRACE_DEBUG;
+  __atomic_store_n(&trace_level, level, __ATOMIC_RELAXED);
+  return 0;
+}
+
+/*trace_drain - write out the records of a ring
+ *@r: ring
+ *
+ * Called by the owner of the ring, or by trace_close once all of the
+ * producers are gone.
+ */
+static int trace_drain(struct trace_ring *r){
+  uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  uint64_t tail = r->tail;
+  size_t off = tail % TRACE_RING_SZ, n = head - tail;
+
+  if (n == 0)
+    return 0;
+
+  flockfile(trace_fp);
+  if (off + n > TRACE_RING_SZ){
+    fwrite(r->buf + off, 1, TRACE_RING_SZ - off, trace_fp);
+    fwrite(r->buf, 1, off + n - TRACE_RING_SZ, trace_fp);
+  } else {
+    fwrite(r->buf + off, 1, n, trace_fp);
+  }
+  funlockfile(trace_fp);
+
+  __atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static void trace_ring_put(struct trace_ring *r, uint64_t *pos, const void *data, size_t n){
+  size_t off = *pos % TRACE_RING_SZ;
+
+  if (off + n > TRACE_RING_SZ){
+    memcpy(r->buf + off, data, TRACE_RING_SZ - off);
+    memcpy(r->buf, (const char *)data + TRACE_RING_SZ - off, off + n - TRACE_RING_SZ);
+  } else {
+    memcpy(r->buf + off, data, n);
+  }
+  *pos += n;
+}
+
+/*trace_ring_get - ring of the calling thread, registered on first use
+ *
+ */
+static struct trace_ring *trace_ring_get(void){
+  struct trace_ring *r = trace_my_ring;
+
+  if (r != NULL)
+    return r;
+
+  r = malloc(sizeof(struct trace_ring));
+  if (r == NULL)
+    return NULL;
+  r->head = r->tail = 0;
+  r->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&trace_rings, &r->next, r, 0,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  trace_my_ring = r;
+  return r;
+}
+
+/*trace_emit - record an event
+ *@type: trace_type
+ *@level: trace level of the event
+ *@arg: TRACE_NARGS arguments
+ *@payload: variable part, may be NULL
+ *@len: payload bytes
+ *
+ */
+int trace_emit(int type, int level, const int64_t *arg, const void *payload, uint32_t len){
+  static const uint64_t zero = 0;
+  struct trace_event ev;
+  struct trace_ring *r;
+  uint64_t head;
+  size_t recsz = sizeof(ev) + TRACE_PAD(len);
+
+  if (!trace_on(level))
+    return 0;
+
+  ev.seq = __atomic_fetch_add(&trace_seq, 1, __ATOMIC_RELAXED);
+  ev.type = type;
+  ev.level = level;
+  ev.len = len;
+  memcpy(ev.arg, arg, sizeof(ev.arg));
+
+  if (trace_fp == NULL){
+    flockfile(stdout);
+    trace_format(&ev, payload, stdout);
+    funlockfile(stdout);
+    return 0;
+  }
+
+  r = trace_ring_get();
+  if (r == NULL)
+    return -1;
+
+  if (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) + recsz > TRACE_RING_SZ)
+    trace_drain(r);
+
+  /* A record larger than the ring goes straight to the file */
+  if (recsz > TRACE_RING_SZ){
+    flockfile(trace_fp);
+    fwrite(&ev, sizeof(ev), 1, trace_fp);
+    fwrite(payload, 1, len, trace_fp);
+    fwrite(&zero, 1, TRACE_PAD(len) - len, trace_fp);
+    funlockfile(trace_fp);
+    return 0;
+  }
+
+  /* The record becomes visible to trace_drain all at once */
+  head = r->head;
+  trace_ring_put(r, &head, &ev, sizeof(ev));
+  if (len > 0)
+    trace_ring_put(r, &head, payload, len);
+  if (TRACE_PAD(len) > len)
+    trace_ring_put(r, &head, &zero, TRACE_PAD(len) - len);
+  __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+
+  return 0;
+}
+
+/*trace_msg - record a line of free text
+ *@level: trace level
+ *@fmt: printf format
+ *
+ */
+int trace_msg(int level, const char *fmt, ...){
+  static const int64_t noargs[TRACE_NARGS];
+  char buf[512];
+  va_list ap;
+  int len;
+
+  if (!trace_on(level))
+    return 0;
+
+  va_start(ap, fmt);
+  if (trace_fp == NULL){
+    vprintf(fmt, ap);
+    va_end(ap);
+    return 0;
+  }
+  len = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  if (len >= (int)sizeof(buf))
+    len = sizeof(buf) - 1;
+  return trace_emit(TR_MSG, level, noargs, buf, len);
+}
+
+/*trace_format - print an event the way the simulator prints it
+ *@ev: event
+ *@payload: its payload
+ *@out: output stream
+ *
+ */
+int trace_format(const struct trace_event *ev, const void *payload, FILE *out){
+  static const char *fault_name[] = { "minor", "major", "cow", "huge" };
+  const int64_t *a = ev->arg;
+  uint32_t i;
+
+  switch (ev->type){
+  case TR_MSG:
+    fwrite(payload, 1, ev->len, out);
+    break;
+  case TR_SLOT:
+    fprintf(out, "Time slot %3lu\n", (unsigned long)a[0]);
+    break;
+  case TR_LOAD:
+    fprintf(out, "\tLoaded a process at %.*s, PID: %d PRIO: %ld\n",
+            (int)ev->len, (const char *)payload, (int)a[0], (long)a[1]);
+    break;
+  case TR_DISPATCH:
+    fprintf(out, "\tCPU %d: Dispatched process %2d\n", (int)a[0], (int)a[1]);
+    break;
+  case TR_PUT:
+    fprintf(out, "\tCPU %d: Put process %2d to run queue\n", (int)a[0], (int)a[1]);
+    break;
+  case TR_FINISH:
+    fprintf(out, "\tCPU %d: Processed %2d has finished\n", (int)a[0], (int)a[1]);
+    break;
+  case TR_BLOCK:
+    fprintf(out, "\tCPU %d: Process %2d blocked on page fault until slot %lu\n",
+            (int)a[0], (int)a[1], (unsigned long)a[2]);
+    break;
+  case TR_STOP:
+    fprintf(out, "\tCPU %d stopped\n", (int)a[0]);
+    break;
+  case TR_ALLOC:
+  case TR_MMAP:
+    fprintf(out, ev->type == TR_ALLOC ? "===== PHYSICAL MEMORY AFTER ALLOCATION =====\n"
+                                      : "===== VIRTUAL MEMORY AFTER MMAP =====\n");
+    fprintf(out, "PID=%d - Region=%d - Address=%08lx - Size=%d byte\n",
+            (int)a[0], (int)a[1], (unsigned long)a[2], (int)a[3]);
+    break;
+  case TR_FREE:
+  case TR_MUNMAP:
+    fprintf(out, ev->type == TR_FREE ? "===== PHYSICAL MEMORY AFTER DEALLOCATION =====\n"
+                                     : "===== VIRTUAL MEMORY AFTER MUNMAP =====\n");
+    fprintf(out, "PID=%d - Region=%d\n", (int)a[0], (int)a[1]);
+    break;
+  case TR_SHMAT:
+    fprintf(out, "===== VIRTUAL MEMORY AFTER SHMAT =====\n");
+    fprintf(out, "PID=%d - Region=%d - Key=%d - Address=%08lx - Size=%d byte\n",
+            (int)a[0], (int)a[1], (int)a[2], (unsigned long)a[3], (int)a[4]);
+    break;
+  case TR_READ:
+  case TR_WRITE:
+    fprintf(out, "%s region=%d offset=%d value=%d PID=%d\n", ev->type == TR_READ ? "read" : "write",
+            (int)a[0], (int)a[1], (int)a[2], (int)a[3]);
+    break;
+  case TR_READV:
+  case TR_WRITEV:
+    fprintf(out, "%s region=%d offset=%d length=%d PID=%d\n", ev->type == TR_READV ? "read" : "write",
+            (int)a[0], (int)a[1], (int)a[2], (int)a[3]);
+    break;
+  case TR_PGTBL: {
+    const uint32_t *pte = payload;
+
+    fprintf(out, "print_pgtbl: %d - %d\n", (int)a[0], (int)a[1]);
+    for (i = 0; i < ev->len / sizeof(uint32_t); i++)
+      fprintf(out, "%08ld: %08x\n", (long)((a[2] + i) * sizeof(uint32_t)), pte[i]);
+    break;
+  }
+  case TR_MEMDUMP: {
+    const int32_t *cell = payload;
+
+    fprintf(out, "===== PHYSICAL MEMORY DUMP =====\n");
+    for (i = 0; i < ev->len / (2 * sizeof(int32_t)); i++)
+      fprintf(out, "BYTE %08x: %d\n", cell[2 * i], cell[2 * i + 1]);
+    if (ev->len == 0)
+      fprintf(out, "Empty physical memory\n");
+    fprintf(out, "===== PHYSICAL MEMORY END-DUMP =====\n");
+    fprintf(out, "================================================================\n");
+    break;
+  }
+  case TR_MEMDIFF: {
+    const int32_t *cell = payload;
+
+    fprintf(out, "===== PHYSICAL MEMORY DIFF =====\n");
+    for (i = 0; i < ev->len / (3 * sizeof(int32_t)); i++)
+      fprintf(out, "BYTE %08x: %d -> %d\n", cell[3 * i], cell[3 * i + 1], cell[3 * i + 2]);
+    if (ev->len == 0)
+      fprintf(out, "No change in physical memory\n");
+    fprintf(out, "===== PHYSICAL MEMORY END-DIFF =====\n");
+    fprintf(out, "================================================================\n");
+    break;
+  }
+  case TR_FAULT:
+    fprintf(out, "\tPID %d: %s fault on page %d\n", (int)a[0],
+            (a[2] >= TRF_MINOR && a[2] <= TRF_HUGE) ? fault_name[a[2]] : "unknown", (int)a[1]);
+    break;
+  case TR_SWAPOUT:
+    fprintf(out, "\tPID %d: page %d swapped out from frame %d to %s %d\n", (int)a[0], (int)a[1],
+            (int)a[2], a[3] ? "zswap entry" : "swap frame", (int)a[4]);
+    break;
+  case TR_SWAPIN:
+    fprintf(out, "\tPID %d: page %d swap-in started, ready at slot %lu\n",
+            (int)a[0], (int)a[1], (unsigned long)a[2]);
+    break;
+  case TR_SYSCALL:
+    fprintf(out, "\tPID %d: syscall %d (%d, %d, %d)\n",
+            (int)a[0], (int)a[1], (int)a[2], (int)a[3], (int)a[4]);
+    break;
+  default:
+    fprintf(out, "unknown trace event %u\n", ev->type);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*trace_close - write out every ring and close the trace file
+ *
+ * The threads that recorded events must have finished.
+ */
+int trace_close(void){
+  struct trace_ring *r = trace_rings, *next;
+
+  for (; r != NULL; r = next){
+    next = r->next;
+    if (trace_fp != NULL)
+      trace_drain(r);
+    free(r);
+  }
+  trace_rings = NULL;
+  trace_my_ring = NULL;
+
+  if (trace_fp != NULL){
+    fclose(trace_fp);
+    trace_fp = NULL;
+  }
+
+  return 0;
+}
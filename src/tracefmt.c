@@ -0,0 +1,378 @@
+/*
+ * tracefmt - print a binary trace written with OS_TRACE_FILE
+ *
+ * Usage: tracefmt [-e | -j] <trace file> [level]
+ *
+ * Records are printed in the order they were recorded, as the text the
+ * simulator prints without a trace file. A level drops the events above
+ * it. -e expands memory diffs back into full memory dumps.
+ *
+ * -j writes Chrome Trace Event JSON instead, for chrome://tracing or
+ * Perfetto. Each CPU is a track with the run spans of the processes and
+ * each process a track with its loads, memory operations, faults, swaps
+ * and syscalls. One slot is shown as one millisecond. Record the trace
+ * with OS_TRACE_LEVEL=5 to get the fault, swap and syscall events.
+ */
+
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct trace_rec {
+  struct trace_event ev;
+  char *payload;
+};
+
+/* Memory image rebuilt from the diffs for -e */
+static signed char *image = NULL;
+static int image_sz = 0;
+
+/*expand_diff - apply a diff to the image and print the full dump
+ *@ev: TR_MEMDIFF event
+ *@payload: its changes
+ *
+ */
+static int expand_diff(const struct trace_event *ev, const int32_t *payload){
+  struct trace_event dump = *ev;
+  int32_t *cell;
+  uint32_t i;
+  int addr, nr = 0;
+
+  for (i = 0; i < ev->len / (3 * sizeof(int32_t)); i++){
+    addr = payload[3 * i];
+    if (addr >= image_sz){
+      int sz = image_sz ? image_sz : 4096;
+
+      while (sz <= addr)
+        sz *= 2;
+      image = realloc(image, sz);
+      memset(image + image_sz, 0, sz - image_sz);
+      image_sz = sz;
+    }
+    image[addr] = payload[3 * i + 2];
+  }
+
+  cell = malloc(2 * sizeof(int32_t) * (image_sz ? image_sz : 1));
+  for (addr = 0; addr < image_sz; addr++){
+    if (image[addr] == 0)
+      continue;
+    cell[2 * nr] = addr;
+    cell[2 * nr + 1] = image[addr];
+    nr++;
+  }
+
+  dump.type = TR_MEMDUMP;
+  dump.len = nr * 2 * sizeof(int32_t);
+  trace_format(&dump, cell, stdout);
+  free(cell);
+
+  return 0;
+}
+
+/* Chrome trace process ids of the two groups of tracks */
+#define JSON_CPUS  1
+#define JSON_PROCS 2
+
+static int json_first = 1;
+
+static void json_event(const char *ph, int jpid, int tid, long ts, const char *name, const char *args){
+  printf("%s\n{\"ph\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%ld,\"name\":\"%s\"",
+         json_first ? "" : ",", ph, jpid, tid, ts, name);
+  if (ph[0] == 'i')
+    printf(",\"s\":\"t\"");
+  if (args != NULL)
+    printf(",\"args\":{%s}", args);
+  printf("}");
+  json_first = 0;
+}
+
+/*json_track - name a track the first time it is used
+ *@seen: per track flags, grown as needed
+ *@nseen: size of seen
+ *
+ */
+static void json_track(char **seen, int *nseen, int jpid, int tid, const char *fmt){
+  char name[64], args[96];
+
+  if (tid < 0)
+    return;
+  if (tid >= *nseen){
+    int n = *nseen ? *nseen : 16;
+
+    while (n <= tid)
+      n *= 2;
+    *seen = realloc(*seen, n);
+    memset(*seen + *nseen, 0, n - *nseen);
+    *nseen = n;
+  }
+  if ((*seen)[tid])
+    return;
+  (*seen)[tid] = 1;
+
+  snprintf(name, sizeof(name), fmt, tid);
+  snprintf(args, sizeof(args), "\"name\":\"%s\"", name);
+  json_event("M", jpid, tid, 0, "thread_name", args);
+  snprintf(args, sizeof(args), "\"sort_index\":%d", tid);
+  json_event("M", jpid, tid, 0, "thread_sort_index", args);
+}
+
+/*export_json - write the records as Chrome Trace Event JSON
+ *@recs: records in seq order
+ *@nr: number of records
+ *@level: highest level to export
+ *
+ */
+static int export_json(const struct trace_rec *recs, size_t nr, int level){
+  static const char *fault_name[] = { "minor fault", "major fault", "cow fault", "huge fault" };
+  static const char *op_name[] = { [TR_ALLOC] = "alloc", [TR_FREE] = "free", [TR_MMAP] = "mmap",
+                                   [TR_MUNMAP] = "munmap", [TR_SHMAT] = "shmat",
+                                   [TR_READ] = "read", [TR_WRITE] = "write",
+                                   [TR_READV] = "read", [TR_WRITEV] = "write" };
+  char *cpu_seen = NULL, *proc_seen = NULL;
+  int ncpu_seen = 0, nproc_seen = 0, *running = NULL, nrunning = 0;
+  long slot = 0, sub = 0, ts = 0;
+  char name[64], args[256];
+  size_t i;
+
+  printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+  json_event("M", JSON_CPUS, 0, 0, "process_name", "\"name\":\"CPUs\"");
+  json_event("M", JSON_PROCS, 0, 0, "process_name", "\"name\":\"Processes\"");
+
+  for (i = 0; i < nr; i++){
+    const struct trace_event *ev = &recs[i].ev;
+    const int64_t *a = ev->arg;
+    int cpu = -1;
+
+    if (ev->level > level)
+      continue;
+
+    /* Events of a slot are spread over its millisecond in record order */
+    if (ev->type == TR_SLOT){
+      slot = a[0];
+      sub = 0;
+      continue;
+    }
+    ts = slot * 1000 + (sub < 999 ? sub++ : 999);
+
+    switch (ev->type){
+    case TR_DISPATCH: case TR_PUT: case TR_FINISH: case TR_BLOCK: case TR_STOP:
+      cpu = a[0];
+      json_track(&cpu_seen, &ncpu_seen, JSON_CPUS, cpu, "CPU %d");
+      if (cpu >= nrunning){
+        int n = nrunning ? nrunning * 2 : 8, k;
+
+        while (n <= cpu)
+          n *= 2;
+        running = realloc(running, n * sizeof(int));
+        for (k = nrunning; k < n; k++)
+          running[k] = -1;
+        nrunning = n;
+      }
+      break;
+    }
+
+    switch (ev->type){
+    case TR_DISPATCH:
+      if (running[cpu] >= 0)
+        json_event("E", JSON_CPUS, cpu, ts, "", NULL);
+      snprintf(name, sizeof(name), "PID %d", (int)a[1]);
+      snprintf(args, sizeof(args), "\"pid\":%d", (int)a[1]);
+      json_event("B", JSON_CPUS, cpu, ts, name, args);
+      running[cpu] = a[1];
+      break;
+    case TR_PUT:
+    case TR_FINISH:
+    case TR_BLOCK:
+    case TR_STOP:
+      if (running[cpu] >= 0)
+        json_event("E", JSON_CPUS, cpu, ts, "", NULL);
+      running[cpu] = -1;
+      if (ev->type == TR_STOP){
+        json_event("i", JSON_CPUS, cpu, ts, "stopped", NULL);
+        break;
+      }
+      if (ev->type == TR_PUT)
+        break;
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[1], "PID %d");
+      if (ev->type == TR_FINISH){
+        snprintf(args, sizeof(args), "\"cpu\":%d", cpu);
+        json_event("i", JSON_PROCS, a[1], ts, "finished", args);
+      } else {
+        snprintf(args, sizeof(args), "\"cpu\":%d,\"until slot\":%ld", cpu, (long)a[2]);
+        json_event("i", JSON_PROCS, a[1], ts, "blocked", args);
+      }
+      break;
+    case TR_LOAD: {
+      int k, n = 0;
+
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[0], "PID %d");
+      n += snprintf(args, sizeof(args), "\"prio\":%ld,\"path\":\"", (long)a[1]);
+      for (k = 0; k < (int)ev->len && n < (int)sizeof(args) - 4; k++){
+        char c = recs[i].payload[k];
+
+        if (c == '"' || c == '\\')
+          args[n++] = '\\';
+        args[n++] = (c >= 0x20) ? c : '?';
+      }
+      args[n++] = '"';
+      args[n] = '\0';
+      json_event("i", JSON_PROCS, a[0], ts, "loaded", args);
+      break;
+    }
+    case TR_ALLOC:
+    case TR_MMAP:
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[0], "PID %d");
+      snprintf(args, sizeof(args), "\"region\":%d,\"address\":%ld,\"size\":%d",
+               (int)a[1], (long)a[2], (int)a[3]);
+      json_event("i", JSON_PROCS, a[0], ts, op_name[ev->type], args);
+      break;
+    case TR_FREE:
+    case TR_MUNMAP:
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[0], "PID %d");
+      snprintf(args, sizeof(args), "\"region\":%d", (int)a[1]);
+      json_event("i", JSON_PROCS, a[0], ts, op_name[ev->type], args);
+      break;
+    case TR_SHMAT:
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[0], "PID %d");
+      snprintf(args, sizeof(args), "\"region\":%d,\"key\":%d,\"address\":%ld,\"size\":%d",
+               (int)a[1], (int)a[2], (long)a[3], (int)a[4]);
+      json_event("i", JSON_PROCS, a[0], ts, op_name[ev->type], args);
+      break;
+    case TR_READ:
+    case TR_WRITE:
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[3], "PID %d");
+      snprintf(args, sizeof(args), "\"region\":%d,\"offset\":%d,\"value\":%d",
+               (int)a[0], (int)a[1], (int)a[2]);
+      json_event("i", JSON_PROCS, a[3], ts, op_name[ev->type], args);
+      break;
+    case TR_READV:
+    case TR_WRITEV:
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[3], "PID %d");
+      snprintf(args, sizeof(args), "\"region\":%d,\"offset\":%d,\"length\":%d",
+               (int)a[0], (int)a[1], (int)a[2]);
+      json_event("i", JSON_PROCS, a[3], ts, op_name[ev->type], args);
+      break;
+    case TR_FAULT:
+      if (a[2] < TRF_MINOR || a[2] > TRF_HUGE)
+        break;
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[0], "PID %d");
+      snprintf(args, sizeof(args), "\"page\":%d", (int)a[1]);
+      json_event("i", JSON_PROCS, a[0], ts, fault_name[a[2]], args);
+      break;
+    case TR_SWAPOUT:
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[0], "PID %d");
+      snprintf(args, sizeof(args), "\"page\":%d,\"frame\":%d,\"to\":\"%s\",\"offset\":%d",
+               (int)a[1], (int)a[2], a[3] ? "zswap" : "swap", (int)a[4]);
+      json_event("i", JSON_PROCS, a[0], ts, "swap out", args);
+      break;
+    case TR_SWAPIN:
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[0], "PID %d");
+      snprintf(args, sizeof(args), "\"page\":%d,\"ready slot\":%ld", (int)a[1], (long)a[2]);
+      json_event("i", JSON_PROCS, a[0], ts, "swap in", args);
+      break;
+    case TR_SYSCALL:
+      json_track(&proc_seen, &nproc_seen, JSON_PROCS, a[0], "PID %d");
+      snprintf(name, sizeof(name), "syscall %d", (int)a[1]);
+      snprintf(args, sizeof(args), "\"a1\":%d,\"a2\":%d,\"a3\":%d", (int)a[2], (int)a[3], (int)a[4]);
+      json_event("i", JSON_PROCS, a[0], ts, name, args);
+      break;
+    }
+  }
+
+  /* Spans still open when the trace ends */
+  for (i = 0; i < (size_t)nrunning; i++)
+    if (running[i] >= 0)
+      json_event("E", JSON_CPUS, i, ts, "", NULL);
+
+  printf("\n]}\n");
+  free(cpu_seen);
+  free(proc_seen);
+  free(running);
+
+  return 0;
+}
+
+static int rec_cmp(const void *a, const void *b){
+  uint64_t sa = ((const struct trace_rec *)a)->ev.seq;
+  uint64_t sb = ((const struct trace_rec *)b)->ev.seq;
+
+  return (sa > sb) - (sa < sb);
+}
+
+int main(int argc, char *argv[]){
+  struct trace_rec *recs = NULL;
+  size_t nr = 0, cap = 0, i;
+  int level = TRACE_DEBUG, expand = 0, json = 0;
+  char magic[8];
+  FILE *fp;
+
+  if (argc > 1 && (strcmp(argv[1], "-e") == 0 || strcmp(argv[1], "-j") == 0)){
+    expand = (argv[1][1] == 'e');
+    json = (argv[1][1] == 'j');
+    argc--;
+    argv++;
+  }
+  if (argc < 2 || argc > 3){
+    printf("Usage: tracefmt [-e | -j] <trace file> [level]\n");
+    return 1;
+  }
+  if (argc == 3)
+    level = atoi(argv[2]);
+
+  fp = fopen(argv[1], "rb");
+  if (fp == NULL){
+    printf("Cannot open trace file %s\n", argv[1]);
+    return 1;
+  }
+  if (fread(magic, 1, 8, fp) != 8 || memcmp(magic, TRACE_MAGIC, 8) != 0){
+    printf("%s is not a trace file\n", argv[1]);
+    fclose(fp);
+    return 1;
+  }
+
+  for (;;){
+    struct trace_event ev;
+
+    if (fread(&ev, sizeof(ev), 1, fp) != 1)
+      break;
+    if (nr == cap){
+      cap = cap ? cap * 2 : 1024;
+      recs = realloc(recs, cap * sizeof(struct trace_rec));
+      if (recs == NULL){
+        printf("Out of memory\n");
+        return 1;
+      }
+    }
+    recs[nr].ev = ev;
+    recs[nr].payload = malloc(TRACE_PAD(ev.len) + 1);
+    if (fread(recs[nr].payload, 1, TRACE_PAD(ev.len), fp) != TRACE_PAD(ev.len)){
+      printf("Truncated record %lu\n", (unsigned long)ev.seq);
+      free(recs[nr].payload);
+      break;
+    }
+    nr++;
+  }
+  fclose(fp);
+
+  qsort(recs, nr, sizeof(struct trace_rec), rec_cmp);
+  if (json)
+    export_json(recs, nr, level);
+  for (i = 0; i < nr; i++){
+    if (json){
+      free(recs[i].payload);
+      continue;
+    }
+    if (recs[i].ev.level > level)
+      ;
+    else if (expand && recs[i].ev.type == TR_MEMDIFF)
+      expand_diff(&recs[i].ev, (const int32_t *)recs[i].payload);
+    else
+      trace_format(&recs[i].ev, recs[i].payload, stdout);
+    free(recs[i].payload);
+  }
+  free(recs);
+  free(image);
+
+  return 0;
+}
@@ -0,0 +1,310 @@
+/*
+ * Synthetic workload generator
+ *
+ * Usage: wlgen [options] <name>
+ *   -n procs       processes in the config, up to WLGEN_MAX_PROCS (16)
+ *   -P programs    distinct programs the processes share (min(procs, 32))
+ *   -c cpus        CPUs (4)
+ *   -t slot        time slot (2)
+ *   -a arrival     poisson:RATE, RATE arrivals per slot on average, or
+ *                  bursty:SIZE:GAP, bursts of SIZE processes on average
+ *                  GAP slots apart on average (poisson:0.5)
+ *   -p mix         priorities and their weights, PRIO:WEIGHT,... (10:1,60:2,120:4)
+ *   -r ratio       share of calc instructions, the rest access memory (0.5)
+ *   -l length      instructions per program on average (20)
+ *   -w bytes       working set of a program (1024)
+ *   -L locality    chance an access stays on the page of the previous one (0.8)
+ *   -m ram         MEMRAM size (1048576)
+ *   -W swap        MEMSWP0 size (16777216)
+ *   -s seed        random seed (1), the same options and seed give the same files
+ *   -d dir         input directory (input)
+ *   -R             print the "start_time path prio" records to stdout for
+ *                  "./os <config> -" instead of writing the config
+ *
+ * Writes the config <dir>/<name> in the read_config() format and the
+ * programs <dir>/proc/<name>/p<k> in the load() format, run it with
+ * "./os <name>". The loader admits one process per slot, arrivals
+ * closer than that are delayed in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#define WLGEN_MAX_PROCS 100000
+#define WLGEN_MAX_MIX 16
+#define WLGEN_MAX_REGIONS 4
+#define WLGEN_PAGESZ 256 /* PAGING_PAGESZ */
+#define WLGEN_MAX_PRIO 140
+
+struct wl_opts {
+  int nprocs, nprogs, cpus, slot;
+  int bursty, records;
+  double rate, burst_size, burst_gap;
+  int mix_prio[WLGEN_MAX_MIX];
+  double mix_weight[WLGEN_MAX_MIX];
+  int nmix;
+  double calc_ratio, locality;
+  int length, wset;
+  long ram, swap;
+  uint64_t seed;
+  const char *dir, *name;
+};
+
+/* xorshift64*, the same sequence on every libc */
+static uint64_t rng_state;
+
+static uint64_t rng_next(void){
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+/* uniform in [0, 1) */
+static double rng_unit(void){
+  return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int rng_int(int n){
+  return (int)(rng_unit() * n);
+}
+
+static double rng_exp(double mean){
+  return -mean * log(1.0 - rng_unit());
+}
+
+static int parse_mix(struct wl_opts *o, char *spec){
+  char *tok, *save = NULL;
+
+  o->nmix = 0;
+  for (tok = strtok_r(spec, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)){
+    int prio;
+    double weight;
+
+    if (o->nmix == WLGEN_MAX_MIX || sscanf(tok, "%d:%lf", &prio, &weight) != 2 ||
+        prio < 0 || prio >= WLGEN_MAX_PRIO || weight <= 0)
+      return -1;
+    o->mix_prio[o->nmix] = prio;
+    o->mix_weight[o->nmix++] = weight;
+  }
+  return o->nmix > 0 ? 0 : -1;
+}
+
+static int pick_prio(const struct wl_opts *o){
+  double total = 0, x;
+  int i;
+
+  for (i = 0; i < o->nmix; i++)
+    total += o->mix_weight[i];
+  x = rng_unit() * total;
+  for (i = 0; i < o->nmix - 1; i++){
+    if (x < o->mix_weight[i])
+      break;
+    x -= o->mix_weight[i];
+  }
+  return o->mix_prio[i];
+}
+
+/*gen_arrivals - start slots of the processes, nondecreasing
+ *@o: options
+ *@start: return the start slot of each process
+ *
+ */
+static void gen_arrivals(const struct wl_opts *o, unsigned long *start){
+  double t = 0;
+  int i = 0;
+
+  while (i < o->nprocs){
+    if (!o->bursty){
+      start[i++] = (unsigned long)t;
+      t += rng_exp(1.0 / o->rate);
+    } else {
+      int size = 1 + (int)rng_exp(o->burst_size - 1);
+
+      while (size-- > 0 && i < o->nprocs)
+        start[i++] = (unsigned long)t;
+      t += rng_exp(o->burst_gap);
+    }
+  }
+}
+
+/*gen_program - write one program
+ *@o: options
+ *@path: program file
+ *@prio: priority in the header, the config overrides it under MLQ
+ *
+ * The working set is split into up to WLGEN_MAX_REGIONS regions
+ * allocated up front and freed at the end. Memory accesses walk it: with
+ * chance o->locality an access stays on the page of the previous one,
+ * otherwise it jumps anywhere in the working set. Writes and reads
+ * alternate at random.
+ */
+static int gen_program(const struct wl_opts *o, const char *path, int prio){
+  int nreg = (o->wset + 4 * WLGEN_PAGESZ - 1) / (4 * WLGEN_PAGESZ);
+  int rgsz, len, body, i, reg = 0, off = 0;
+  FILE *fp;
+
+  if (nreg > WLGEN_MAX_REGIONS)
+    nreg = WLGEN_MAX_REGIONS;
+  rgsz = (o->wset + nreg - 1) / nreg;
+  body = o->length / 2 + rng_int(o->length + 1);
+  len = nreg + body + nreg;
+
+  fp = fopen(path, "w");
+  if (fp == NULL)
+    return -1;
+  fprintf(fp, "%d %d\n", prio, len);
+
+  for (i = 0; i < nreg; i++)
+    fprintf(fp, "alloc %d %d\n", rgsz, i);
+
+  for (i = 0; i < body; i++){
+    if (rng_unit() < o->calc_ratio){
+      fprintf(fp, "calc\n");
+      continue;
+    }
+    if (rng_unit() < o->locality){
+      int page = off - off % WLGEN_PAGESZ;
+      int span = rgsz - page < WLGEN_PAGESZ ? rgsz - page : WLGEN_PAGESZ;
+
+      off = page + rng_int(span);
+    } else {
+      reg = rng_int(nreg);
+      off = rng_int(rgsz);
+    }
+    if (rng_unit() < 0.5)
+      fprintf(fp, "write %d %d %d\n", 1 + rng_int(255), reg, off);
+    else
+      fprintf(fp, "read %d %d %d\n", reg, off, 0);
+  }
+
+  for (i = 0; i < nreg; i++)
+    fprintf(fp, "free %d\n", i);
+
+  return fclose(fp);
+}
+
+static int gen_config(const struct wl_opts *o){
+  unsigned long *start = malloc(sizeof(unsigned long) * o->nprocs);
+  unsigned long last;
+  char path[512];
+  FILE *fp;
+  int i;
+
+  snprintf(path, sizeof(path), "%s/proc/%s", o->dir, o->name);
+  if (mkdir(path, 0755) < 0 && errno != EEXIST){
+    printf("wlgen: cannot create %s\n", path);
+    free(start);
+    return -1;
+  }
+  for (i = 0; i < o->nprogs; i++){
+    snprintf(path, sizeof(path), "%s/proc/%s/p%d", o->dir, o->name, i);
+    if (gen_program(o, path, pick_prio(o)) < 0){
+      printf("wlgen: cannot write %s\n", path);
+      free(start);
+      return -1;
+    }
+  }
+
+  snprintf(path, sizeof(path), "%s/%s", o->dir, o->name);
+  fp = o->records ? stdout : fopen(path, "w");
+  if (fp == NULL || start == NULL){
+    printf("wlgen: cannot write %s\n", path);
+    free(start);
+    return -1;
+  }
+  gen_arrivals(o, start);
+  if (!o->records){
+    fprintf(fp, "%d %d %d\n", o->slot, o->cpus, o->nprocs);
+    fprintf(fp, "%ld %ld 0 0 0\n", o->ram, o->swap);
+  }
+  for (i = 0; i < o->nprocs; i++)
+    fprintf(fp, "%lu %s/p%d %d\n", start[i], o->name, rng_int(o->nprogs), pick_prio(o));
+  if (fp != stdout)
+    fclose(fp);
+  last = start[o->nprocs - 1];
+  free(start);
+
+  fprintf(o->records ? stderr : stdout, "wlgen: %d processes arriving over %lu slots, %d programs in %s/proc/%s\n",
+          o->nprocs, last + 1, o->nprogs, o->dir, o->name);
+  return 0;
+}
+
+static void usage(void){
+  printf("Usage: wlgen [-n procs] [-P programs] [-c cpus] [-t slot] [-a poisson:RATE|bursty:SIZE:GAP]\n"
+         "             [-p PRIO:WEIGHT,...] [-r calc ratio] [-l length] [-w working set] [-L locality]\n"
+         "             [-m ram] [-W swap] [-s seed] [-d dir] [-R] <name>\n");
+}
+
+int main(int argc, char *argv[]){
+  struct wl_opts o = {
+    .nprocs = 16, .nprogs = 0, .cpus = 4, .slot = 2,
+    .bursty = 0, .rate = 0.5,
+    .calc_ratio = 0.5, .locality = 0.8, .length = 20, .wset = 1024,
+    .ram = 1048576, .swap = 16777216, .seed = 1, .dir = "input",
+  };
+  char mix[] = "10:1,60:2,120:4";
+  int i;
+
+  parse_mix(&o, mix);
+  for (i = 1; i < argc - 1 && argv[i][0] == '-'; i += 2){
+    const char *v = argv[i + 1];
+
+    if (argv[i][1] == 'R'){
+      o.records = 1;
+      i--;
+      continue;
+    }
+
+    switch (argv[i][1]){
+    case 'n': o.nprocs = atoi(v); break;
+    case 'P': o.nprogs = atoi(v); break;
+    case 'c': o.cpus = atoi(v); break;
+    case 't': o.slot = atoi(v); break;
+    case 'r': o.calc_ratio = atof(v); break;
+    case 'l': o.length = atoi(v); break;
+    case 'w': o.wset = atoi(v); break;
+    case 'L': o.locality = atof(v); break;
+    case 'm': o.ram = atol(v); break;
+    case 'W': o.swap = atol(v); break;
+    case 's': o.seed = strtoull(v, NULL, 0); break;
+    case 'd': o.dir = v; break;
+    case 'a':
+      if (sscanf(v, "poisson:%lf", &o.rate) == 1 && o.rate > 0){
+        o.bursty = 0;
+      } else if (sscanf(v, "bursty:%lf:%lf", &o.burst_size, &o.burst_gap) == 2 &&
+                 o.burst_size >= 1 && o.burst_gap >= 0){
+        o.bursty = 1;
+      } else {
+        usage();
+        return 1;
+      }
+      break;
+    case 'p':
+      if (parse_mix(&o, argv[i + 1]) < 0){
+        usage();
+        return 1;
+      }
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+  if (i != argc - 1 || o.nprocs < 1 || o.nprocs > WLGEN_MAX_PROCS || o.cpus < 1 || o.slot < 1 ||
+      o.length < 1 || o.wset < 1 || strlen(argv[i]) > 40){
+    usage();
+    return 1;
+  }
+  o.name = argv[i];
+  if (o.nprogs <= 0)
+    o.nprogs = o.nprocs < 32 ? o.nprocs : 32;
+  rng_state = o.seed ? o.seed : 1;
+
+  return gen_config(&o) < 0 ? 1 : 0;
+}